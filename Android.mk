@@ -84,6 +84,11 @@ LOCAL_SRC_FILES := \
 	brillo/android/weave/IWeaveServiceManagerNotificationListener.aidl \
 	common/binder_constants.cc \
 	common/binder_utils.cc \
+	common/command_snapshot.cc \
+	common/device_info.cc \
+	common/json_patch.cc \
+	common/parcelable_dictionary.cc \
+	common/versioned_json.cc \
 
 include $(BUILD_STATIC_LIBRARY)
 
@@ -109,12 +114,15 @@ LOCAL_SRC_FILES := \
 	buffet/ap_manager_client.cc \
 	buffet/avahi_mdns_client.cc \
 	buffet/binder_command_proxy.cc \
+	buffet/binder_dispatcher.cc \
 	buffet/binder_weave_service.cc \
 	buffet/buffet_config.cc \
 	buffet/dbus_constants.cc \
+	buffet/definition_loader.cc \
 	buffet/flouride_socket_bluetooth_client.cc \
 	buffet/http_transport_client.cc \
 	buffet/manager.cc \
+	buffet/request_body_reader.cc \
 	buffet/shill_client.cc \
 	buffet/socket_stream.cc \
 	buffet/webserv_client.cc \
@@ -195,8 +203,10 @@ LOCAL_C_INCLUDES := \
 
 LOCAL_SHARED_LIBRARIES := \
 	$(buffetSharedLibraries) \
+	libweaved \
 
 LOCAL_STATIC_LIBRARIES := \
+	libbinderwrapper_test_support \
 	libbrillo-test-helpers \
 	libchrome_test_helpers \
 	libgtest \
@@ -209,7 +219,52 @@ LOCAL_CLANG := true
 
 LOCAL_SRC_FILES := \
 	buffet/binder_command_proxy_unittest.cc \
+	buffet/binder_dispatcher_unittest.cc \
+	buffet/binder_weave_service_unittest.cc \
 	buffet/buffet_config_unittest.cc \
 	buffet/buffet_testrunner.cc \
+	buffet/definition_loader_unittest.cc \
+	buffet/http_transport_client_unittest.cc \
+	buffet/manager_unittest.cc \
+	buffet/mpsc_queue_unittest.cc \
+	buffet/request_body_reader_unittest.cc \
+	buffet/socket_stream_unittest.cc \
+	common/device_info_unittest.cc \
+	common/json_patch_unittest.cc \
+	common/parcelable_dictionary_unittest.cc \
+	libweaved/command_unittest.cc \
+	libweaved/service_unittest.cc \
 
 include $(BUILD_NATIVE_TEST)
+
+# weaved_benchmark
+# In-process microbenchmarks of the weaved IPC paths.
+# ========================================================
+include $(CLEAR_VARS)
+LOCAL_MODULE := weaved_benchmark
+LOCAL_MODULE_TAGS := eng
+LOCAL_CPP_EXTENSION := $(buffetCommonCppExtension)
+LOCAL_CFLAGS := $(buffetCommonCFlags)
+LOCAL_CPPFLAGS := $(buffetCommonCppFlags)
+LOCAL_C_INCLUDES := \
+	$(buffetCommonCIncludes) \
+	external/gmock/include \
+
+LOCAL_SHARED_LIBRARIES := \
+	$(buffetSharedLibraries) \
+	libweaved \
+
+LOCAL_STATIC_LIBRARIES := \
+	libbinderwrapper_test_support \
+	libgtest \
+	libgmock \
+	libweave-test \
+	weave-daemon-common \
+	weave-common \
+
+LOCAL_CLANG := true
+
+LOCAL_SRC_FILES := \
+	buffet/weaved_benchmark.cc \
+
+include $(BUILD_EXECUTABLE)
@@ -14,12 +14,20 @@
 
 #include "buffet/binder_command_proxy.h"
 
+#include <utility>
+
+#include <base/bind.h>
+#include <base/logging.h>
+#include <brillo/bind_lambda.h>
 #include <weave/enum_to_string.h>
 
+#include "buffet/binder_dispatcher.h"
 #include "buffet/weave_error_conversion.h"
 #include "common/binder_utils.h"
+#include "common/parcelable_dictionary.h"
 
 using weaved::binder_utils::ParseDictionary;
+using weaved::binder_utils::ToJson;
 using weaved::binder_utils::ToStatus;
 using weaved::binder_utils::ToString;
 using weaved::binder_utils::ToString16;
@@ -36,30 +44,82 @@ android::binder::Status ReportDestroyedError() {
 }  // anonymous namespace
 
 BinderCommandProxy::BinderCommandProxy(
-    const std::weak_ptr<weave::Command>& command) : command_{command} {}
+    const std::weak_ptr<weave::Command>& command,
+    const base::Closure& done_callback,
+    base::TimeDelta progress_interval)
+    : command_{command},
+      done_callback_{done_callback},
+      progress_interval_{progress_interval} {
+  auto command_instance = command.lock();
+  if (command_instance) {
+    id_ = command_instance->GetID();
+    name_ = command_instance->GetName();
+    component_ = command_instance->GetComponent();
+    origin_ = EnumToString(command_instance->GetOrigin());
+    parameters_ = ToJson(command_instance->GetParameters());
+  }
+}
+
+BinderCommandProxy::~BinderCommandProxy() {
+  // The last reference may be released on a binder thread.
+  BinderDispatcher::RunOnMainThread(
+      base::Bind(&BinderCommandProxy::Shutdown, base::Unretained(this)));
+}
+
+android::status_t BinderCommandProxy::onTransact(uint32_t code,
+                                                 const android::Parcel& data,
+                                                 android::Parcel* reply,
+                                                 uint32_t flags) {
+  using android::weave::IWeaveCommand;
+  switch (code) {
+    case IWeaveCommand::GETID:
+    case IWeaveCommand::GETNAME:
+    case IWeaveCommand::GETCOMPONENT:
+    case IWeaveCommand::GETORIGIN:
+    case IWeaveCommand::GETPARAMETERS:
+      return BnWeaveCommand::onTransact(code, data, reply, flags);
+  }
+  return BinderDispatcher::TransactOnMainThread(base::Bind([&]() {
+    return BnWeaveCommand::onTransact(code, data, reply, flags);
+  }));
+}
+
+void BinderCommandProxy::Shutdown() {
+  FlushProgress();
+  NotifyDone();
+  weak_ptr_factory_.InvalidateWeakPtrs();
+}
+
+void BinderCommandProxy::NotifyDone() {
+  if (done_callback_.is_null())
+    return;
+  base::Closure callback = done_callback_;
+  done_callback_.Reset();
+  callback.Run();
+}
 
 android::binder::Status BinderCommandProxy::getId(android::String16* id) {
-  auto command = command_.lock();
-  if (!command)
+  // May run on a binder thread, see onTransact().
+  if (command_.expired())
     return ReportDestroyedError();
-  *id = ToString16(command->GetID());
+  *id = ToString16(id_);
   return android::binder::Status::ok();
 }
 
 android::binder::Status BinderCommandProxy::getName(android::String16* name) {
-  auto command = command_.lock();
-  if (!command)
+  // May run on a binder thread, see onTransact().
+  if (command_.expired())
     return ReportDestroyedError();
-  *name = ToString16(command->GetName());
+  *name = ToString16(name_);
   return android::binder::Status::ok();
 }
 
 android::binder::Status BinderCommandProxy::getComponent(
     android::String16* component) {
-  auto command = command_.lock();
-  if (!command)
+  // May run on a binder thread, see onTransact().
+  if (command_.expired())
     return ReportDestroyedError();
-  *component = ToString16(command->GetComponent());
+  *component = ToString16(component_);
   return android::binder::Status::ok();
 }
 
@@ -73,19 +133,19 @@ android::binder::Status BinderCommandProxy::getState(android::String16* state) {
 
 android::binder::Status BinderCommandProxy::getOrigin(
     android::String16* origin) {
-  auto command = command_.lock();
-  if (!command)
+  // May run on a binder thread, see onTransact().
+  if (command_.expired())
     return ReportDestroyedError();
-  *origin = ToString16(EnumToString(command->GetOrigin()));
+  *origin = ToString16(origin_);
   return android::binder::Status::ok();
 }
 
 android::binder::Status BinderCommandProxy::getParameters(
     android::String16* parameters) {
-  auto command = command_.lock();
-  if (!command)
+  // May run on a binder thread, see onTransact().
+  if (command_.expired())
     return ReportDestroyedError();
-  *parameters = ToString16(command->GetParameters());
+  *parameters = ToString16(parameters_);
   return android::binder::Status::ok();
 }
 
@@ -94,7 +154,8 @@ android::binder::Status BinderCommandProxy::getProgress(
   auto command = command_.lock();
   if (!command)
     return ReportDestroyedError();
-  *progress = ToString16(command->GetProgress());
+  *progress = ToString16(pending_progress_ ? *pending_progress_
+                                           : command->GetProgress());
   return android::binder::Status::ok();
 }
 
@@ -107,6 +168,23 @@ android::binder::Status BinderCommandProxy::getResults(
   return android::binder::Status::ok();
 }
 
+android::binder::Status BinderCommandProxy::getSnapshot(
+    android::weave::CommandSnapshot* snapshot) {
+  auto command = command_.lock();
+  if (!command)
+    return ReportDestroyedError();
+  snapshot->id = id_;
+  snapshot->name = name_;
+  snapshot->component = component_;
+  snapshot->state = EnumToString(command->GetState());
+  snapshot->origin = origin_;
+  snapshot->parameters = parameters_;
+  snapshot->progress =
+      ToJson(pending_progress_ ? *pending_progress_ : command->GetProgress());
+  snapshot->results = ToJson(command->GetResults());
+  return android::binder::Status::ok();
+}
+
 android::binder::Status BinderCommandProxy::setProgress(
     const android::String16& progress) {
   auto command = command_.lock();
@@ -114,11 +192,83 @@ android::binder::Status BinderCommandProxy::setProgress(
     return ReportDestroyedError();
   std::unique_ptr<base::DictionaryValue> dict;
   auto status = ParseDictionary(progress, &dict);
-  if (status.isOk()) {
-    weave::ErrorPtr error;
-    status = ToStatus(command->SetProgress(*dict, &error), &error);
+  if (!status.isOk())
+    return status;
+  return SubmitProgress(command.get(), std::move(dict));
+}
+
+android::binder::Status BinderCommandProxy::updateProgress(
+    const android::weave::ParcelableDictionary& changed,
+    const std::vector<android::String16>& removed) {
+  auto command = command_.lock();
+  if (!command)
+    return ReportDestroyedError();
+  // The difference is relative to the last progress the client has set.
+  std::unique_ptr<base::DictionaryValue> progress;
+  if (pending_progress_)
+    progress = std::move(pending_progress_);
+  else
+    progress.reset(command->GetProgress().DeepCopy());
+  for (const android::String16& name : removed)
+    progress->RemoveWithoutPathExpansion(ToString(name), nullptr);
+  for (base::DictionaryValue::Iterator it(changed.dict()); !it.IsAtEnd();
+       it.Advance()) {
+    progress->SetWithoutPathExpansion(it.key(), it.value().DeepCopy());
   }
-  return status;
+  return SubmitProgress(command.get(), std::move(progress));
+}
+
+android::binder::Status BinderCommandProxy::SubmitProgress(
+    weave::Command* command,
+    std::unique_ptr<base::DictionaryValue> progress) {
+  if (progress_task_ != brillo::MessageLoop::kTaskIdNull) {
+    pending_progress_ = std::move(progress);
+    return android::binder::Status::ok();
+  }
+  weave::ErrorPtr error;
+  bool success = command->SetProgress(*progress, &error);
+  if (success && !progress_interval_.is_zero()) {
+    progress_task_ = brillo::MessageLoop::current()->PostDelayedTask(
+        FROM_HERE,
+        base::Bind(&BinderCommandProxy::OnProgressInterval,
+                   weak_ptr_factory_.GetWeakPtr()),
+        progress_interval_);
+  }
+  return ToStatus(success, &error);
+}
+
+void BinderCommandProxy::OnProgressInterval() {
+  progress_task_ = brillo::MessageLoop::kTaskIdNull;
+  if (!pending_progress_ || !ApplyPendingProgress())
+    return;
+  progress_task_ = brillo::MessageLoop::current()->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&BinderCommandProxy::OnProgressInterval,
+                 weak_ptr_factory_.GetWeakPtr()),
+      progress_interval_);
+}
+
+void BinderCommandProxy::FlushProgress() {
+  if (progress_task_ != brillo::MessageLoop::kTaskIdNull) {
+    brillo::MessageLoop::current()->CancelTask(progress_task_);
+    progress_task_ = brillo::MessageLoop::kTaskIdNull;
+  }
+  if (pending_progress_)
+    ApplyPendingProgress();
+}
+
+bool BinderCommandProxy::ApplyPendingProgress() {
+  std::unique_ptr<base::DictionaryValue> progress{
+      std::move(pending_progress_)};
+  auto command = command_.lock();
+  if (!command)
+    return false;
+  weave::ErrorPtr error;
+  if (!command->SetProgress(*progress, &error)) {
+    LOG(ERROR) << "Failed to update command progress: " << error->GetMessage();
+    return false;
+  }
+  return true;
 }
 
 android::binder::Status BinderCommandProxy::complete(
@@ -126,12 +276,15 @@ android::binder::Status BinderCommandProxy::complete(
   auto command = command_.lock();
   if (!command)
     return ReportDestroyedError();
+  FlushProgress();
   std::unique_ptr<base::DictionaryValue> dict;
   auto status = ParseDictionary(results, &dict);
   if (status.isOk()) {
     weave::ErrorPtr error;
     status = ToStatus(command->Complete(*dict, &error), &error);
   }
+  if (status.isOk())
+    NotifyDone();
   return status;
 }
 
@@ -141,25 +294,34 @@ android::binder::Status BinderCommandProxy::abort(
   auto command = command_.lock();
   if (!command)
     return ReportDestroyedError();
+  FlushProgress();
   weave::ErrorPtr command_error;
   weave::Error::AddTo(&command_error, FROM_HERE, ToString(errorCode),
                       ToString(errorMessage));
   weave::ErrorPtr error;
-  return ToStatus(command->Abort(command_error.get(), &error), &error);
+  bool success = command->Abort(command_error.get(), &error);
+  if (success)
+    NotifyDone();
+  return ToStatus(success, &error);
 }
 
 android::binder::Status BinderCommandProxy::cancel() {
   auto command = command_.lock();
   if (!command)
     return ReportDestroyedError();
+  FlushProgress();
   weave::ErrorPtr error;
-  return ToStatus(command->Cancel(&error), &error);
+  bool success = command->Cancel(&error);
+  if (success)
+    NotifyDone();
+  return ToStatus(success, &error);
 }
 
 android::binder::Status BinderCommandProxy::pause() {
   auto command = command_.lock();
   if (!command)
     return ReportDestroyedError();
+  FlushProgress();
   weave::ErrorPtr error;
   return ToStatus(command->Pause(&error), &error);
 }
@@ -170,6 +332,7 @@ android::binder::Status BinderCommandProxy::setError(
   auto command = command_.lock();
   if (!command)
     return ReportDestroyedError();
+  FlushProgress();
   weave::ErrorPtr command_error;
   weave::Error::AddTo(&command_error, FROM_HERE, ToString(errorCode),
                       ToString(errorMessage));
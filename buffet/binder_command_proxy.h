@@ -15,9 +15,16 @@
 #ifndef BUFFET_BINDER_COMMAND_PROXY_H_
 #define BUFFET_BINDER_COMMAND_PROXY_H_
 
+#include <memory>
 #include <string>
+#include <vector>
 
+#include <base/callback.h>
 #include <base/macros.h>
+#include <base/memory/weak_ptr.h>
+#include <base/time/time.h>
+#include <base/values.h>
+#include <brillo/message_loops/message_loop.h>
 #include <weave/command.h>
 
 #include "android/weave/BnWeaveCommand.h"
@@ -27,10 +34,24 @@ namespace buffet {
 // Implementation of android::weave::IWeaveCommand binder object.
 // This class simply redirects binder calls to the underlying weave::Command
 // object (and performs necessary parameter/result type conversions).
+// |done_callback| is invoked once the client is done with the command: when
+// it completes, aborts or cancels the command, or releases the proxy.
+// If |progress_interval| is not zero, progress updates are passed on to the
+// command at most once per |progress_interval|. The updates received in
+// between are coalesced and only the last one is applied, so errors in them
+// can only be logged. Pending progress is applied right away before any other
+// change to the command.
+// The properties that never change during the lifetime of a command (ID, name,
+// component, origin and parameters) are copied at construction and are served
+// on the calling binder thread. All the other calls run on the main thread
+// (see BinderDispatcher).
 class BinderCommandProxy : public android::weave::BnWeaveCommand {
  public:
-  explicit BinderCommandProxy(const std::weak_ptr<weave::Command>& command);
-  ~BinderCommandProxy() override = default;
+  explicit BinderCommandProxy(
+      const std::weak_ptr<weave::Command>& command,
+      const base::Closure& done_callback = base::Closure(),
+      base::TimeDelta progress_interval = base::TimeDelta());
+  ~BinderCommandProxy() override;
 
   android::binder::Status getId(android::String16* id) override;
   android::binder::Status getName(android::String16* name) override;
@@ -40,8 +61,13 @@ class BinderCommandProxy : public android::weave::BnWeaveCommand {
   android::binder::Status getParameters(android::String16* parameters) override;
   android::binder::Status getProgress(android::String16* progress) override;
   android::binder::Status getResults(android::String16* results) override;
+  android::binder::Status getSnapshot(
+      android::weave::CommandSnapshot* snapshot) override;
   android::binder::Status setProgress(
       const android::String16& progress) override;
+  android::binder::Status updateProgress(
+      const android::weave::ParcelableDictionary& changed,
+      const std::vector<android::String16>& removed) override;
   android::binder::Status complete(const android::String16& results) override;
   android::binder::Status abort(const android::String16& errorCode,
                                 const android::String16& errorMessage) override;
@@ -52,7 +78,51 @@ class BinderCommandProxy : public android::weave::BnWeaveCommand {
       const android::String16& errorMessage) override;
 
  private:
+  android::status_t onTransact(uint32_t code,
+                               const android::Parcel& data,
+                               android::Parcel* reply,
+                               uint32_t flags) override;
+
+  // Applies the pending progress and reports the command as done. Runs on the
+  // main thread when the proxy is destroyed.
+  void Shutdown();
+
+  // Invokes |done_callback_| unless it has been invoked already.
+  void NotifyDone();
+
+  // Applies |progress| to |command| now, or keeps it as the pending progress
+  // if an update was applied less than |progress_interval_| ago.
+  android::binder::Status SubmitProgress(
+      weave::Command* command,
+      std::unique_ptr<base::DictionaryValue> progress);
+
+  // Applies the pending progress, if any, and starts a new throttling interval
+  // if it was applied successfully.
+  void OnProgressInterval();
+
+  // Applies the pending progress right away and ends the throttling interval.
+  void FlushProgress();
+
+  // Applies the pending progress to the command. Errors are logged.
+  bool ApplyPendingProgress();
+
   std::weak_ptr<weave::Command> command_;
+  base::Closure done_callback_;
+
+  // Immutable copies of the command properties.
+  std::string id_;
+  std::string name_;
+  std::string component_;
+  std::string origin_;
+  std::string parameters_;
+
+  base::TimeDelta progress_interval_;
+  // The latest progress not yet passed on to the command.
+  std::unique_ptr<base::DictionaryValue> pending_progress_;
+  // Runs at the end of the current throttling interval.
+  brillo::MessageLoop::TaskId progress_task_{brillo::MessageLoop::kTaskIdNull};
+
+  base::WeakPtrFactory<BinderCommandProxy> weak_ptr_factory_{this};
 
   DISALLOW_COPY_AND_ASSIGN(BinderCommandProxy);
 };
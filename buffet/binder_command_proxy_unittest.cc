@@ -16,6 +16,9 @@
 
 #include <memory>
 
+#include <base/bind.h>
+#include <brillo/bind_lambda.h>
+#include <brillo/message_loops/fake_message_loop.h>
 #include <gtest/gtest.h>
 #include <weave/command.h>
 #include <weave/enum_to_string.h>
@@ -23,6 +26,7 @@
 #include <weave/test/unittest_utils.h>
 
 #include "common/binder_utils.h"
+#include "common/parcelable_dictionary.h"
 
 using weaved::binder_utils::ToString;
 using weaved::binder_utils::ToString16;
@@ -124,6 +128,25 @@ TEST_F(BinderCommandProxyTest, Init) {
   EXPECT_EQ(kTestCommandId, ToString(result));
 }
 
+TEST_F(BinderCommandProxyTest, GetSnapshot) {
+  android::weave::CommandSnapshot snapshot;
+  EXPECT_TRUE(GetCommandProxy()->getSnapshot(&snapshot).isOk());
+  EXPECT_EQ(kTestCommandId, snapshot.id);
+  EXPECT_EQ("robot.jump", snapshot.name);
+  EXPECT_EQ("myComponent", snapshot.component);
+  EXPECT_EQ("queued", snapshot.state);
+  EXPECT_EQ("local", snapshot.origin);
+  EXPECT_EQ(R"({"_jumpType":"_withKick","height":53})", snapshot.parameters);
+  EXPECT_EQ("{}", snapshot.progress);
+  EXPECT_EQ("{}", snapshot.results);
+}
+
+TEST_F(BinderCommandProxyTest, GetSnapshotDestroyed) {
+  command_.reset();
+  android::weave::CommandSnapshot snapshot;
+  EXPECT_FALSE(GetCommandProxy()->getSnapshot(&snapshot).isOk());
+}
+
 TEST_F(BinderCommandProxyTest, SetProgress) {
   EXPECT_CALL(*command_, SetProgress(EqualToJson("{'progress': 10}"), _))
       .WillOnce(Return(true));
@@ -131,6 +154,62 @@ TEST_F(BinderCommandProxyTest, SetProgress) {
       GetCommandProxy()->setProgress(ToString16(R"({"progress": 10})")).isOk());
 }
 
+TEST_F(BinderCommandProxyTest, UpdateProgress) {
+  base::DictionaryValue progress;
+  progress.SetInteger("percent", 10);
+  progress.SetString("status", "downloading");
+  progress.SetString("file", "update.bin");
+  EXPECT_CALL(*command_, GetProgress()).WillRepeatedly(ReturnRef(progress));
+  EXPECT_CALL(*command_,
+              SetProgress(EqualToJson("{'percent': 20, 'file': 'update.bin',"
+                                      " 'stage': 'verify'}"),
+                          _))
+      .WillOnce(Return(true));
+
+  base::DictionaryValue changed;
+  changed.SetInteger("percent", 20);
+  changed.SetString("stage", "verify");
+  EXPECT_TRUE(GetCommandProxy()
+                  ->updateProgress(
+                      android::weave::ParcelableDictionary{&changed},
+                      {ToString16("status")})
+                  .isOk());
+}
+
+TEST_F(BinderCommandProxyTest, ThrottleProgress) {
+  brillo::FakeMessageLoop message_loop{nullptr};
+  message_loop.SetAsCurrent();
+  proxy_.reset(new BinderCommandProxy{std::weak_ptr<weave::Command>{command_},
+                                      base::Closure(),
+                                      base::TimeDelta::FromSeconds(1)});
+
+  testing::InSequence sequence;
+  EXPECT_CALL(*command_, SetProgress(EqualToJson("{'progress': 10}"), _))
+      .WillOnce(Return(true));
+  EXPECT_CALL(*command_, SetProgress(EqualToJson("{'progress': 30}"), _))
+      .WillOnce(Return(true));
+  EXPECT_CALL(*command_, SetProgress(EqualToJson("{'progress': 40}"), _))
+      .WillOnce(Return(true));
+  EXPECT_CALL(*command_, Complete(EqualToJson("{}"), _))
+      .WillOnce(Return(true));
+
+  // The first update is applied right away, the next ones are coalesced until
+  // the interval expires.
+  EXPECT_TRUE(
+      GetCommandProxy()->setProgress(ToString16(R"({"progress": 10})")).isOk());
+  EXPECT_TRUE(
+      GetCommandProxy()->setProgress(ToString16(R"({"progress": 20})")).isOk());
+  EXPECT_TRUE(
+      GetCommandProxy()->setProgress(ToString16(R"({"progress": 30})")).isOk());
+  EXPECT_TRUE(message_loop.RunOnce(true));
+
+  // Completing the command applies the pending progress first.
+  EXPECT_TRUE(
+      GetCommandProxy()->setProgress(ToString16(R"({"progress": 40})")).isOk());
+  EXPECT_TRUE(GetCommandProxy()->complete(ToString16("{}")).isOk());
+  EXPECT_FALSE(message_loop.RunOnce(false));
+}
+
 TEST_F(BinderCommandProxyTest, Complete) {
   EXPECT_CALL(
       *command_,
@@ -160,4 +239,32 @@ TEST_F(BinderCommandProxyTest, Pause) {
   EXPECT_TRUE(GetCommandProxy()->pause().isOk());
 }
 
+TEST_F(BinderCommandProxyTest, DoneCallback) {
+  int done_count = 0;
+  proxy_.reset(new BinderCommandProxy{
+      std::weak_ptr<weave::Command>{command_},
+      base::Bind([&done_count]() { done_count++; })});
+
+  EXPECT_CALL(*command_, Pause(_)).WillOnce(Return(true));
+  EXPECT_TRUE(GetCommandProxy()->pause().isOk());
+  EXPECT_EQ(0, done_count);
+
+  EXPECT_CALL(*command_, Cancel(_)).WillOnce(Return(true));
+  EXPECT_TRUE(GetCommandProxy()->cancel().isOk());
+  EXPECT_EQ(1, done_count);
+
+  // Releasing the proxy does not report the command again.
+  proxy_.reset();
+  EXPECT_EQ(1, done_count);
+}
+
+TEST_F(BinderCommandProxyTest, DoneCallbackOnRelease) {
+  int done_count = 0;
+  proxy_.reset(new BinderCommandProxy{
+      std::weak_ptr<weave::Command>{command_},
+      base::Bind([&done_count]() { done_count++; })});
+  proxy_.reset();
+  EXPECT_EQ(1, done_count);
+}
+
 }  // namespace buffet
@@ -0,0 +1,244 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/binder_dispatcher.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <base/bind.h>
+#include <base/files/scoped_file.h>
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+#include <base/synchronization/waitable_event.h>
+#include <base/threading/platform_thread.h>
+#include <binder/ProcessState.h>
+
+#include "buffet/mpsc_queue.h"
+
+namespace buffet {
+
+class BinderTaskQueue final {
+ public:
+  explicit BinderTaskQueue(base::ScopedFD event_fd)
+      : event_fd_{std::move(event_fd)} {}
+
+  int event_fd() const { return event_fd_.get(); }
+
+  // Queues |closure| for the main thread. Once the task has run, or has been
+  // dropped because the queue is closed, |*ran| is set accordingly and |done|
+  // is signaled. |done| and |ran| may be nullptr if nobody waits for the task.
+  void Post(const base::Closure& closure,
+            base::WaitableEvent* done,
+            bool* ran) {
+    std::unique_ptr<Task> task{new Task{closure, done, ran}};
+    if (closed_.load()) {
+      Finish(task.get(), false);
+      return;
+    }
+    bool was_empty = tasks_.Push(std::move(task));
+    // Pairs with the fence in Close(): either Close() drops this task, or
+    // this thread sees |closed_| and drops it itself.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (closed_.load(std::memory_order_relaxed)) {
+      DropPending();
+      return;
+    }
+    // Only the first task queued since the main thread last emptied the queue
+    // needs to wake it up.
+    if (!was_empty)
+      return;
+    uint64_t value = 1;
+    if (HANDLE_EINTR(write(event_fd_.get(), &value, sizeof(value))) < 0)
+      PLOG(ERROR) << "Failed to signal eventfd";
+  }
+
+  // Runs the queued tasks when the eventfd is signaled. Called on the main
+  // thread.
+  void RunPending() {
+    uint64_t value = 0;
+    if (HANDLE_EINTR(read(event_fd_.get(), &value, sizeof(value))) < 0 &&
+        errno != EAGAIN) {
+      PLOG(ERROR) << "Failed to read eventfd";
+    }
+    for (const auto& task : tasks_.PopAll()) {
+      task->closure.Run();
+      Finish(task.get(), true);
+    }
+  }
+
+  // Drops the queued tasks and makes Post() drop any later ones. Called on
+  // the main thread.
+  void Close() {
+    closed_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    DropPending();
+  }
+
+ private:
+  struct Task {
+    base::Closure closure;
+    base::WaitableEvent* done;
+    bool* ran;
+  };
+
+  static void Finish(Task* task, bool ran) {
+    if (task->ran)
+      *task->ran = ran;
+    if (task->done)
+      task->done->Signal();
+  }
+
+  // PopAll() takes the whole list at once, so this is safe to call on any
+  // thread, concurrently with the main thread.
+  void DropPending() {
+    std::vector<std::unique_ptr<Task>> tasks = tasks_.PopAll();
+    if (!tasks.empty()) {
+      LOG(WARNING) << "Dropping " << tasks.size()
+                   << " binder tasks on shutdown";
+    }
+    for (const auto& task : tasks)
+      Finish(task.get(), false);
+  }
+
+  base::ScopedFD event_fd_;
+  std::atomic<bool> closed_{false};
+  MpscQueue<Task> tasks_;
+
+  DISALLOW_COPY_AND_ASSIGN(BinderTaskQueue);
+};
+
+namespace {
+
+// The main thread of the running dispatcher. Never reset, so that binder
+// threads, which outlive the dispatcher, never take themselves for the main
+// thread.
+std::atomic<base::PlatformThreadId> g_main_thread_id{base::kInvalidThreadId};
+
+// The queue of the running dispatcher, accessed with std::atomic_load() and
+// std::atomic_store(). It is published before the binder threads start.
+std::shared_ptr<BinderTaskQueue> g_queue;
+
+}  // anonymous namespace
+
+BinderDispatcher::BinderDispatcher(
+    const std::shared_ptr<BinderTaskQueue>& queue)
+    : queue_{queue} {}
+
+BinderDispatcher::~BinderDispatcher() {
+  if (watch_task_ != brillo::MessageLoop::kTaskIdNull)
+    brillo::MessageLoop::current()->CancelTask(watch_task_);
+  std::atomic_store(&g_queue, std::shared_ptr<BinderTaskQueue>{});
+  // Releases the binder threads waiting for their tasks to run.
+  queue_->Close();
+}
+
+std::unique_ptr<BinderDispatcher> BinderDispatcher::Start(
+    size_t thread_count) {
+  std::unique_ptr<BinderDispatcher> dispatcher = Create();
+  if (!dispatcher)
+    return nullptr;
+  android::sp<android::ProcessState> process_state =
+      android::ProcessState::self();
+  process_state->setThreadPoolMaxThreadCount(thread_count);
+  process_state->startThreadPool();
+  return dispatcher;
+}
+
+std::unique_ptr<BinderDispatcher> BinderDispatcher::Create() {
+  CHECK(!std::atomic_load(&g_queue));
+  base::ScopedFD event_fd{eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)};
+  if (!event_fd.is_valid()) {
+    PLOG(ERROR) << "Failed to create eventfd";
+    return nullptr;
+  }
+  auto queue = std::make_shared<BinderTaskQueue>(std::move(event_fd));
+  std::unique_ptr<BinderDispatcher> dispatcher{new BinderDispatcher{queue}};
+  dispatcher->watch_task_ = brillo::MessageLoop::current()->WatchFileDescriptor(
+      FROM_HERE, queue->event_fd(), brillo::MessageLoop::kWatchRead, true,
+      base::Bind(&BinderTaskQueue::RunPending, base::Unretained(queue.get())));
+  if (dispatcher->watch_task_ == brillo::MessageLoop::kTaskIdNull) {
+    LOG(ERROR) << "Failed to watch eventfd";
+    return nullptr;
+  }
+
+  g_main_thread_id.store(base::PlatformThread::CurrentId());
+  std::atomic_store(&g_queue, queue);
+  return dispatcher;
+}
+
+bool BinderDispatcher::IsMainThread() {
+  base::PlatformThreadId main_thread_id = g_main_thread_id.load();
+  return main_thread_id == base::kInvalidThreadId ||
+         base::PlatformThread::CurrentId() == main_thread_id;
+}
+
+bool BinderDispatcher::RunOnMainThread(const base::Closure& task) {
+  if (IsMainThread()) {
+    task.Run();
+    return true;
+  }
+  std::shared_ptr<BinderTaskQueue> queue = std::atomic_load(&g_queue);
+  if (!queue) {
+    LOG(WARNING) << "Dropping binder task on shutdown";
+    return false;
+  }
+  base::WaitableEvent done{false, false};
+  bool ran = false;
+  queue->Post(task, &done, &ran);
+  done.Wait();
+  return ran;
+}
+
+android::status_t BinderDispatcher::TransactOnMainThread(
+    const base::Callback<android::status_t()>& transact) {
+  if (IsMainThread())
+    return transact.Run();
+  android::status_t status = android::DEAD_OBJECT;
+  RunOnMainThread(
+      base::Bind(&BinderDispatcher::RunTransact, transact, &status));
+  return status;
+}
+
+void BinderDispatcher::RunTransact(
+    const base::Callback<android::status_t()>& transact,
+    android::status_t* status) {
+  *status = transact.Run();
+}
+
+base::Closure BinderDispatcher::BindToMainThread(
+    const base::Closure& callback) {
+  if (g_main_thread_id.load() == base::kInvalidThreadId)
+    return callback;
+  return base::Bind(&BinderDispatcher::PostToMainThread, callback);
+}
+
+void BinderDispatcher::PostToMainThread(const base::Closure& closure) {
+  if (IsMainThread()) {
+    closure.Run();
+    return;
+  }
+  std::shared_ptr<BinderTaskQueue> queue = std::atomic_load(&g_queue);
+  if (queue)
+    queue->Post(closure, nullptr, nullptr);
+}
+
+}  // namespace buffet
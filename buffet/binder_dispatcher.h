@@ -0,0 +1,92 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BUFFET_BINDER_DISPATCHER_H_
+#define BUFFET_BINDER_DISPATCHER_H_
+
+#include <memory>
+
+#include <base/callback.h>
+#include <base/macros.h>
+#include <brillo/message_loops/message_loop.h>
+#include <utils/Errors.h>
+
+namespace buffet {
+
+// The queue of tasks for the main thread, defined in binder_dispatcher.cc.
+// Binder threads keep it alive while they post a task, so it may outlive the
+// dispatcher.
+class BinderTaskQueue;
+
+// By default weaved serves binder calls on its main thread, from the message
+// loop. The BinderDispatcher enables serving them on a pool of binder threads
+// instead. The weave device and the rest of the daemon state remain confined
+// to the main thread: binder objects serve the calls that only read immutable
+// snapshots on the binder thread directly and hand everything else over to the
+// main thread with RunOnMainThread(). The hand-over goes through a lock-free
+// queue and an eventfd watched by the main message loop.
+//
+// All the static methods work whether or not a dispatcher has been started,
+// so the binder objects do not need to know which mode weaved runs in.
+class BinderDispatcher final {
+ public:
+  // Stops dispatching to the main thread. Tasks still queued are dropped and
+  // their callers released, as are the callers of any later RunOnMainThread()
+  // from a binder thread.
+  ~BinderDispatcher();
+
+  // Starts a pool of up to |thread_count| binder threads. Must be called on
+  // the main thread, which needs a current brillo::MessageLoop. Returns
+  // nullptr on failure. Only one dispatcher may exist at a time.
+  static std::unique_ptr<BinderDispatcher> Start(size_t thread_count);
+  // Same as Start(), but without starting any binder threads. Used by tests,
+  // whose own threads stand in for the binder threads.
+  static std::unique_ptr<BinderDispatcher> Create();
+
+  // Returns true if called on the main thread, or if no binder thread pool
+  // has ever been started.
+  static bool IsMainThread();
+
+  // Runs |task| on the main thread and waits for it to complete. The task
+  // runs right away if called on the main thread. Returns false if the task
+  // was dropped because the dispatcher is shutting down.
+  static bool RunOnMainThread(const base::Closure& task);
+
+  // Runs the binder transaction |transact| on the main thread and returns its
+  // result, or DEAD_OBJECT once the dispatcher is shutting down. Meant for
+  // the onTransact() overrides of the binder objects.
+  static android::status_t TransactOnMainThread(
+      const base::Callback<android::status_t()>& transact);
+
+  // Returns a callback that runs |callback| on the main thread without
+  // waiting for it, for callbacks that may be invoked on a binder thread, such
+  // as death notifications.
+  static base::Closure BindToMainThread(const base::Closure& callback);
+
+ private:
+  explicit BinderDispatcher(const std::shared_ptr<BinderTaskQueue>& queue);
+
+  static void PostToMainThread(const base::Closure& closure);
+  static void RunTransact(const base::Callback<android::status_t()>& transact,
+                          android::status_t* status);
+
+  std::shared_ptr<BinderTaskQueue> queue_;
+  brillo::MessageLoop::TaskId watch_task_{brillo::MessageLoop::kTaskIdNull};
+
+  DISALLOW_COPY_AND_ASSIGN(BinderDispatcher);
+};
+
+}  // namespace buffet
+
+#endif  // BUFFET_BINDER_DISPATCHER_H_
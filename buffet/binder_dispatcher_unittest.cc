@@ -0,0 +1,92 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/binder_dispatcher.h"
+
+#include <memory>
+#include <thread>
+
+#include <base/bind.h>
+#include <base/message_loop/message_loop.h>
+#include <brillo/bind_lambda.h>
+#include <brillo/message_loops/base_message_loop.h>
+#include <gtest/gtest.h>
+
+namespace buffet {
+
+class BinderDispatcherTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    message_loop_.SetAsCurrent();
+    dispatcher_ = BinderDispatcher::Create();
+    ASSERT_NE(nullptr, dispatcher_.get());
+  }
+
+ protected:
+  base::MessageLoopForIO base_loop_;
+  brillo::BaseMessageLoop message_loop_{&base_loop_};
+  std::unique_ptr<BinderDispatcher> dispatcher_;
+};
+
+TEST_F(BinderDispatcherTest, RunOnMainThread) {
+  EXPECT_TRUE(BinderDispatcher::IsMainThread());
+  bool ran = false;
+  BinderDispatcher::RunOnMainThread(base::Bind([&ran]() { ran = true; }));
+  EXPECT_TRUE(ran);
+
+  bool on_main_thread = false;
+  bool binder_thread_result = false;
+  std::thread binder_thread{[&]() {
+    EXPECT_FALSE(BinderDispatcher::IsMainThread());
+    binder_thread_result =
+        BinderDispatcher::RunOnMainThread(base::Bind([&]() {
+          on_main_thread = BinderDispatcher::IsMainThread();
+          message_loop_.BreakLoop();
+        }));
+  }};
+  message_loop_.Run();
+  binder_thread.join();
+  EXPECT_TRUE(on_main_thread);
+  EXPECT_TRUE(binder_thread_result);
+}
+
+TEST_F(BinderDispatcherTest, TransactOnMainThread) {
+  android::status_t status = android::OK;
+  std::thread binder_thread{[&]() {
+    status = BinderDispatcher::TransactOnMainThread(base::Bind([this]() {
+      message_loop_.BreakLoop();
+      return android::BAD_VALUE;
+    }));
+  }};
+  message_loop_.Run();
+  binder_thread.join();
+  EXPECT_EQ(android::BAD_VALUE, status);
+}
+
+TEST_F(BinderDispatcherTest, ShutdownReleasesBinderThreads) {
+  bool ran = false;
+  bool result = true;
+  // The task is either dropped from the queue on shutdown or posted after
+  // it, but never runs and never leaves the binder thread waiting.
+  std::thread binder_thread{[&]() {
+    result = BinderDispatcher::RunOnMainThread(
+        base::Bind([&ran]() { ran = true; }));
+  }};
+  dispatcher_.reset();
+  binder_thread.join();
+  EXPECT_FALSE(result);
+  EXPECT_FALSE(ran);
+}
+
+}  // namespace buffet
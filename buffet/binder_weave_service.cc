@@ -17,10 +17,17 @@
 #include <algorithm>
 
 #include <base/bind.h>
+#include <base/logging.h>
+#include <base/strings/string_util.h>
+#include <base/strings/stringprintf.h>
+#include <brillo/bind_lambda.h>
+#include <brillo/strings/string_utils.h>
 #include <weave/command.h>
 #include <weave/device.h>
+#include <weave/error.h>
 
 #include "buffet/binder_command_proxy.h"
+#include "buffet/binder_dispatcher.h"
 #include "common/binder_utils.h"
 
 using weaved::binder_utils::ToStatus;
@@ -29,42 +36,279 @@ using weaved::binder_utils::ToString16;
 
 namespace buffet {
 
+namespace {
+
+// Returns the component definition at the given |path| in the component
+// tree. Nested components are separated by dots ("parent.child"). Elements of
+// component arrays are not supported.
+const base::DictionaryValue* FindComponent(
+    const base::DictionaryValue& components,
+    const std::string& path) {
+  const base::DictionaryValue* tree = &components;
+  const base::DictionaryValue* component = nullptr;
+  for (const std::string& name : brillo::string_utils::Split(path, ".")) {
+    if (component && !component->GetDictionary("components", &tree))
+      return nullptr;
+    if (!tree->GetDictionaryWithoutPathExpansion(name, &component))
+      return nullptr;
+  }
+  return component;
+}
+
+android::binder::Status ReportInvalidArguments(const char* message) {
+  return android::binder::Status::fromExceptionCode(
+      android::binder::Status::EX_ILLEGAL_ARGUMENT,
+      android::String8{message});
+}
+
+}  // anonymous namespace
+
 BinderWeaveService::BinderWeaveService(
     weave::Device* device,
-    android::sp<android::weave::IWeaveClient> client)
-    : device_{device}, client_{client} {}
+    android::sp<android::weave::IWeaveClient> client,
+    const DeliveryOptions& delivery_options)
+    : device_{device},
+      client_{client},
+      delivery_options_{delivery_options} {}
 
 BinderWeaveService::~BinderWeaveService() {
+  // The last reference may be released on a binder thread.
+  BinderDispatcher::RunOnMainThread(
+      base::Bind(&BinderWeaveService::Shutdown, base::Unretained(this)));
+}
+
+void BinderWeaveService::Shutdown() {
+  weak_ptr_factory_.InvalidateWeakPtrs();
+  held_local_commands_.clear();
+  held_cloud_commands_.clear();
+  client_.clear();
+  VLOG(1) << "Command delivery stats: delivered="
+          << delivery_stats_.delivered << ", held=" << delivery_stats_.held
+          << ", aborted=" << delivery_stats_.aborted
+          << ", dropped=" << delivery_stats_.dropped
+          << ", max_in_flight=" << delivery_stats_.max_in_flight
+          << ", max_held=" << delivery_stats_.max_held;
   // TODO(avakulenko): Make it possible to remove components from the tree in
   // libweave and enable the following code.
   // for (const std::string& component : components_)
   //   device_->RemoveComponent(component, nullptr);
 }
 
+android::status_t BinderWeaveService::onTransact(uint32_t code,
+                                                 const android::Parcel& data,
+                                                 android::Parcel* reply,
+                                                 uint32_t flags) {
+  return BinderDispatcher::TransactOnMainThread(base::Bind([&]() {
+    return BnWeaveService::onTransact(code, data, reply, flags);
+  }));
+}
+
+void BinderWeaveService::Rebind(weave::Device* device,
+                                const base::DictionaryValue& old_components) {
+  // Handlers registered with the old device must not fire anymore, and its
+  // commands are gone along with it.
+  weak_ptr_factory_.InvalidateWeakPtrs();
+  device_ = device;
+  in_flight_commands_ = 0;
+  held_local_commands_.clear();
+  held_cloud_commands_.clear();
+
+  for (const std::string& name : components_) {
+    const base::DictionaryValue* component =
+        FindComponent(old_components, name);
+    const base::ListValue* trait_list = nullptr;
+    if (!component || !component->GetList("traits", &trait_list)) {
+      LOG(ERROR) << "Component '" << name << "' missing from the old device";
+      continue;
+    }
+    std::vector<std::string> traits;
+    for (const auto& trait_value : *trait_list) {
+      std::string trait;
+      if (trait_value->GetAsString(&trait))
+        traits.push_back(trait);
+    }
+    weave::ErrorPtr error;
+    if (!device_->AddComponent(name, traits, &error)) {
+      LOG(ERROR) << "Failed to re-add component '" << name
+                 << "': " << error->GetMessage();
+      continue;
+    }
+    const base::DictionaryValue* state = nullptr;
+    if (component->GetDictionary("state", &state) &&
+        !device_->SetStateProperties(name, *state, &error)) {
+      LOG(ERROR) << "Failed to restore state of component '" << name
+                 << "': " << error->GetMessage();
+    }
+  }
+
+  std::set<std::pair<std::string, std::string>> commands;
+  std::swap(commands, registered_commands_);
+  for (const auto& pair : commands)
+    AddCommandHandler(pair.first, pair.second);
+}
+
 android::binder::Status BinderWeaveService::addComponent(
     const android::String16& name,
     const std::vector<android::String16>& traits) {
-  std::string component_name = ToString(name);
   weave::ErrorPtr error;
   std::vector<std::string> supported_traits;
   std::transform(traits.begin(), traits.end(),
                  std::back_inserter(supported_traits), ToString);
-  if (!device_->AddComponent(component_name, supported_traits, &error))
-    return ToStatus(false, &error);
-  components_.push_back(component_name);
-  return android::binder::Status::ok();
+  bool success = AddComponent(ToString(name), supported_traits, &error);
+  return ToStatus(success, &error);
 }
 
 android::binder::Status BinderWeaveService::registerCommandHandler(
     const android::String16& component,
     const android::String16& command) {
-  std::string component_name = ToString(component);
-  std::string command_name = ToString(command);
+  weave::ErrorPtr error;
+  bool success =
+      RegisterCommandHandler(ToString(component), ToString(command), &error);
+  return ToStatus(success, &error);
+}
+
+android::binder::Status BinderWeaveService::addComponents(
+    const std::vector<android::String16>& names,
+    const std::vector<int32_t>& traitCounts,
+    const std::vector<android::String16>& traits,
+    std::vector<android::String16>* errors) {
+  if (names.size() != traitCounts.size())
+    return ReportInvalidArguments("Trait count missing for some components");
+  size_t trait_total = 0;
+  for (int32_t count : traitCounts) {
+    if (count < 0)
+      return ReportInvalidArguments("Negative trait count");
+    trait_total += count;
+  }
+  if (trait_total != traits.size())
+    return ReportInvalidArguments("Trait counts do not match the trait list");
+
+  errors->clear();
+  errors->reserve(names.size());
+  auto trait_it = traits.begin();
+  for (size_t i = 0; i < names.size(); i++) {
+    std::vector<std::string> component_traits;
+    std::transform(trait_it, trait_it + traitCounts[i],
+                   std::back_inserter(component_traits), ToString);
+    trait_it += traitCounts[i];
+    weave::ErrorPtr error;
+    if (AddComponent(ToString(names[i]), component_traits, &error))
+      errors->emplace_back();
+    else
+      errors->push_back(ToString16(error->GetMessage()));
+  }
+  return android::binder::Status::ok();
+}
+
+android::binder::Status BinderWeaveService::registerCommandHandlers(
+    const std::vector<android::String16>& components,
+    const std::vector<android::String16>& commands,
+    std::vector<android::String16>* errors) {
+  if (components.size() != commands.size())
+    return ReportInvalidArguments("Component and command lists differ in size");
+
+  errors->clear();
+  errors->reserve(commands.size());
+  for (size_t i = 0; i < commands.size(); i++) {
+    weave::ErrorPtr error;
+    if (RegisterCommandHandler(ToString(components[i]), ToString(commands[i]),
+                               &error)) {
+      errors->emplace_back();
+    } else {
+      errors->push_back(ToString16(error->GetMessage()));
+    }
+  }
+  return android::binder::Status::ok();
+}
+
+bool BinderWeaveService::AddComponent(const std::string& name,
+                                      const std::vector<std::string>& traits,
+                                      weave::ErrorPtr* error) {
+  if (!device_->AddComponent(name, traits, error))
+    return false;
+  components_.push_back(name);
+  return true;
+}
+
+bool BinderWeaveService::RegisterCommandHandler(
+    const std::string& component_name,
+    const std::string& command_name,
+    weave::ErrorPtr* error) {
+  if (command_name != "*" &&
+      !base::EndsWith(command_name, ".*", base::CompareCase::SENSITIVE)) {
+    AddCommandHandler(component_name, command_name);
+    return true;
+  }
+
+  std::vector<std::string> command_names;
+  if (!ExpandCommandWildcard(component_name, command_name, &command_names,
+                             error)) {
+    return false;
+  }
+  for (const std::string& name : command_names)
+    AddCommandHandler(component_name, name);
+  return true;
+}
+
+void BinderWeaveService::AddCommandHandler(const std::string& component_name,
+                                           const std::string& command_name) {
+  if (!registered_commands_.emplace(component_name, command_name).second)
+    return;
   device_->AddCommandHandler(component_name, command_name,
                              base::Bind(&BinderWeaveService::OnCommand,
                                         weak_ptr_factory_.GetWeakPtr(),
                                         component_name, command_name));
-  return android::binder::Status::ok();
+}
+
+bool BinderWeaveService::ExpandCommandWildcard(
+    const std::string& component_name,
+    const std::string& wildcard,
+    std::vector<std::string>* command_names,
+    weave::ErrorPtr* error) const {
+  const base::DictionaryValue* component =
+      FindComponent(device_->GetComponents(), component_name);
+  const base::ListValue* component_traits = nullptr;
+  if (!component || !component->GetList("traits", &component_traits)) {
+    weave::Error::AddTo(
+        error, FROM_HERE, "invalid_component",
+        base::StringPrintf("Component '%s' not found", component_name.c_str()));
+    return false;
+  }
+
+  // "<trait>.*" selects a single trait, "*" selects all of them.
+  std::string trait_filter;
+  if (wildcard != "*")
+    trait_filter = wildcard.substr(0, wildcard.size() - 2);
+
+  const base::DictionaryValue& trait_defs = device_->GetTraits();
+  bool trait_found = false;
+  for (const auto& trait_value : *component_traits) {
+    std::string trait;
+    if (!trait_value->GetAsString(&trait) ||
+        (!trait_filter.empty() && trait != trait_filter)) {
+      continue;
+    }
+    trait_found = true;
+    const base::DictionaryValue* trait_def = nullptr;
+    const base::DictionaryValue* commands = nullptr;
+    if (!trait_defs.GetDictionaryWithoutPathExpansion(trait, &trait_def) ||
+        !trait_def->GetDictionary("commands", &commands)) {
+      continue;
+    }
+    for (base::DictionaryValue::Iterator it(*commands); !it.IsAtEnd();
+         it.Advance()) {
+      command_names->push_back(trait + "." + it.key());
+    }
+  }
+
+  if (!trait_filter.empty() && !trait_found) {
+    weave::Error::AddTo(
+        error, FROM_HERE, "invalid_trait",
+        base::StringPrintf("Component '%s' does not implement trait '%s'",
+                           component_name.c_str(), trait_filter.c_str()));
+    return false;
+  }
+  return true;
 }
 
 android::binder::Status BinderWeaveService::updateState(
@@ -77,14 +321,86 @@ android::binder::Status BinderWeaveService::updateState(
                   &error);
 }
 
+android::binder::Status BinderWeaveService::setStateProperties(
+    const android::String16& component,
+    const android::weave::ParcelableDictionary& properties) {
+  weave::ErrorPtr error;
+  return ToStatus(device_->SetStateProperties(ToString(component),
+                                              properties.dict(), &error),
+                  &error);
+}
+
 void BinderWeaveService::OnCommand(
     const std::string& component_name,
     const std::string& command_name,
     const std::weak_ptr<weave::Command>& command) {
+  auto command_instance = command.lock();
+  if (!command_instance)
+    return;
+  PendingCommand pending{component_name, command_name, command};
+  if (HasFreeSlot()) {
+    DeliverCommand(pending);
+    return;
+  }
+
+  if (delivery_options_.overflow_policy == OverflowPolicy::kAbort) {
+    LOG(WARNING) << "Aborting command '" << command_name << "' of component '"
+                 << component_name << "': client is busy";
+    weave::ErrorPtr command_error;
+    weave::Error::AddTo(&command_error, FROM_HERE, "client_busy",
+                        "Too many commands in progress for this client");
+    command_instance->Abort(command_error.get(), nullptr);
+    delivery_stats_.aborted++;
+    return;
+  }
+
+  if (command_instance->GetOrigin() == weave::Command::Origin::kLocal)
+    held_local_commands_.push_back(pending);
+  else
+    held_cloud_commands_.push_back(pending);
+  delivery_stats_.held++;
+  delivery_stats_.max_held =
+      std::max(delivery_stats_.max_held,
+               held_local_commands_.size() + held_cloud_commands_.size());
+}
+
+void BinderWeaveService::DeliverCommand(const PendingCommand& command) {
+  in_flight_commands_++;
+  delivery_stats_.delivered++;
+  delivery_stats_.max_in_flight =
+      std::max(delivery_stats_.max_in_flight, in_flight_commands_);
   android::sp<android::weave::IWeaveCommand> command_proxy =
-      new BinderCommandProxy{command};
-  client_->onCommand(ToString16(component_name), ToString16(command_name),
-                     command_proxy);
+      new BinderCommandProxy{
+          command.command,
+          base::Bind(&BinderWeaveService::OnCommandDone,
+                     weak_ptr_factory_.GetWeakPtr()),
+          delivery_options_.progress_interval};
+  client_->onCommand(ToString16(command.component_name),
+                     ToString16(command.command_name), command_proxy);
+}
+
+void BinderWeaveService::OnCommandDone() {
+  CHECK_GT(in_flight_commands_, 0u);
+  in_flight_commands_--;
+  while (HasFreeSlot() &&
+         (!held_local_commands_.empty() || !held_cloud_commands_.empty())) {
+    std::deque<PendingCommand>& queue = !held_local_commands_.empty()
+                                            ? held_local_commands_
+                                            : held_cloud_commands_;
+    PendingCommand command = queue.front();
+    queue.pop_front();
+    // The command may have been cancelled or expired while it was held.
+    if (command.command.expired()) {
+      delivery_stats_.dropped++;
+      continue;
+    }
+    DeliverCommand(command);
+  }
+}
+
+bool BinderWeaveService::HasFreeSlot() const {
+  return delivery_options_.max_in_flight_commands == 0 ||
+         in_flight_commands_ < delivery_options_.max_in_flight_commands;
 }
 
 }  // namespace buffet
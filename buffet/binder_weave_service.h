@@ -15,12 +15,17 @@
 #ifndef BUFFET_BINDER_WEAVE_SERVICE_H_
 #define BUFFET_BINDER_WEAVE_SERVICE_H_
 
+#include <deque>
 #include <memory>
-#include <vector>
+#include <set>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <base/macros.h>
 #include <base/memory/weak_ptr.h>
+#include <base/time/time.h>
+#include <base/values.h>
 
 #include "android/weave/IWeaveClient.h"
 #include "android/weave/BnWeaveService.h"
@@ -28,6 +33,8 @@
 namespace weave {
 class Command;
 class Device;
+class Error;
+using ErrorPtr = std::unique_ptr<Error>;
 }
 
 namespace buffet {
@@ -39,11 +46,55 @@ namespace buffet {
 // the components and their state added by the client).
 class BinderWeaveService final : public android::weave::BnWeaveService {
  public:
+  // What to do with a command when the client already has the maximum number
+  // of commands in flight.
+  enum class OverflowPolicy {
+    kHold,   // Keep the command queued in libweave until the client catches up.
+    kAbort,  // Abort the command with a "client_busy" error.
+  };
+
+  struct DeliveryOptions {
+    // The maximum number of commands delivered to the client that it has not
+    // completed, aborted or cancelled yet. Zero means no limit.
+    size_t max_in_flight_commands{0};
+    OverflowPolicy overflow_policy{OverflowPolicy::kHold};
+    // The minimum interval between the progress updates of a command that are
+    // applied to it (see BinderCommandProxy). Zero disables throttling.
+    base::TimeDelta progress_interval{base::TimeDelta::FromMilliseconds(200)};
+  };
+
+  // Command delivery counters of this client.
+  struct DeliveryStats {
+    size_t delivered{0};
+    size_t held{0};     // Commands that had to wait for a free slot.
+    size_t aborted{0};  // Commands aborted because the client was busy.
+    size_t dropped{0};  // Held commands that were gone before delivery.
+    size_t max_in_flight{0};
+    size_t max_held{0};
+  };
+
   BinderWeaveService(weave::Device* device,
-                     android::sp<android::weave::IWeaveClient> client);
+                     android::sp<android::weave::IWeaveClient> client,
+                     const DeliveryOptions& delivery_options =
+                         DeliveryOptions());
   ~BinderWeaveService() override;
 
+  const DeliveryStats& delivery_stats() const { return delivery_stats_; }
+
+  // Moves this client over to a newly created |device|. The components this
+  // client added are re-created with the traits and state they had in
+  // |old_components|, the component tree of the previous device, and all
+  // command handlers are registered again.
+  void Rebind(weave::Device* device,
+              const base::DictionaryValue& old_components);
+
  private:
+  // Serves all the calls on the main thread (see BinderDispatcher).
+  android::status_t onTransact(uint32_t code,
+                               const android::Parcel& data,
+                               android::Parcel* reply,
+                               uint32_t flags) override;
+
   // Binder methods for android::weave::IWeaveService:
   android::binder::Status addComponent(
       const android::String16& name,
@@ -51,17 +102,83 @@ class BinderWeaveService final : public android::weave::BnWeaveService {
   android::binder::Status registerCommandHandler(
       const android::String16& component,
       const android::String16& command) override;
+  android::binder::Status addComponents(
+      const std::vector<android::String16>& names,
+      const std::vector<int32_t>& traitCounts,
+      const std::vector<android::String16>& traits,
+      std::vector<android::String16>* errors) override;
+  android::binder::Status registerCommandHandlers(
+      const std::vector<android::String16>& components,
+      const std::vector<android::String16>& commands,
+      std::vector<android::String16>* errors) override;
   android::binder::Status updateState(
       const android::String16& component,
       const android::String16& state) override;
+  android::binder::Status setStateProperties(
+      const android::String16& component,
+      const android::weave::ParcelableDictionary& properties) override;
+
+  // Adds the component |name| to the device and records it as owned by this
+  // client.
+  bool AddComponent(const std::string& name,
+                    const std::vector<std::string>& traits,
+                    weave::ErrorPtr* error);
 
+  // Registers the handlers for |command_name| of |component_name|, which is
+  // either a full command name or a "<trait>.*"/"*" wildcard.
+  bool RegisterCommandHandler(const std::string& component_name,
+                              const std::string& command_name,
+                              weave::ErrorPtr* error);
+
+  // Registers a command handler with libweave for |command_name| of
+  // |component_name|, unless this client has already registered it.
+  void AddCommandHandler(const std::string& component_name,
+                         const std::string& command_name);
+
+  // Expands the "<trait>.*" or "*" |wildcard| into the list of commands of
+  // the respective traits implemented by |component_name|.
+  bool ExpandCommandWildcard(const std::string& component_name,
+                             const std::string& wildcard,
+                             std::vector<std::string>* command_names,
+                             weave::ErrorPtr* error) const;
+
+  struct PendingCommand {
+    std::string component_name;
+    std::string command_name;
+    std::weak_ptr<weave::Command> command;
+  };
+
+  // Delivers the |command| to the client right away if it has a free slot,
+  // otherwise holds or aborts it according to the overflow policy.
   void OnCommand(const std::string& component_name,
                  const std::string& command_name,
                  const std::weak_ptr<weave::Command>& command);
 
+  // Sends |command| to the client and takes up an in-flight slot until the
+  // client is done with it.
+  void DeliverCommand(const PendingCommand& command);
+
+  // Frees the in-flight slot of a command and delivers the held commands,
+  // local ones first.
+  void OnCommandDone();
+
+  bool HasFreeSlot() const;
+
+  // Tears this object down on the main thread before it is destroyed.
+  void Shutdown();
+
   weave::Device* device_;
   android::sp<android::weave::IWeaveClient> client_;
   std::vector<std::string> components_;
+  // Commands registered by this client, as (component, command) pairs.
+  std::set<std::pair<std::string, std::string>> registered_commands_;
+
+  DeliveryOptions delivery_options_;
+  DeliveryStats delivery_stats_;
+  size_t in_flight_commands_{0};
+  // Commands waiting for a free slot, by origin.
+  std::deque<PendingCommand> held_local_commands_;
+  std::deque<PendingCommand> held_cloud_commands_;
 
   base::WeakPtrFactory<BinderWeaveService> weak_ptr_factory_{this};
   DISALLOW_COPY_AND_ASSIGN(BinderWeaveService);
@@ -0,0 +1,339 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/binder_weave_service.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <weave/command.h>
+#include <weave/error.h>
+#include <weave/test/mock_command.h>
+#include <weave/test/mock_device.h>
+#include <weave/test/unittest_utils.h>
+
+#include "android/weave/BnWeaveClient.h"
+#include "common/binder_utils.h"
+
+using weave::test::CreateDictionaryValue;
+using weaved::binder_utils::ToJson;
+using weaved::binder_utils::ToString;
+using weaved::binder_utils::ToString16;
+
+namespace buffet {
+
+using ::testing::_;
+using ::testing::ElementsAre;
+using ::testing::Invoke;
+using ::testing::NiceMock;
+using ::testing::Return;
+using ::testing::ReturnRef;
+using ::testing::ReturnRefOfCopy;
+using ::testing::SaveArg;
+using ::testing::StrictMock;
+
+namespace {
+
+const char kComponent[] = "myComponent";
+const char kCommand[] = "robot.jump";
+
+// Records the commands delivered to the client. Releasing a command proxy
+// tells the service that the client is done with it.
+class FakeWeaveClient : public android::weave::BnWeaveClient {
+ public:
+  android::binder::Status onServiceConnected(
+      const android::sp<android::weave::IWeaveService>& service) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status onCommand(
+      const android::String16& componentName,
+      const android::String16& commandName,
+      const android::sp<android::weave::IWeaveCommand>& command) override {
+    commands.push_back(command);
+    return android::binder::Status::ok();
+  }
+
+  std::vector<android::sp<android::weave::IWeaveCommand>> commands;
+};
+
+}  // anonymous namespace
+
+class BinderWeaveServiceTest : public ::testing::Test {
+ protected:
+  using OverflowPolicy = BinderWeaveService::OverflowPolicy;
+
+  void CreateService(size_t max_in_flight_commands,
+                     OverflowPolicy overflow_policy) {
+    EXPECT_CALL(device_, AddCommandHandler(kComponent, kCommand, _))
+        .WillOnce(SaveArg<2>(&command_handler_));
+    client_ = new FakeWeaveClient;
+    BinderWeaveService::DeliveryOptions options;
+    options.max_in_flight_commands = max_in_flight_commands;
+    options.overflow_policy = overflow_policy;
+    service_ = new BinderWeaveService{&device_, client_, options};
+    android::weave::IWeaveService* service = service_.get();
+    EXPECT_TRUE(service->registerCommandHandler(ToString16(kComponent),
+                                                ToString16(kCommand))
+                    .isOk());
+  }
+
+  // Creates a command and sends it to the service as libweave would.
+  std::shared_ptr<weave::test::MockCommand> SendCommand(
+      const std::string& id,
+      weave::Command::Origin origin) {
+    auto command = std::make_shared<NiceMock<weave::test::MockCommand>>();
+    ON_CALL(*command, GetID()).WillByDefault(ReturnRefOfCopy(id));
+    ON_CALL(*command, GetName())
+        .WillByDefault(ReturnRefOfCopy(std::string{kCommand}));
+    ON_CALL(*command, GetComponent())
+        .WillByDefault(ReturnRefOfCopy(std::string{kComponent}));
+    ON_CALL(*command, GetOrigin()).WillByDefault(Return(origin));
+    ON_CALL(*command, GetParameters()).WillByDefault(ReturnRef(empty_));
+    ON_CALL(*command, GetProgress()).WillByDefault(ReturnRef(empty_));
+    ON_CALL(*command, GetResults()).WillByDefault(ReturnRef(empty_));
+    command_handler_.Run(command);
+    return command;
+  }
+
+  // Returns the IDs of the commands the client has not finished yet.
+  std::vector<std::string> GetDeliveredCommands() const {
+    std::vector<std::string> ids;
+    for (const auto& command : client_->commands) {
+      android::String16 id;
+      EXPECT_TRUE(command->getId(&id).isOk());
+      ids.push_back(ToString(id));
+    }
+    return ids;
+  }
+
+  // Makes the client finish the oldest command it has.
+  void FinishCommand() {
+    ASSERT_FALSE(client_->commands.empty());
+    client_->commands.erase(client_->commands.begin());
+  }
+
+  const BinderWeaveService::DeliveryStats& stats() const {
+    return service_->delivery_stats();
+  }
+
+  base::DictionaryValue empty_;
+  StrictMock<weave::test::MockDevice> device_;
+  weave::Device::CommandHandlerCallback command_handler_;
+  android::sp<FakeWeaveClient> client_;
+  android::sp<BinderWeaveService> service_;
+};
+
+TEST_F(BinderWeaveServiceTest, HoldCommandsOverLimit) {
+  CreateService(2, OverflowPolicy::kHold);
+  auto command1 = SendCommand("1", weave::Command::Origin::kLocal);
+  auto command2 = SendCommand("2", weave::Command::Origin::kLocal);
+  auto command3 = SendCommand("3", weave::Command::Origin::kLocal);
+  auto command4 = SendCommand("4", weave::Command::Origin::kLocal);
+  EXPECT_THAT(GetDeliveredCommands(), ElementsAre("1", "2"));
+  EXPECT_EQ(2u, stats().delivered);
+  EXPECT_EQ(2u, stats().held);
+  EXPECT_EQ(2u, stats().max_held);
+
+  FinishCommand();
+  EXPECT_THAT(GetDeliveredCommands(), ElementsAre("2", "3"));
+  FinishCommand();
+  FinishCommand();
+  EXPECT_THAT(GetDeliveredCommands(), ElementsAre("4"));
+  FinishCommand();
+  EXPECT_TRUE(GetDeliveredCommands().empty());
+
+  EXPECT_EQ(4u, stats().delivered);
+  EXPECT_EQ(2u, stats().held);
+  EXPECT_EQ(0u, stats().aborted);
+  EXPECT_EQ(0u, stats().dropped);
+  EXPECT_EQ(2u, stats().max_in_flight);
+}
+
+TEST_F(BinderWeaveServiceTest, DeliverHeldLocalCommandsFirst) {
+  CreateService(1, OverflowPolicy::kHold);
+  auto command1 = SendCommand("1", weave::Command::Origin::kCloud);
+  auto command2 = SendCommand("2", weave::Command::Origin::kCloud);
+  auto command3 = SendCommand("3", weave::Command::Origin::kLocal);
+  auto command4 = SendCommand("4", weave::Command::Origin::kCloud);
+  auto command5 = SendCommand("5", weave::Command::Origin::kLocal);
+  EXPECT_THAT(GetDeliveredCommands(), ElementsAre("1"));
+
+  std::vector<std::string> order;
+  for (int i = 0; i < 4; i++) {
+    FinishCommand();
+    std::vector<std::string> delivered = GetDeliveredCommands();
+    ASSERT_EQ(1u, delivered.size());
+    order.push_back(delivered.front());
+  }
+  EXPECT_THAT(order, ElementsAre("3", "5", "2", "4"));
+  EXPECT_EQ(1u, stats().max_in_flight);
+  EXPECT_EQ(4u, stats().max_held);
+}
+
+TEST_F(BinderWeaveServiceTest, AbortCommandsOverLimit) {
+  CreateService(1, OverflowPolicy::kAbort);
+  auto command1 = SendCommand("1", weave::Command::Origin::kLocal);
+
+  auto command2 = std::make_shared<StrictMock<weave::test::MockCommand>>();
+  EXPECT_CALL(*command2, Abort(_, _)).WillOnce(Return(true));
+  command_handler_.Run(command2);
+
+  EXPECT_THAT(GetDeliveredCommands(), ElementsAre("1"));
+  EXPECT_EQ(1u, stats().delivered);
+  EXPECT_EQ(0u, stats().held);
+  EXPECT_EQ(1u, stats().aborted);
+
+  // The slot is available again once the client is done with the command.
+  FinishCommand();
+  auto command3 = SendCommand("3", weave::Command::Origin::kLocal);
+  EXPECT_THAT(GetDeliveredCommands(), ElementsAre("3"));
+}
+
+TEST_F(BinderWeaveServiceTest, DropExpiredHeldCommands) {
+  CreateService(1, OverflowPolicy::kHold);
+  auto command1 = SendCommand("1", weave::Command::Origin::kLocal);
+  auto command2 = SendCommand("2", weave::Command::Origin::kLocal);
+  auto command3 = SendCommand("3", weave::Command::Origin::kLocal);
+  // libweave drops the command, e.g. because it was cancelled.
+  command2.reset();
+
+  FinishCommand();
+  EXPECT_THAT(GetDeliveredCommands(), ElementsAre("3"));
+  EXPECT_EQ(2u, stats().delivered);
+  EXPECT_EQ(2u, stats().held);
+  EXPECT_EQ(1u, stats().dropped);
+}
+
+TEST_F(BinderWeaveServiceTest, NoLimit) {
+  CreateService(0, OverflowPolicy::kAbort);
+  std::vector<std::shared_ptr<weave::test::MockCommand>> commands;
+  for (int i = 0; i < 20; i++)
+    commands.push_back(SendCommand(std::to_string(i),
+                                   weave::Command::Origin::kCloud));
+  EXPECT_EQ(20u, GetDeliveredCommands().size());
+  EXPECT_EQ(20u, stats().max_in_flight);
+  EXPECT_EQ(0u, stats().aborted);
+}
+
+TEST_F(BinderWeaveServiceTest, Rebind) {
+  CreateService(1, OverflowPolicy::kAbort);
+  EXPECT_CALL(device_, AddComponent(kComponent, ElementsAre("robot"), _))
+      .WillOnce(Return(true));
+  android::weave::IWeaveService* service = service_.get();
+  EXPECT_TRUE(service->addComponent(ToString16(kComponent),
+                                    {ToString16("robot")})
+                  .isOk());
+  auto command1 = SendCommand("1", weave::Command::Origin::kLocal);
+
+  auto old_components = CreateDictionaryValue(R"({
+    'myComponent': {
+      'traits': ['robot'],
+      'state': {'robot': {'battery': 50}}
+    }
+  })");
+  StrictMock<weave::test::MockDevice> new_device;
+  std::string state;
+  weave::Device::CommandHandlerCallback old_command_handler = command_handler_;
+  EXPECT_CALL(new_device, AddComponent(kComponent, ElementsAre("robot"), _))
+      .WillOnce(Return(true));
+  EXPECT_CALL(new_device, SetStateProperties(kComponent, _, _))
+      .WillOnce(Invoke([&state](const std::string& component,
+                                const base::DictionaryValue& dict,
+                                weave::ErrorPtr* error) {
+        state = ToJson(dict);
+        return true;
+      }));
+  EXPECT_CALL(new_device, AddCommandHandler(kComponent, kCommand, _))
+      .WillOnce(SaveArg<2>(&command_handler_));
+  service_->Rebind(&new_device, *old_components);
+  EXPECT_EQ(R"({"robot":{"battery":50}})", state);
+
+  // The handler registered with the old device no longer delivers commands.
+  auto command2 = std::make_shared<StrictMock<weave::test::MockCommand>>();
+  old_command_handler.Run(command2);
+  EXPECT_THAT(GetDeliveredCommands(), ElementsAre("1"));
+
+  // The commands of the old device no longer count towards the limit.
+  auto command3 = SendCommand("3", weave::Command::Origin::kLocal);
+  EXPECT_THAT(GetDeliveredCommands(), ElementsAre("1", "3"));
+  EXPECT_EQ(2u, stats().delivered);
+}
+
+TEST_F(BinderWeaveServiceTest, AddComponents) {
+  CreateService(0, OverflowPolicy::kAbort);
+  EXPECT_CALL(device_, AddComponent("a", ElementsAre("robot", "lamp"), _))
+      .WillOnce(Return(true));
+  EXPECT_CALL(device_, AddComponent("b", ElementsAre(), _))
+      .WillOnce(Invoke([](const std::string& name,
+                          const std::vector<std::string>& traits,
+                          weave::ErrorPtr* error) {
+        weave::Error::AddTo(error, FROM_HERE, "invalid_component",
+                            "Component already exists");
+        return false;
+      }));
+  EXPECT_CALL(device_, AddComponent("c", ElementsAre("robot"), _))
+      .WillOnce(Return(true));
+  android::weave::IWeaveService* service = service_.get();
+  std::vector<android::String16> errors;
+  EXPECT_TRUE(service->addComponents(
+                  {ToString16("a"), ToString16("b"), ToString16("c")},
+                  {2, 0, 1},
+                  {ToString16("robot"), ToString16("lamp"),
+                   ToString16("robot")},
+                  &errors)
+                  .isOk());
+  ASSERT_EQ(3u, errors.size());
+  EXPECT_EQ("", ToString(errors[0]));
+  EXPECT_EQ("Component already exists", ToString(errors[1]));
+  EXPECT_EQ("", ToString(errors[2]));
+}
+
+TEST_F(BinderWeaveServiceTest, AddComponentsInvalidTraitCounts) {
+  CreateService(0, OverflowPolicy::kAbort);
+  android::weave::IWeaveService* service = service_.get();
+  std::vector<android::String16> errors;
+  EXPECT_FALSE(service->addComponents({ToString16("a"), ToString16("b")}, {1},
+                                      {ToString16("robot")}, &errors)
+                   .isOk());
+  EXPECT_FALSE(service->addComponents({ToString16("a")}, {2},
+                                      {ToString16("robot")}, &errors)
+                   .isOk());
+  EXPECT_FALSE(service->addComponents({ToString16("a")}, {-1}, {}, &errors)
+                   .isOk());
+}
+
+TEST_F(BinderWeaveServiceTest, RegisterCommandHandlers) {
+  CreateService(0, OverflowPolicy::kAbort);
+  EXPECT_CALL(device_, AddCommandHandler(kComponent, "robot.sit", _));
+  // The wildcard can't be expanded for a component the device doesn't have.
+  EXPECT_CALL(device_, GetComponents()).WillRepeatedly(ReturnRef(empty_));
+  android::weave::IWeaveService* service = service_.get();
+  std::vector<android::String16> errors;
+  EXPECT_TRUE(service->registerCommandHandlers(
+                  {ToString16(kComponent), ToString16("unknown")},
+                  {ToString16("robot.sit"), ToString16("*")}, &errors)
+                  .isOk());
+  ASSERT_EQ(2u, errors.size());
+  EXPECT_EQ("", ToString(errors[0]));
+  EXPECT_EQ("Component 'unknown' not found", ToString(errors[1]));
+
+  EXPECT_FALSE(service->registerCommandHandlers({ToString16(kComponent)}, {},
+                                                &errors)
+                   .isOk());
+}
+
+}  // namespace buffet
@@ -47,6 +47,8 @@ class BuffetConfig final : public weave::provider::ConfigStore {
 
     base::FilePath definitions;
     base::FilePath test_definitions;
+    // Where to cache the parsed definitions. Empty disables the cache.
+    base::FilePath definitions_cache;
 
     std::string test_privet_ssid;
   };
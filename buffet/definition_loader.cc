@@ -0,0 +1,291 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/definition_loader.h"
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+#include <base/files/file_enumerator.h>
+#include <base/files/file_util.h>
+#include <base/files/important_file_writer.h>
+#include <base/json/json_reader.h>
+#include <base/logging.h>
+#include <base/sha1.h>
+#include <base/synchronization/waitable_event.h>
+#include <base/threading/simple_thread.h>
+#include <binder/Parcel.h>
+#include <weave/device.h>
+
+#include "common/binder_utils.h"
+#include "common/parcelable_dictionary.h"
+
+using weaved::binder_utils::ReadUtf8String;
+using weaved::binder_utils::WriteUtf8String;
+
+namespace buffet {
+
+namespace {
+
+// The maximum number of threads parsing the definition files.
+const size_t kMaxThreads = 4;
+
+// Identifies the cache file format. Bump the version whenever the format
+// changes, so that old caches are ignored.
+const int32_t kCacheMagic = 0x57444546;  // "WDEF"
+const int32_t kCacheVersion = 2;
+
+}  // anonymous namespace
+
+// Reads a single definition file on a worker thread and parses it, unless its
+// cached definitions are up to date.
+class DefinitionLoader::ParseTask
+    : public base::DelegateSimpleThread::Delegate {
+ public:
+  explicit ParseTask(File* file) : file_{file} {}
+
+  void Run() override {
+    Parse();
+    done_.Signal();
+  }
+
+  void Wait() { done_.Wait(); }
+
+ private:
+  void Parse() {
+    std::string json;
+    CHECK(base::ReadFileToString(file_->path, &json))
+        << "Failed to read file '" << file_->path.value() << "'";
+    file_->hash = base::SHA1HashString(json);
+    if (file_->cached_definitions && file_->cached_hash == file_->hash) {
+      file_->definitions = std::move(file_->cached_definitions);
+      file_->from_cache = true;
+      return;
+    }
+    file_->cached_definitions.reset();
+
+    int error_code = 0;
+    std::string message;
+    std::unique_ptr<base::Value> value{
+        base::JSONReader::ReadAndReturnError(json, base::JSON_PARSE_RFC,
+                                             &error_code, &message)
+            .release()};
+    base::DictionaryValue* dict = nullptr;
+    CHECK(value && value->GetAsDictionary(&dict))
+        << "Failed to parse '" << file_->path.value() << "': " << message;
+    value.release();
+    file_->definitions.reset(dict);
+  }
+
+  File* file_;
+  // Signaled once |file_| is loaded. Manual reset, since LoadInto() may
+  // wait for it more than once.
+  base::WaitableEvent done_{true, false};
+
+  DISALLOW_COPY_AND_ASSIGN(ParseTask);
+};
+
+// Writes the definitions cache on a worker thread, off the main thread.
+class DefinitionLoader::WriteCacheTask
+    : public base::DelegateSimpleThread::Delegate {
+ public:
+  explicit WriteCacheTask(const DefinitionLoader* loader) : loader_{loader} {}
+
+  void Run() override { loader_->WriteCache(); }
+
+ private:
+  const DefinitionLoader* loader_;
+
+  DISALLOW_COPY_AND_ASSIGN(WriteCacheTask);
+};
+
+DefinitionLoader::DefinitionLoader(const BuffetConfig::Options& options)
+    : options_{options} {}
+
+DefinitionLoader::~DefinitionLoader() {
+  if (thread_pool_)
+    thread_pool_->JoinAll();
+}
+
+void DefinitionLoader::Start() {
+  AddFiles(Kind::kTraits, options_.definitions.Append("traits"),
+           FILE_PATH_LITERAL("*.json"));
+  AddFiles(Kind::kCommands, options_.definitions.Append("commands"),
+           FILE_PATH_LITERAL("*.json"));
+  if (!options_.test_definitions.empty()) {
+    AddFiles(Kind::kCommands, options_.test_definitions.Append("commands"),
+             FILE_PATH_LITERAL("*test.json"));
+  }
+  AddFiles(Kind::kStateDefinitions, options_.definitions.Append("states"),
+           FILE_PATH_LITERAL("*.schema.json"));
+  AddFiles(Kind::kStateDefaults, options_.definitions.Append("states"),
+           FILE_PATH_LITERAL("*.defaults.json"));
+
+  if (files_.empty())
+    return;
+  ReadCache();
+
+  thread_pool_.reset(new base::DelegateSimpleThreadPool{
+      "weaved_definitions", static_cast<int>(std::min(kMaxThreads,
+                                                      files_.size()))});
+  thread_pool_->Start();
+  for (File& file : files_) {
+    tasks_.emplace_back(new ParseTask{&file});
+    thread_pool_->AddWork(tasks_.back().get());
+  }
+}
+
+void DefinitionLoader::LoadInto(weave::Device* device) {
+  for (const auto& task : tasks_)
+    task->Wait();
+  if (!loaded_ && !files_.empty()) {
+    loaded_ = true;
+    loaded_from_cache_ = std::all_of(files_.begin(), files_.end(),
+                                     [](const File& file) {
+                                       return file.from_cache;
+                                     });
+    if (loaded_from_cache_) {
+      LOG(INFO) << "Using cached definitions from "
+                << options_.definitions_cache.value();
+    } else if (!options_.definitions_cache.empty()) {
+      // The files are no longer modified, so the worker may read them while
+      // the definitions are added to |device| below.
+      write_cache_task_.reset(new WriteCacheTask{this});
+      thread_pool_->AddWork(write_cache_task_.get());
+    }
+  }
+
+  for (const File& file : files_) {
+    LOG(INFO) << "Loading definitions from " << file.path.value();
+    CHECK(file.definitions);
+    switch (file.kind) {
+      case Kind::kTraits:
+        device->AddTraitDefinitions(*file.definitions);
+        break;
+      case Kind::kCommands:
+        device->AddCommandDefinitions(*file.definitions);
+        break;
+      case Kind::kStateDefinitions:
+        device->AddStateDefinitions(*file.definitions);
+        break;
+      case Kind::kStateDefaults:
+        CHECK(device->SetStateProperties(*file.definitions, nullptr));
+        break;
+    }
+  }
+}
+
+void DefinitionLoader::AddFiles(Kind kind,
+                                const base::FilePath& dir,
+                                const base::FilePath::StringType& pattern) {
+  LOG(INFO) << "Looking for definitions in " << dir.value();
+  base::FileEnumerator enumerator(dir, false, base::FileEnumerator::FILES,
+                                  pattern);
+  std::vector<File> files;
+  for (base::FilePath path = enumerator.Next(); !path.empty();
+       path = enumerator.Next()) {
+    files.emplace_back();
+    files.back().kind = kind;
+    files.back().path = path;
+  }
+  // Load the files in a stable order, independent of the directory order.
+  std::sort(files.begin(), files.end(), [](const File& a, const File& b) {
+    return a.path < b.path;
+  });
+  std::move(files.begin(), files.end(), std::back_inserter(files_));
+}
+
+void DefinitionLoader::ReadCache() {
+  if (options_.definitions_cache.empty())
+    return;
+  std::string data;
+  if (!base::ReadFileToString(options_.definitions_cache, &data))
+    return;
+
+  android::Parcel parcel;
+  parcel.setData(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+  int32_t magic = 0;
+  int32_t version = 0;
+  int32_t count = 0;
+  if (parcel.readInt32(&magic) != android::OK || magic != kCacheMagic ||
+      parcel.readInt32(&version) != android::OK || version != kCacheVersion ||
+      parcel.readInt32(&count) != android::OK ||
+      count != static_cast<int32_t>(files_.size())) {
+    return;
+  }
+  std::vector<std::string> hashes;
+  for (const File& file : files_) {
+    int32_t kind = 0;
+    std::string path;
+    std::string hash;
+    if (parcel.readInt32(&kind) != android::OK ||
+        ReadUtf8String(&parcel, &path) != android::OK ||
+        ReadUtf8String(&parcel, &hash) != android::OK ||
+        kind != static_cast<int32_t>(file.kind) ||
+        path != file.path.value()) {
+      return;
+    }
+    hashes.push_back(hash);
+  }
+
+  std::vector<std::unique_ptr<base::DictionaryValue>> definitions;
+  for (size_t i = 0; i < files_.size(); i++) {
+    android::weave::ParcelableDictionary dict;
+    if (dict.readFromParcel(&parcel) != android::OK) {
+      LOG(WARNING) << "Definitions cache "
+                   << options_.definitions_cache.value() << " is corrupt";
+      return;
+    }
+    definitions.push_back(dict.ReleaseDict());
+  }
+  // The ParseTasks check the hashes against the contents of the files.
+  for (size_t i = 0; i < files_.size(); i++) {
+    files_[i].cached_hash = hashes[i];
+    files_[i].cached_definitions = std::move(definitions[i]);
+  }
+}
+
+void DefinitionLoader::WriteCache() const {
+  if (options_.definitions_cache.empty())
+    return;
+
+  android::Parcel parcel;
+  parcel.writeInt32(kCacheMagic);
+  parcel.writeInt32(kCacheVersion);
+  parcel.writeInt32(static_cast<int32_t>(files_.size()));
+  for (const File& file : files_) {
+    parcel.writeInt32(static_cast<int32_t>(file.kind));
+    WriteUtf8String(&parcel, file.path.value());
+    WriteUtf8String(&parcel, file.hash);
+  }
+  for (const File& file : files_) {
+    android::weave::ParcelableDictionary dict{file.definitions.get()};
+    if (dict.writeToParcel(&parcel) != android::OK) {
+      LOG(WARNING) << "Failed to serialize definitions from "
+                   << file.path.value();
+      return;
+    }
+  }
+
+  std::string data{reinterpret_cast<const char*>(parcel.data()),
+                   parcel.dataSize()};
+  if (!base::ImportantFileWriter::WriteFileAtomically(
+          options_.definitions_cache, data)) {
+    LOG(WARNING) << "Failed to write definitions cache "
+                 << options_.definitions_cache.value();
+  }
+}
+
+}  // namespace buffet
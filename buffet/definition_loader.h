@@ -0,0 +1,109 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BUFFET_DEFINITION_LOADER_H_
+#define BUFFET_DEFINITION_LOADER_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/files/file_path.h>
+#include <base/macros.h>
+#include <base/values.h>
+
+#include "buffet/buffet_config.h"
+
+namespace base {
+class DelegateSimpleThreadPool;
+}
+
+namespace weave {
+class Device;
+}
+
+namespace buffet {
+
+// Loads the trait, command and state definitions and the state defaults from
+// the JSON files in BuffetConfig::Options::definitions (and the command
+// definitions from test_definitions) into a weave::Device.
+// The files are read and parsed on a pool of worker threads, started with
+// Start() while the rest of the daemon initializes. If
+// BuffetConfig::Options::definitions_cache is set, the parsed definitions are
+// saved there in a binary form along with the path and a SHA-1 hash of the
+// contents of each of the files, and later loads use the cached definitions
+// of the files whose contents have not changed instead of parsing them.
+// Timestamps are not used, since system images are built with fixed ones.
+class DefinitionLoader final {
+ public:
+  explicit DefinitionLoader(const BuffetConfig::Options& options);
+  ~DefinitionLoader();
+
+  // Looks for the definition files and starts loading them.
+  void Start();
+
+  // Waits for the files to be loaded and adds the definitions to |device|.
+  // Crashes if any of the files is missing or malformed. If any file had to
+  // be parsed, the cache is updated on a worker thread.
+  void LoadInto(weave::Device* device);
+
+  // Returns true if the definitions of all the files came from the cache.
+  bool loaded_from_cache() const { return loaded_from_cache_; }
+
+ private:
+  enum class Kind : int32_t {
+    kTraits = 0,
+    kCommands = 1,
+    kStateDefinitions = 2,
+    kStateDefaults = 3,
+  };
+
+  class ParseTask;
+  class WriteCacheTask;
+
+  struct File {
+    Kind kind;
+    base::FilePath path;
+    // SHA-1 hash of the contents, set by the ParseTask.
+    std::string hash;
+    std::unique_ptr<base::DictionaryValue> definitions;
+    // The definitions of this file from the cache and the hash of the
+    // contents they were parsed from, if any.
+    std::string cached_hash;
+    std::unique_ptr<base::DictionaryValue> cached_definitions;
+    bool from_cache{false};
+  };
+
+  void AddFiles(Kind kind,
+                const base::FilePath& dir,
+                const base::FilePath::StringType& pattern);
+  void ReadCache();
+  void WriteCache() const;
+
+  BuffetConfig::Options options_;
+  std::vector<File> files_;
+  std::vector<std::unique_ptr<ParseTask>> tasks_;
+  std::unique_ptr<WriteCacheTask> write_cache_task_;
+  std::unique_ptr<base::DelegateSimpleThreadPool> thread_pool_;
+  bool loaded_{false};
+  bool loaded_from_cache_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(DefinitionLoader);
+};
+
+}  // namespace buffet
+
+#endif  // BUFFET_DEFINITION_LOADER_H_
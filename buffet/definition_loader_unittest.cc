@@ -0,0 +1,119 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/definition_loader.h"
+
+#include <algorithm>
+
+#include <base/files/file_util.h>
+#include <base/files/scoped_temp_dir.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <weave/test/mock_device.h>
+#include <weave/test/unittest_utils.h>
+
+namespace buffet {
+
+using ::testing::_;
+using ::testing::InSequence;
+using ::testing::Return;
+using ::testing::StrictMock;
+using weave::test::CreateDictionaryValue;
+
+namespace {
+
+MATCHER_P(EqualToJson, json, "") {
+  return weave::test::IsEqualValue(*CreateDictionaryValue(json), arg);
+}
+
+}  // namespace
+
+class DefinitionLoaderTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    options_.definitions = temp_dir_.path().Append("etc");
+    options_.definitions_cache = temp_dir_.path().Append("cache");
+    WriteFile("traits/b.json", "{'b': {}}");
+    WriteFile("traits/a.json", "{'a': {}}");
+    WriteFile("commands/c.json", "{'c': {}}");
+    WriteFile("states/s.schema.json", "{'s': {}}");
+    WriteFile("states/s.defaults.json", "{'s': {'p': 1}}");
+  }
+
+  void WriteFile(const std::string& name, std::string json) {
+    std::replace(json.begin(), json.end(), '\'', '"');
+    base::FilePath path = options_.definitions.Append(name);
+    ASSERT_TRUE(base::CreateDirectory(path.DirName()));
+    ASSERT_EQ(static_cast<int>(json.size()),
+              base::WriteFile(path, json.data(), json.size()));
+  }
+
+  // Loads the definitions, expecting |state_defaults| as the state defaults,
+  // and returns true if the cache was used.
+  bool Load(const std::string& state_defaults = "{'s': {'p': 1}}") {
+    StrictMock<weave::test::MockDevice> device;
+    InSequence sequence;
+    EXPECT_CALL(device, AddTraitDefinitions(EqualToJson("{'a': {}}")));
+    EXPECT_CALL(device, AddTraitDefinitions(EqualToJson("{'b': {}}")));
+    EXPECT_CALL(device, AddCommandDefinitions(EqualToJson("{'c': {}}")));
+    EXPECT_CALL(device, AddStateDefinitions(EqualToJson("{'s': {}}")));
+    EXPECT_CALL(device,
+                SetStateProperties(EqualToJson(state_defaults.c_str()), _))
+        .WillOnce(Return(true));
+
+    DefinitionLoader loader{options_};
+    loader.Start();
+    loader.LoadInto(&device);
+    return loader.loaded_from_cache();
+  }
+
+ protected:
+  base::ScopedTempDir temp_dir_;
+  BuffetConfig::Options options_;
+};
+
+TEST_F(DefinitionLoaderTest, Cache) {
+  EXPECT_FALSE(Load());
+  EXPECT_TRUE(base::PathExists(options_.definitions_cache));
+  EXPECT_TRUE(Load());
+}
+
+TEST_F(DefinitionLoaderTest, CacheInvalidatedByChange) {
+  EXPECT_FALSE(Load());
+  WriteFile("commands/c.json", "{'c': {} }");
+  EXPECT_FALSE(Load());
+  EXPECT_TRUE(Load());
+}
+
+TEST_F(DefinitionLoaderTest, CacheInvalidatedByChangeWithSameTimestamp) {
+  EXPECT_FALSE(Load());
+  // System images are built with fixed timestamps, so an update may change a
+  // file without changing its size or modification time.
+  base::FilePath path = options_.definitions.Append("states/s.defaults.json");
+  base::File::Info info;
+  ASSERT_TRUE(base::GetFileInfo(path, &info));
+  WriteFile("states/s.defaults.json", "{'s': {'p': 2}}");
+  ASSERT_TRUE(base::TouchFile(path, info.last_accessed, info.last_modified));
+  EXPECT_FALSE(Load("{'s': {'p': 2}}"));
+  EXPECT_TRUE(Load("{'s': {'p': 2}}"));
+}
+
+TEST_F(DefinitionLoaderTest, NoCache) {
+  options_.definitions_cache.clear();
+  EXPECT_FALSE(Load());
+  EXPECT_FALSE(Load());
+}
+
+}  // namespace buffet
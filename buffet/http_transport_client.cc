@@ -14,12 +14,16 @@
 
 #include "buffet/http_transport_client.h"
 
+#include <algorithm>
+#include <vector>
+
 #include <base/bind.h>
 #include <brillo/errors/error.h>
 #include <brillo/http/http_request.h>
 #include <brillo/http/http_utils.h>
 #include <brillo/streams/memory_stream.h>
 #include <weave/enum_to_string.h>
+#include <weave/error.h>
 
 #include "buffet/weave_error_conversion.h"
 
@@ -29,9 +33,6 @@ namespace {
 
 using weave::provider::HttpClient;
 
-// The number of seconds each HTTP request will be allowed before timing out.
-const int kRequestTimeoutSeconds = 30;
-
 class ResponseImpl : public HttpClient::Response {
  public:
   ~ResponseImpl() override = default;
@@ -54,53 +55,190 @@ class ResponseImpl : public HttpClient::Response {
   DISALLOW_COPY_AND_ASSIGN(ResponseImpl);
 };
 
-void OnSuccessCallback(const HttpClient::SendRequestCallback& callback,
-                       int id,
-                       std::unique_ptr<brillo::http::Response> response) {
-  callback.Run(std::unique_ptr<HttpClient::Response>{new ResponseImpl{
-                   std::move(response)}},
-               nullptr);
+// Returns the host (and port) part of |url|, used to group the requests for
+// the per-host request limit.
+std::string GetHost(const std::string& url) {
+  size_t begin = url.find("://");
+  begin = (begin == std::string::npos) ? 0 : begin + 3;
+  size_t end = url.find_first_of("/?#", begin);
+  return url.substr(begin, end == std::string::npos ? end : end - begin);
 }
 
-void OnErrorCallback(const HttpClient::SendRequestCallback& callback,
-                     int id,
-                     const brillo::Error* brillo_error) {
+void FailRequest(const HttpClient::SendRequestCallback& callback,
+                 const std::string& code,
+                 const std::string& message) {
   weave::ErrorPtr error;
-  ConvertError(*brillo_error, &error);
+  weave::Error::AddTo(&error, FROM_HERE, code, message);
   callback.Run(nullptr, std::move(error));
 }
 
 }  // anonymous namespace
 
 HttpTransportClient::HttpTransportClient()
-    : transport_{brillo::http::Transport::CreateDefault()} {
+    : HttpTransportClient{Options{}} {}
+
+HttpTransportClient::HttpTransportClient(const Options& options)
+    : HttpTransportClient{options, brillo::http::Transport::CreateDefault()} {}
+
+HttpTransportClient::HttpTransportClient(
+    const Options& options,
+    const std::shared_ptr<brillo::http::Transport>& transport)
+    : options_{options}, transport_{transport} {
+  // Each request has its own timer (see OnTimeout()), the transport timeout
+  // is only a backstop.
   transport_->SetDefaultTimeout(
-      base::TimeDelta::FromSeconds(kRequestTimeoutSeconds));
+      std::max(options_.read_timeout, options_.write_timeout));
 }
 
-HttpTransportClient::~HttpTransportClient() {}
+HttpTransportClient::~HttpTransportClient() {
+  std::vector<SendRequestCallback> callbacks;
+  for (const auto& pair : active_requests_) {
+    brillo::MessageLoop::current()->CancelTask(pair.second.timeout_task);
+    if (pair.second.transport_request_id != 0)
+      transport_->CancelRequest(pair.second.transport_request_id);
+    callbacks.push_back(pair.second.callback);
+  }
+  for (const auto& pair : hosts_) {
+    for (const PendingRequest& request : pair.second.queue)
+      callbacks.push_back(request.callback);
+  }
+  for (const SendRequestCallback& callback : callbacks) {
+    brillo::MessageLoop::current()->PostTask(
+        FROM_HERE, base::Bind(&FailRequest, callback, "request_cancelled",
+                              "HTTP client is shutting down"));
+  }
+}
 
 void HttpTransportClient::SendRequest(Method method,
                                       const std::string& url,
                                       const Headers& headers,
                                       const std::string& data,
                                       const SendRequestCallback& callback) {
-  brillo::http::Request request(url, weave::EnumToString(method), transport_);
-  request.AddHeaders(headers);
-  if (!data.empty()) {
-    auto stream = brillo::MemoryStream::OpenCopyOf(data, nullptr);
+  PendingRequest request{method, url, headers, data, callback};
+  std::string host = GetHost(url);
+  HostState& host_state = hosts_[host];
+  if (options_.max_requests_per_host > 0 &&
+      host_state.active_requests >= options_.max_requests_per_host) {
+    VLOG(2) << "Too many requests to " << host << ", queuing " << url;
+    host_state.queue.push_back(std::move(request));
+    return;
+  }
+  if (!StartRequest(host, request))
+    StartQueuedRequests(host);
+}
+
+bool HttpTransportClient::StartRequest(const std::string& host,
+                                       const PendingRequest& pending_request) {
+  brillo::http::Request request(pending_request.url,
+                                weave::EnumToString(pending_request.method),
+                                transport_);
+  request.AddHeaders(pending_request.headers);
+  if (!pending_request.data.empty()) {
+    auto stream =
+        brillo::MemoryStream::OpenCopyOf(pending_request.data, nullptr);
     CHECK(stream->GetRemainingSize());
     brillo::ErrorPtr cromeos_error;
     if (!request.AddRequestBody(std::move(stream), &cromeos_error)) {
       weave::ErrorPtr error;
       ConvertError(*cromeos_error, &error);
       transport_->RunCallbackAsync(
-          FROM_HERE, base::Bind(callback, nullptr, base::Passed(&error)));
-      return;
+          FROM_HERE, base::Bind(pending_request.callback, nullptr,
+                                base::Passed(&error)));
+      return false;
     }
   }
-  request.GetResponse(base::Bind(&OnSuccessCallback, callback),
-                      base::Bind(&OnErrorCallback, callback));
+  hosts_[host].active_requests++;
+  int request_id = ++last_request_id_;
+  base::TimeDelta timeout = pending_request.method == Method::kGet
+                                ? options_.read_timeout
+                                : options_.write_timeout;
+  active_requests_[request_id] = ActiveRequest{
+      host, pending_request.callback, 0,
+      brillo::MessageLoop::current()->PostDelayedTask(
+          FROM_HERE,
+          base::Bind(&HttpTransportClient::OnTimeout,
+                     weak_ptr_factory_.GetWeakPtr(), request_id),
+          timeout)};
+  int transport_request_id = request.GetResponse(
+      base::Bind(&HttpTransportClient::OnSuccess,
+                 weak_ptr_factory_.GetWeakPtr(), request_id),
+      base::Bind(&HttpTransportClient::OnError, weak_ptr_factory_.GetWeakPtr(),
+                 request_id));
+  // The transport may have completed the request already. If the request
+  // failed to start, the transport reports the error asynchronously and
+  // there is no ID.
+  auto it = active_requests_.find(request_id);
+  if (it != active_requests_.end())
+    it->second.transport_request_id = transport_request_id;
+  return true;
+}
+
+void HttpTransportClient::OnSuccess(
+    int request_id,
+    int transport_request_id,
+    std::unique_ptr<brillo::http::Response> response) {
+  SendRequestCallback callback;
+  if (!OnRequestDone(request_id, &callback))
+    return;
+  callback.Run(std::unique_ptr<HttpClient::Response>{new ResponseImpl{
+                   std::move(response)}},
+               nullptr);
+}
+
+void HttpTransportClient::OnError(int request_id,
+                                  int transport_request_id,
+                                  const brillo::Error* brillo_error) {
+  SendRequestCallback callback;
+  if (!OnRequestDone(request_id, &callback))
+    return;
+  weave::ErrorPtr error;
+  ConvertError(*brillo_error, &error);
+  callback.Run(nullptr, std::move(error));
+}
+
+void HttpTransportClient::OnTimeout(int request_id) {
+  auto it = active_requests_.find(request_id);
+  if (it == active_requests_.end())
+    return;
+  it->second.timeout_task = brillo::MessageLoop::kTaskIdNull;
+  LOG(WARNING) << "HTTP request to " << it->second.host << " timed out";
+  // The transport may not be able to cancel the request. Its completion is
+  // ignored then, as the request is no longer active.
+  if (it->second.transport_request_id != 0)
+    transport_->CancelRequest(it->second.transport_request_id);
+  SendRequestCallback callback;
+  OnRequestDone(request_id, &callback);
+  FailRequest(callback, "timeout", "HTTP request timed out");
+}
+
+bool HttpTransportClient::OnRequestDone(int request_id,
+                                        SendRequestCallback* callback) {
+  auto it = active_requests_.find(request_id);
+  if (it == active_requests_.end())
+    return false;
+  brillo::MessageLoop::current()->CancelTask(it->second.timeout_task);
+  std::string host = it->second.host;
+  *callback = it->second.callback;
+  active_requests_.erase(it);
+  HostState& host_state = hosts_[host];
+  CHECK_GT(host_state.active_requests, 0u);
+  host_state.active_requests--;
+  StartQueuedRequests(host);
+  return true;
+}
+
+void HttpTransportClient::StartQueuedRequests(const std::string& host) {
+  auto it = hosts_.find(host);
+  while (it != hosts_.end() && !it->second.queue.empty() &&
+         it->second.active_requests < options_.max_requests_per_host) {
+    PendingRequest request = std::move(it->second.queue.front());
+    it->second.queue.pop_front();
+    StartRequest(host, request);
+  }
+  if (it != hosts_.end() && it->second.queue.empty() &&
+      it->second.active_requests == 0) {
+    hosts_.erase(it);
+  }
 }
 
 }  // namespace buffet
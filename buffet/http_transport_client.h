@@ -15,13 +15,21 @@
 #ifndef BUFFET_HTTP_TRANSPORT_CLIENT_H_
 #define BUFFET_HTTP_TRANSPORT_CLIENT_H_
 
+#include <deque>
+#include <map>
 #include <memory>
 #include <string>
 
+#include <base/macros.h>
+#include <base/memory/weak_ptr.h>
+#include <base/time/time.h>
+#include <brillo/message_loops/message_loop.h>
 #include <weave/provider/http_client.h>
 
 namespace brillo {
+class Error;
 namespace http {
+class Response;
 class Transport;
 }
 }
@@ -30,8 +38,26 @@ namespace buffet {
 
 class HttpTransportClient : public weave::provider::HttpClient {
  public:
+  struct Options {
+    // Timeout for requests that only read data from the server (GET).
+    base::TimeDelta read_timeout{base::TimeDelta::FromSeconds(30)};
+    // Timeout for requests that modify data on the server (POST, PUT, PATCH).
+    base::TimeDelta write_timeout{base::TimeDelta::FromSeconds(30)};
+    // Maximum number of requests in flight to the same host. Further requests
+    // are queued until one of the active requests completes. 0 means there is
+    // no limit.
+    size_t max_requests_per_host{0};
+  };
+
   HttpTransportClient();
+  explicit HttpTransportClient(const Options& options);
+  // Sends the requests through |transport| instead of the default one.
+  HttpTransportClient(
+      const Options& options,
+      const std::shared_ptr<brillo::http::Transport>& transport);
 
+  // Fails the requests in flight and the queued ones, so that libweave never
+  // waits for them.
   ~HttpTransportClient() override;
 
   void SendRequest(Method method,
@@ -41,7 +67,55 @@ class HttpTransportClient : public weave::provider::HttpClient {
                    const SendRequestCallback& callback) override;
 
  private:
+  struct PendingRequest {
+    Method method;
+    std::string url;
+    Headers headers;
+    std::string data;
+    SendRequestCallback callback;
+  };
+
+  struct HostState {
+    size_t active_requests{0};
+    std::deque<PendingRequest> queue;
+  };
+
+  // A request started on the transport, which has not completed yet.
+  struct ActiveRequest {
+    std::string host;
+    SendRequestCallback callback;
+    // The transport's ID of the request, 0 if it is not known (yet).
+    int transport_request_id;
+    brillo::MessageLoop::TaskId timeout_task;
+  };
+
+  // Sends |request| to |host|. Returns false if the request could not be
+  // sent, in which case its callback is invoked asynchronously with an error.
+  bool StartRequest(const std::string& host, const PendingRequest& request);
+  void OnSuccess(int request_id,
+                 int transport_request_id,
+                 std::unique_ptr<brillo::http::Response> response);
+  void OnError(int request_id,
+               int transport_request_id,
+               const brillo::Error* brillo_error);
+  // Cancels the request |request_id| and fails it with a timeout error.
+  void OnTimeout(int request_id);
+  // Removes the request |request_id| from the active requests and starts the
+  // queued requests allowed by the per-host limit. Returns false if the
+  // request is no longer active, i.e. it has timed out already, otherwise
+  // sets |callback| to the callback of the request.
+  bool OnRequestDone(int request_id, SendRequestCallback* callback);
+  void StartQueuedRequests(const std::string& host);
+
+  Options options_;
   std::shared_ptr<brillo::http::Transport> transport_;
+  std::map<std::string, HostState> hosts_;
+  // The requests in flight, by an ID assigned by this class. The transport
+  // request IDs can't be used, as the transport may not provide one.
+  std::map<int, ActiveRequest> active_requests_;
+  int last_request_id_{0};
+
+  base::WeakPtrFactory<HttpTransportClient> weak_ptr_factory_{this};
   DISALLOW_COPY_AND_ASSIGN(HttpTransportClient);
 };
 
@@ -0,0 +1,148 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/http_transport_client.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/bind.h>
+#include <base/test/simple_test_clock.h>
+#include <brillo/http/http_transport_fake.h>
+#include <brillo/message_loops/fake_message_loop.h>
+#include <brillo/mime_utils.h>
+#include <gtest/gtest.h>
+#include <weave/error.h>
+
+namespace buffet {
+
+namespace {
+
+const char kUrlA1[] = "https://a.example.com/1";
+const char kUrlA2[] = "https://a.example.com/2";
+const char kUrlB1[] = "https://b.example.com/1";
+
+}  // anonymous namespace
+
+class HttpTransportClientTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    message_loop_.SetAsCurrent();
+    // The requests complete only when the test handles them.
+    transport_->SetAsync(true);
+    for (const char* url : {kUrlA1, kUrlA2, kUrlB1}) {
+      transport_->AddSimpleReplyHandler(url, brillo::http::request_type::kGet,
+                                        brillo::http::status_code::Ok, url,
+                                        brillo::mime::text::kPlain);
+    }
+  }
+
+  void CreateClient(const HttpTransportClient::Options& options) {
+    client_.reset(new HttpTransportClient{options, transport_});
+  }
+
+  void SendRequest(const std::string& url) {
+    client_->SendRequest(
+        weave::provider::HttpClient::Method::kGet, url, {}, "",
+        base::Bind(&HttpTransportClientTest::OnResponse,
+                   base::Unretained(this)));
+  }
+
+  // Records the response data, or the error code.
+  void OnResponse(std::unique_ptr<weave::provider::HttpClient::Response> r,
+                  weave::ErrorPtr error) {
+    results_.push_back(r ? r->GetData() : error->GetCode());
+  }
+
+  void AdvanceTime(base::TimeDelta delta) {
+    clock_.Advance(delta);
+    while (message_loop_.RunOnce(false)) {
+    }
+  }
+
+  base::SimpleTestClock clock_;
+  brillo::FakeMessageLoop message_loop_{&clock_};
+  std::shared_ptr<brillo::http::fake::Transport> transport_{
+      std::make_shared<brillo::http::fake::Transport>()};
+  std::unique_ptr<HttpTransportClient> client_;
+  std::vector<std::string> results_;
+};
+
+TEST_F(HttpTransportClientTest, CompletionCancelsTimeout) {
+  HttpTransportClient::Options options;
+  options.read_timeout = base::TimeDelta::FromSeconds(5);
+  CreateClient(options);
+  SendRequest(kUrlA1);
+  EXPECT_TRUE(results_.empty());
+
+  transport_->HandleAllAsyncRequests();
+  EXPECT_EQ(std::vector<std::string>{kUrlA1}, results_);
+  AdvanceTime(base::TimeDelta::FromSeconds(10));
+  EXPECT_EQ(std::vector<std::string>{kUrlA1}, results_);
+}
+
+TEST_F(HttpTransportClientTest, TimeoutIgnoresLateCompletion) {
+  HttpTransportClient::Options options;
+  options.read_timeout = base::TimeDelta::FromSeconds(5);
+  options.max_requests_per_host = 1;
+  CreateClient(options);
+  SendRequest(kUrlA1);
+  SendRequest(kUrlA2);
+
+  AdvanceTime(base::TimeDelta::FromSeconds(4));
+  EXPECT_TRUE(results_.empty());
+  // The timeout frees the slot of the first request for the second one.
+  AdvanceTime(base::TimeDelta::FromSeconds(1));
+  EXPECT_EQ(std::vector<std::string>{"timeout"}, results_);
+
+  // The fake transport can't cancel requests, so the first one completes
+  // anyway, and must not be reported again.
+  transport_->HandleAllAsyncRequests();
+  EXPECT_EQ((std::vector<std::string>{"timeout", kUrlA2}), results_);
+}
+
+TEST_F(HttpTransportClientTest, PerHostLimit) {
+  HttpTransportClient::Options options;
+  options.max_requests_per_host = 1;
+  CreateClient(options);
+  SendRequest(kUrlA1);
+  SendRequest(kUrlA2);
+  SendRequest(kUrlB1);
+
+  // The second request to a.example.com starts only after the first one
+  // completes, so it completes last.
+  transport_->HandleAllAsyncRequests();
+  transport_->HandleAllAsyncRequests();
+  EXPECT_EQ((std::vector<std::string>{kUrlA1, kUrlB1, kUrlA2}), results_);
+}
+
+TEST_F(HttpTransportClientTest, DestructionFailsPendingRequests) {
+  HttpTransportClient::Options options;
+  options.max_requests_per_host = 1;
+  CreateClient(options);
+  SendRequest(kUrlA1);
+  SendRequest(kUrlA2);
+
+  client_.reset();
+  EXPECT_TRUE(results_.empty());
+  AdvanceTime(base::TimeDelta{});
+  EXPECT_EQ((std::vector<std::string>{"request_cancelled",
+                                      "request_cancelled"}),
+            results_);
+  transport_->HandleAllAsyncRequests();
+  EXPECT_EQ(2u, results_.size());
+}
+
+}  // namespace buffet
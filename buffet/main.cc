@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <memory>
 #include <string>
 
 #include <signal.h>
@@ -27,6 +29,7 @@
 #include <brillo/strings/string_utils.h>
 #include <brillo/syslog_logging.h>
 
+#include "buffet/binder_dispatcher.h"
 #include "buffet/buffet_config.h"
 #include "buffet/dbus_constants.h"
 #include "buffet/manager.h"
@@ -41,14 +44,21 @@ namespace buffet {
 
 class Daemon final : public DBusServiceDaemon {
  public:
-  explicit Daemon(const Manager::Options& options)
-      : DBusServiceDaemon(kServiceName, kRootServicePath), options_{options} {}
+  Daemon(const Manager::Options& options, size_t binder_threads)
+      : DBusServiceDaemon(kServiceName, kRootServicePath),
+        options_{options},
+        binder_threads_{binder_threads} {}
 
  protected:
   int OnInit() override {
     android::BinderWrapper::Create();
-    if (!binder_watcher_.Init())
+    if (binder_threads_ > 0) {
+      binder_dispatcher_ = BinderDispatcher::Start(binder_threads_);
+      if (!binder_dispatcher_)
+        return EX_OSERR;
+    } else if (!binder_watcher_.Init()) {
       return EX_OSERR;
+    }
 
     return brillo::DBusServiceDaemon::OnInit();
   }
@@ -63,9 +73,17 @@ class Daemon final : public DBusServiceDaemon {
 
   void OnShutdown(int* return_code) override { manager_->Stop(); }
 
+  // SIGHUP recreates the weave device without tearing down the daemon.
+  bool OnRestart() override {
+    manager_->RestartDevice();
+    return true;
+  }
+
  private:
   Manager::Options options_;
+  size_t binder_threads_;
   brillo::BinderWatcher binder_watcher_;
+  std::unique_ptr<BinderDispatcher> binder_dispatcher_;
   android::sp<buffet::Manager> manager_;
 
   DISALLOW_COPY_AND_ASSIGN(Daemon);
@@ -77,6 +95,7 @@ namespace {
 
 const char kDefaultConfigFilePath[] = "/etc/weaved/weaved.conf";
 const char kDefaultStateFilePath[] = "/data/misc/weaved/device_reg_info";
+const char kDefinitionsCachePath[] = "/data/misc/weaved/definitions_cache";
 
 }  // namespace
 
@@ -90,6 +109,22 @@ int main(int argc, char* argv[]) {
               "Connect to GCD via a persistent XMPP connection.");
   DEFINE_bool(disable_privet, false, "disable Privet protocol");
   DEFINE_bool(enable_ping, false, "enable test HTTP handler at /privet/ping");
+  DEFINE_int32(notification_delay_ms, 50,
+               "Interval over which service manager change notifications are "
+               "batched, in milliseconds (0 disables batching).");
+  DEFINE_int32(max_in_flight_commands, 0,
+               "Maximum number of commands delivered to a client and not yet "
+               "finished by it (0 means no limit).");
+  DEFINE_bool(abort_commands_when_busy, false,
+              "Abort the commands over the in-flight limit instead of holding "
+              "them until the client catches up.");
+  DEFINE_int32(progress_interval_ms, 200,
+               "Minimum interval between the command progress updates passed "
+               "on to libweave, in milliseconds (0 disables throttling).");
+  DEFINE_int32(binder_threads, 0,
+               "Number of binder threads serving the read-only binder calls, "
+               "while the other calls are passed on to the main thread (0 "
+               "serves all binder calls on the main thread).");
   DEFINE_string(device_whitelist, "",
                 "Comma separated list of network interfaces to monitor for "
                 "connectivity (an empty list enables all interfaces).");
@@ -123,14 +158,27 @@ int main(int argc, char* argv[]) {
   options.disable_privet = FLAGS_disable_privet;
   options.enable_ping = FLAGS_enable_ping;
   options.device_whitelist = {device_whitelist.begin(), device_whitelist.end()};
+  options.notification_delay =
+      base::TimeDelta::FromMilliseconds(FLAGS_notification_delay_ms);
+  options.command_delivery_options.max_in_flight_commands =
+      std::max(FLAGS_max_in_flight_commands, 0);
+  options.command_delivery_options.overflow_policy =
+      FLAGS_abort_commands_when_busy
+          ? buffet::BinderWeaveService::OverflowPolicy::kAbort
+          : buffet::BinderWeaveService::OverflowPolicy::kHold;
+  options.command_delivery_options.progress_interval =
+      base::TimeDelta::FromMilliseconds(FLAGS_progress_interval_ms);
 
   options.config_options.defaults = base::FilePath{FLAGS_config_path};
   options.config_options.settings = base::FilePath{FLAGS_state_path};
   options.config_options.definitions = base::FilePath{"/etc/weaved"};
   options.config_options.test_definitions =
       base::FilePath{FLAGS_test_definitions_path};
+  options.config_options.definitions_cache =
+      base::FilePath{kDefinitionsCachePath};
   options.config_options.test_privet_ssid = FLAGS_test_privet_ssid;
 
-  buffet::Daemon daemon{options};
+  buffet::Daemon daemon{options,
+                        static_cast<size_t>(std::max(FLAGS_binder_threads, 0))};
   return daemon.Run();
 }
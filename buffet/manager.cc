@@ -14,17 +14,19 @@
 
 #include "buffet/manager.h"
 
+#include <algorithm>
+#include <iterator>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 
 #include <base/bind.h>
 #include <base/bind_helpers.h>
-#include <base/files/file_enumerator.h>
-#include <base/files/file_util.h>
 #include <base/json/json_reader.h>
 #include <base/json/json_writer.h>
 #include <base/message_loop/message_loop.h>
+#include <base/rand_util.h>
 #include <base/time/time.h>
 #include <binderwrapper/binder_wrapper.h>
 #include <cutils/properties.h>
@@ -41,14 +43,19 @@
 #include <weave/enum_to_string.h>
 
 #include "brillo/weaved_system_properties.h"
+#include "buffet/binder_dispatcher.h"
 #include "buffet/bluetooth_client.h"
 #include "buffet/buffet_config.h"
+#include "buffet/definition_loader.h"
 #include "buffet/http_transport_client.h"
 #include "buffet/mdns_client.h"
 #include "buffet/shill_client.h"
 #include "buffet/weave_error_conversion.h"
 #include "buffet/webserv_client.h"
+#include "common/binder_constants.h"
 #include "common/binder_utils.h"
+#include "common/json_patch.h"
+#include "common/parcelable_dictionary.h"
 
 using brillo::dbus_utils::AsyncEventSequencer;
 using NotificationListener =
@@ -58,106 +65,93 @@ namespace buffet {
 
 namespace {
 
-const char kErrorDomain[] = "buffet";
-const char kFileReadError[] = "file_read_error";
 const char kBaseComponent[] = "base";
 const char kRebootCommand[] = "base.reboot";
 
-bool LoadFile(const base::FilePath& file_path,
-              std::string* data,
-              brillo::ErrorPtr* error) {
-  if (!base::ReadFileToString(file_path, data)) {
-    brillo::errors::system::AddSystemError(error, FROM_HERE, errno);
-    brillo::Error::AddToPrintf(error, FROM_HERE, kErrorDomain, kFileReadError,
-                               "Failed to read file '%s'",
-                               file_path.value().c_str());
-    return false;
-  }
-  return true;
-}
-
-void LoadTraitDefinitions(const BuffetConfig::Options& options,
-                          weave::Device* device) {
-  // Load component-specific device trait definitions.
-  base::FilePath dir{options.definitions.Append("traits")};
-  LOG(INFO) << "Looking for trait definitions in " << dir.value();
-  base::FileEnumerator enumerator(dir, false, base::FileEnumerator::FILES,
-                                  FILE_PATH_LITERAL("*.json"));
-  std::vector<std::string> result;
-  for (base::FilePath path = enumerator.Next(); !path.empty();
-       path = enumerator.Next()) {
-    LOG(INFO) << "Loading trait definition from " << path.value();
-    std::string json;
-    CHECK(LoadFile(path, &json, nullptr));
-    device->AddTraitDefinitionsFromJson(json);
+// The versions of the trait definitions and the component tree start at a
+// random multiple of 2^kVersionEpochShift, leaving room for that many changes
+// per process. They stay below 2^53, since the component tree version is also
+// sent as a double in the COMPONENTS notification value.
+const int kVersionEpochShift = 21;
+const uint64_t kVersionEpochCount = 1ull << 31;
+
+int64_t NewVersionEpoch() {
+  return static_cast<int64_t>(base::RandGenerator(kVersionEpochCount) + 1)
+         << kVersionEpochShift;
+}
+
+using android::weave::DeviceInfo;
+using StateProperty = std::string ManagerStateSnapshot::*;
+using DeviceInfoField = std::string DeviceInfo::*;
+
+// The state properties along with the ID of their change notification and
+// their field in DeviceInfo. Both getAllProperties() and getDeviceInfo() are
+// filled from this table.
+const struct {
+  int notification_id;
+  StateProperty property;
+  DeviceInfoField device_info_field;
+} kStateProperties[] = {
+    {NotificationListener::CLOUD_ID, &ManagerStateSnapshot::cloud_id,
+     &DeviceInfo::cloud_id},
+    {NotificationListener::DEVICE_ID, &ManagerStateSnapshot::device_id,
+     &DeviceInfo::device_id},
+    {NotificationListener::DEVICE_NAME, &ManagerStateSnapshot::device_name,
+     &DeviceInfo::name},
+    {NotificationListener::DEVICE_DESCRIPTION,
+     &ManagerStateSnapshot::device_description, &DeviceInfo::description},
+    {NotificationListener::DEVICE_LOCATION,
+     &ManagerStateSnapshot::device_location, &DeviceInfo::location},
+    {NotificationListener::OEM_NAME, &ManagerStateSnapshot::oem_name,
+     &DeviceInfo::oem_name},
+    {NotificationListener::MODEL_NAME, &ManagerStateSnapshot::model_name,
+     &DeviceInfo::model_name},
+    {NotificationListener::MODEL_ID, &ManagerStateSnapshot::model_id,
+     &DeviceInfo::model_id},
+    {NotificationListener::PAIRING_SESSION_ID,
+     &ManagerStateSnapshot::pairing_session_id,
+     &DeviceInfo::pairing_session_id},
+    {NotificationListener::PAIRING_MODE, &ManagerStateSnapshot::pairing_mode,
+     &DeviceInfo::pairing_mode},
+    {NotificationListener::PAIRING_CODE, &ManagerStateSnapshot::pairing_code,
+     &DeviceInfo::pairing_code},
+    {NotificationListener::STATE, &ManagerStateSnapshot::state,
+     &DeviceInfo::state},
+};
+
+// Returns the state property for |notification_id|, or nullptr if the
+// notification is not about one of them.
+StateProperty GetStateProperty(int notification_id) {
+  for (const auto& entry : kStateProperties) {
+    if (entry.notification_id == notification_id)
+      return entry.property;
   }
+  return nullptr;
 }
 
-void LoadCommandDefinitions(const BuffetConfig::Options& options,
-                            weave::Device* device) {
-  auto load_packages = [device](const base::FilePath& root,
-                                const base::FilePath::StringType& pattern) {
-    base::FilePath dir{root.Append("commands")};
-    LOG(INFO) << "Looking for command schemas in " << dir.value();
-    base::FileEnumerator enumerator(dir, false, base::FileEnumerator::FILES,
-                                    pattern);
-    for (base::FilePath path = enumerator.Next(); !path.empty();
-         path = enumerator.Next()) {
-      LOG(INFO) << "Loading command schema from " << path.value();
-      std::string json;
-      CHECK(LoadFile(path, &json, nullptr));
-      device->AddCommandDefinitionsFromJson(json);
-    }
-  };
-  load_packages(options.definitions, FILE_PATH_LITERAL("*.json"));
-  if (!options.test_definitions.empty())
-    load_packages(options.test_definitions, FILE_PATH_LITERAL("*test.json"));
-}
-
-void LoadStateDefinitions(const BuffetConfig::Options& options,
-                          weave::Device* device) {
-  // Load component-specific device state definitions.
-  base::FilePath dir{options.definitions.Append("states")};
-  LOG(INFO) << "Looking for state definitions in " << dir.value();
-  base::FileEnumerator enumerator(dir, false, base::FileEnumerator::FILES,
-                                  FILE_PATH_LITERAL("*.schema.json"));
-  std::vector<std::string> result;
-  for (base::FilePath path = enumerator.Next(); !path.empty();
-       path = enumerator.Next()) {
-    LOG(INFO) << "Loading state definition from " << path.value();
-    std::string json;
-    CHECK(LoadFile(path, &json, nullptr));
-    device->AddStateDefinitionsFromJson(json);
-  }
+// Returned by the getters of the trait definitions and the component tree
+// while there is no weave device, e.g. during a restart or shutdown.
+android::binder::Status ReportNoDevice() {
+  return android::binder::Status::fromServiceSpecificError(
+      1, android::String8{"Weave device is not available"});
 }
 
-void LoadStateDefaults(const BuffetConfig::Options& options,
-                       weave::Device* device) {
-  // Load component-specific device state defaults.
-  base::FilePath dir{options.definitions.Append("states")};
-  LOG(INFO) << "Looking for state defaults in " << dir.value();
-  base::FileEnumerator enumerator(dir, false, base::FileEnumerator::FILES,
-                                  FILE_PATH_LITERAL("*.defaults.json"));
-  std::vector<std::string> result;
-  for (base::FilePath path = enumerator.Next(); !path.empty();
-       path = enumerator.Next()) {
-    LOG(INFO) << "Loading state defaults from " << path.value();
-    std::string json;
-    CHECK(LoadFile(path, &json, nullptr));
-    CHECK(device->SetStatePropertiesFromJson(json, nullptr));
-  }
+// Returns true if a listener with the given notification |mask| is
+// interested in |notification_id|.
+bool IsInNotificationMask(int notification_id, int mask) {
+  return (mask & (1 << notification_id)) != 0;
 }
 
-// Updates the manager's state property if the new value is different from
+// Updates the state property of |snapshot| if the new value is different from
 // the current value. In this case also adds the appropriate notification ID
 // to the array to record the state change for clients.
-void UpdateValue(Manager* manager,
-                 std::string Manager::* prop,
+void UpdateValue(ManagerStateSnapshot* snapshot,
+                 StateProperty prop,
                  const std::string& new_value,
                  int notification,
                  std::vector<int>* notification_ids) {
-  if (manager->*prop != new_value) {
-    manager->*prop = new_value;
+  if (snapshot->*prop != new_value) {
+    snapshot->*prop = new_value;
     notification_ids->push_back(notification);
   }
 }
@@ -175,18 +169,33 @@ class Manager::TaskRunner : public weave::provider::TaskRunner {
 
 Manager::Manager(const Options& options,
                  const scoped_refptr<dbus::Bus>& bus)
-    : options_{options}, bus_{bus} {}
+    : options_{options}, bus_{bus} {
+  // Clients may keep versions across a restart of weaved.
+  traits_cache_.version = NewVersionEpoch();
+  components_cache_.version = NewVersionEpoch();
+}
 
 Manager::~Manager() {
+  // The last reference may be released on a binder thread.
+  BinderDispatcher::RunOnMainThread(
+      base::Bind(&Manager::Shutdown, base::Unretained(this)));
+}
+
+void Manager::Shutdown() {
   android::BinderWrapper* binder_wrapper = android::BinderWrapper::Get();
-  for (const auto& listener : notification_listeners_) {
+  for (const auto& pair : notification_listeners_) {
     binder_wrapper->UnregisterForDeathNotifications(
-        android::IInterface::asBinder(listener));
+        android::IInterface::asBinder(pair.first));
   }
   for (const auto& pair : services_) {
     binder_wrapper->UnregisterForDeathNotifications(
         android::IInterface::asBinder(pair.first));
   }
+  weak_ptr_factory_.InvalidateWeakPtrs();
+  services_.clear();
+  pending_clients_.clear();
+  notification_listeners_.clear();
+  Stop();
 }
 
 void Manager::Start(AsyncEventSequencer* sequencer) {
@@ -195,11 +204,18 @@ void Manager::Start(AsyncEventSequencer* sequencer) {
 }
 
 void Manager::RestartWeave(AsyncEventSequencer* sequencer) {
+  // Once the device exists the providers are up, and tearing them down would
+  // leave the client services bound to the destroyed device.
+  if (device_)
+    return RestartDevice();
   Stop();
 
+  // Start loading the definitions while waiting for the web server.
+  definition_loader_.reset(new DefinitionLoader{options_.config_options});
+  definition_loader_->Start();
   task_runner_.reset(new TaskRunner{});
   config_.reset(new BuffetConfig{options_.config_options});
-  http_client_.reset(new HttpTransportClient);
+  http_client_.reset(new HttpTransportClient{options_.http_options});
   shill_client_.reset(new ShillClient{bus_,
                                       options_.device_whitelist,
                                       !options_.xmpp_enabled});
@@ -229,19 +245,27 @@ void Manager::RestartWeave(AsyncEventSequencer* sequencer) {
     CreateDevice();
 }
 
+void Manager::StartForTesting(std::unique_ptr<weave::Device> device) {
+  Stop();
+  AttachDevice(std::move(device));
+}
+
 void Manager::CreateDevice() {
   if (device_)
     return;
 
-  device_ = weave::Device::Create(config_.get(), task_runner_.get(),
-                                  http_client_.get(), shill_client_.get(),
-                                  mdns_client_.get(), web_serv_client_.get(),
-                                  shill_client_.get(), bluetooth_client_.get());
+  std::unique_ptr<weave::Device> device = weave::Device::Create(
+      config_.get(), task_runner_.get(), http_client_.get(),
+      shill_client_.get(), mdns_client_.get(), web_serv_client_.get(),
+      shill_client_.get(), bluetooth_client_.get());
 
-  LoadTraitDefinitions(options_.config_options, device_.get());
-  LoadCommandDefinitions(options_.config_options, device_.get());
-  LoadStateDefinitions(options_.config_options, device_.get());
-  LoadStateDefaults(options_.config_options, device_.get());
+  // The loader keeps the parsed definitions for RestartDevice().
+  definition_loader_->LoadInto(device.get());
+  AttachDevice(std::move(device));
+}
+
+void Manager::AttachDevice(std::unique_ptr<weave::Device> device) {
+  device_ = std::move(device);
 
   device_->AddSettingsChangedCallback(
       base::Bind(&Manager::OnConfigChanged, weak_ptr_factory_.GetWeakPtr()));
@@ -270,8 +294,41 @@ void Manager::CreateDevice() {
   CreateServicesForClients();
 }
 
-void Manager::Stop() {
+void Manager::RestartDevice() {
+  if (!device_) {
+    LOG(WARNING) << "Weave device is not created yet, nothing to restart";
+    return;
+  }
+  LOG(INFO) << "Restarting weave device";
+  std::unique_ptr<base::DictionaryValue> components{
+      device_->GetComponents().DeepCopy()};
+  // CreateDevice() also creates the services of the pending clients, which
+  // are bound to the new device already.
+  std::vector<android::sp<BinderWeaveService>> services;
+  for (const auto& pair : services_)
+    services.push_back(pair.second);
+  DestroyDevice();
+  CreateDevice();
+  for (const auto& service : services)
+    service->Rebind(device_.get(), *components);
+}
+
+void Manager::DestroyDevice() {
+  // Pending notifications refer to the device being destroyed.
+  if (notification_task_ != brillo::MessageLoop::kTaskIdNull) {
+    brillo::MessageLoop::current()->CancelTask(notification_task_);
+    notification_task_ = brillo::MessageLoop::kTaskIdNull;
+  }
+  pending_notification_ids_.clear();
   device_.reset();
+  notified_components_.reset();
+  InvalidateJsonCache(&traits_cache_);
+  InvalidateJsonCache(&components_cache_);
+}
+
+void Manager::Stop() {
+  DestroyDevice();
+  definition_loader_.reset();
 #ifdef BUFFET_USE_WIFI_BOOTSTRAPPING
   web_serv_client_.reset();
   mdns_client_.reset();
@@ -283,38 +340,56 @@ void Manager::Stop() {
 }
 
 void Manager::OnTraitDefsChanged() {
+  InvalidateJsonCache(&traits_cache_);
   NotifyServiceManagerChange({NotificationListener::TRAITS});
 }
 
 void Manager::OnComponentTreeChanged() {
+  InvalidateJsonCache(&components_cache_);
   NotifyServiceManagerChange({NotificationListener::COMPONENTS});
 }
 
+std::shared_ptr<const ManagerStateSnapshot> Manager::GetStateSnapshot() const {
+  return std::atomic_load(&state_snapshot_);
+}
+
+void Manager::PublishStateSnapshot(
+    const std::shared_ptr<const ManagerStateSnapshot>& snapshot,
+    const std::vector<int>& notification_ids) {
+  if (notification_ids.empty())
+    return;
+  std::atomic_store(&state_snapshot_, snapshot);
+  NotifyServiceManagerChange(notification_ids);
+}
+
 void Manager::OnGcdStateChanged(weave::GcdState state) {
-  state_ = weave::EnumToString(state);
-  NotifyServiceManagerChange({NotificationListener::STATE});
-  property_set(weaved::system_properties::kState, state_.c_str());
+  auto snapshot = std::make_shared<ManagerStateSnapshot>(*GetStateSnapshot());
+  snapshot->state = weave::EnumToString(state);
+  PublishStateSnapshot(snapshot, {NotificationListener::STATE});
+  property_set(weaved::system_properties::kState, snapshot->state.c_str());
 }
 
 void Manager::OnConfigChanged(const weave::Settings& settings) {
+  auto snapshot = std::make_shared<ManagerStateSnapshot>(*GetStateSnapshot());
   std::vector<int> ids;
-  UpdateValue(this, &Manager::cloud_id_, settings.cloud_id,
-              NotificationListener::CLOUD_ID, &ids);
-  UpdateValue(this, &Manager::device_id_, settings.device_id,
-              NotificationListener::DEVICE_ID, &ids);
-  UpdateValue(this, &Manager::device_name_, settings.name,
-              NotificationListener::DEVICE_NAME, &ids);
-  UpdateValue(this, &Manager::device_description_, settings.description,
-              NotificationListener::DEVICE_DESCRIPTION, &ids);
-  UpdateValue(this, &Manager::device_location_, settings.location,
-              NotificationListener::DEVICE_LOCATION, &ids);
-  UpdateValue(this, &Manager::oem_name_, settings.oem_name,
-              NotificationListener::OEM_NAME, &ids);
-  UpdateValue(this, &Manager::model_id_, settings.model_id,
-              NotificationListener::MODEL_ID, &ids);
-  UpdateValue(this, &Manager::model_name_, settings.model_name,
-              NotificationListener::MODEL_NAME, &ids);
-  NotifyServiceManagerChange(ids);
+  UpdateValue(snapshot.get(), &ManagerStateSnapshot::cloud_id,
+              settings.cloud_id, NotificationListener::CLOUD_ID, &ids);
+  UpdateValue(snapshot.get(), &ManagerStateSnapshot::device_id,
+              settings.device_id, NotificationListener::DEVICE_ID, &ids);
+  UpdateValue(snapshot.get(), &ManagerStateSnapshot::device_name,
+              settings.name, NotificationListener::DEVICE_NAME, &ids);
+  UpdateValue(snapshot.get(), &ManagerStateSnapshot::device_description,
+              settings.description, NotificationListener::DEVICE_DESCRIPTION,
+              &ids);
+  UpdateValue(snapshot.get(), &ManagerStateSnapshot::device_location,
+              settings.location, NotificationListener::DEVICE_LOCATION, &ids);
+  UpdateValue(snapshot.get(), &ManagerStateSnapshot::oem_name,
+              settings.oem_name, NotificationListener::OEM_NAME, &ids);
+  UpdateValue(snapshot.get(), &ManagerStateSnapshot::model_id,
+              settings.model_id, NotificationListener::MODEL_ID, &ids);
+  UpdateValue(snapshot.get(), &ManagerStateSnapshot::model_name,
+              settings.model_name, NotificationListener::MODEL_NAME, &ids);
+  PublishStateSnapshot(snapshot, ids);
 }
 
 void Manager::OnPairingStart(const std::string& session_id,
@@ -322,28 +397,32 @@ void Manager::OnPairingStart(const std::string& session_id,
                              const std::vector<uint8_t>& code) {
   // For now, just overwrite the exposed PairInfo with the most recent pairing
   // attempt.
+  auto snapshot = std::make_shared<ManagerStateSnapshot>(*GetStateSnapshot());
   std::vector<int> ids;
-  UpdateValue(this, &Manager::pairing_session_id_, session_id,
-              NotificationListener::PAIRING_SESSION_ID, &ids);
-  UpdateValue(this, &Manager::pairing_mode_, EnumToString(pairing_type),
-              NotificationListener::PAIRING_MODE, &ids);
+  UpdateValue(snapshot.get(), &ManagerStateSnapshot::pairing_session_id,
+              session_id, NotificationListener::PAIRING_SESSION_ID, &ids);
+  UpdateValue(snapshot.get(), &ManagerStateSnapshot::pairing_mode,
+              EnumToString(pairing_type), NotificationListener::PAIRING_MODE,
+              &ids);
   std::string pairing_code{code.begin(), code.end()};
-  UpdateValue(this, &Manager::pairing_code_, pairing_code,
-              NotificationListener::PAIRING_CODE, &ids);
-  NotifyServiceManagerChange(ids);
+  UpdateValue(snapshot.get(), &ManagerStateSnapshot::pairing_code,
+              pairing_code, NotificationListener::PAIRING_CODE, &ids);
+  PublishStateSnapshot(snapshot, ids);
 }
 
 void Manager::OnPairingEnd(const std::string& session_id) {
-  if (pairing_session_id_ != session_id)
+  std::shared_ptr<const ManagerStateSnapshot> current = GetStateSnapshot();
+  if (current->pairing_session_id != session_id)
     return;
+  auto snapshot = std::make_shared<ManagerStateSnapshot>(*current);
   std::vector<int> ids;
-  UpdateValue(this, &Manager::pairing_session_id_, "",
+  UpdateValue(snapshot.get(), &ManagerStateSnapshot::pairing_session_id, "",
               NotificationListener::PAIRING_SESSION_ID, &ids);
-  UpdateValue(this, &Manager::pairing_mode_, "",
+  UpdateValue(snapshot.get(), &ManagerStateSnapshot::pairing_mode, "",
               NotificationListener::PAIRING_MODE, &ids);
-  UpdateValue(this, &Manager::pairing_code_, "",
+  UpdateValue(snapshot.get(), &ManagerStateSnapshot::pairing_code, "",
               NotificationListener::PAIRING_CODE, &ids);
-  NotifyServiceManagerChange(ids);
+  PublishStateSnapshot(snapshot, ids);
 }
 
 void Manager::OnRebootDevice(const std::weak_ptr<weave::Command>& cmd) {
@@ -361,6 +440,37 @@ void Manager::RebootDeviceNow() {
   power_manager_client_.Reboot(android::RebootReason::DEFAULT);
 }
 
+android::status_t Manager::onTransact(uint32_t code,
+                                      const android::Parcel& data,
+                                      android::Parcel* reply,
+                                      uint32_t flags) {
+  using android::weave::IWeaveServiceManager;
+  switch (code) {
+    case IWeaveServiceManager::GETCLOUDID:
+    case IWeaveServiceManager::GETDEVICEID:
+    case IWeaveServiceManager::GETDEVICENAME:
+    case IWeaveServiceManager::GETDEVICEDESCRIPTION:
+    case IWeaveServiceManager::GETDEVICELOCATION:
+    case IWeaveServiceManager::GETOEMNAME:
+    case IWeaveServiceManager::GETMODELNAME:
+    case IWeaveServiceManager::GETMODELID:
+    case IWeaveServiceManager::GETPAIRINGSESSIONID:
+    case IWeaveServiceManager::GETPAIRINGMODE:
+    case IWeaveServiceManager::GETPAIRINGCODE:
+    case IWeaveServiceManager::GETSTATE:
+    case IWeaveServiceManager::GETALLPROPERTIES:
+    case IWeaveServiceManager::GETDEVICEINFO:
+    case IWeaveServiceManager::GETTRAITS:
+    case IWeaveServiceManager::GETCOMPONENTS:
+    case IWeaveServiceManager::GETTRAITSIFCHANGED:
+    case IWeaveServiceManager::GETCOMPONENTSIFCHANGED:
+      return BnWeaveServiceManager::onTransact(code, data, reply, flags);
+  }
+  return BinderDispatcher::TransactOnMainThread(base::Bind([&]() {
+    return BnWeaveServiceManager::onTransact(code, data, reply, flags);
+  }));
+}
+
 android::binder::Status Manager::connect(
     const android::sp<android::weave::IWeaveClient>& client) {
   pending_clients_.push_back(client);
@@ -371,83 +481,213 @@ android::binder::Status Manager::connect(
 
 android::binder::Status Manager::registerNotificationListener(
     const WeaveServiceManagerNotificationListener& listener) {
-  notification_listeners_.insert(listener);
+  AddNotificationListener(listener, false);
+  return android::binder::Status::ok();
+}
+
+android::binder::Status Manager::registerNotificationListenerWithValues(
+    const WeaveServiceManagerNotificationListener& listener) {
+  AddNotificationListener(listener, true);
+  return android::binder::Status::ok();
+}
+
+android::binder::Status Manager::setNotificationMask(
+    const WeaveServiceManagerNotificationListener& listener,
+    int32_t mask) {
+  auto it = notification_listeners_.find(listener);
+  if (it == notification_listeners_.end()) {
+    LOG(WARNING) << "Notification mask set for an unknown listener";
+    return android::binder::Status::ok();
+  }
+  it->second.mask = mask;
+  return android::binder::Status::ok();
+}
+
+void Manager::AddNotificationListener(
+    const WeaveServiceManagerNotificationListener& listener,
+    bool with_values) {
+  auto pair = notification_listeners_.emplace(listener,
+                                              NotificationListenerInfo{});
+  pair.first->second.with_values = with_values;
+  if (!pair.second)
+    return;
   android::BinderWrapper::Get()->RegisterForDeathNotifications(
       android::IInterface::asBinder(listener),
-      base::Bind(&Manager::OnNotificationListenerDestroyed,
-                 weak_ptr_factory_.GetWeakPtr(), listener));
-  return android::binder::Status::ok();
+      BinderDispatcher::BindToMainThread(
+          base::Bind(&Manager::OnNotificationListenerDestroyed,
+                     weak_ptr_factory_.GetWeakPtr(), listener)));
 }
 
 android::binder::Status Manager::getCloudId(android::String16* id) {
-  *id = weaved::binder_utils::ToString16(cloud_id_);
+  *id = weaved::binder_utils::ToString16(GetStateSnapshot()->cloud_id);
   return android::binder::Status::ok();
 }
 
 android::binder::Status Manager::getDeviceId(android::String16* id) {
-  *id = weaved::binder_utils::ToString16(device_id_);
+  *id = weaved::binder_utils::ToString16(GetStateSnapshot()->device_id);
   return android::binder::Status::ok();
 }
 
 android::binder::Status Manager::getDeviceName(android::String16* name) {
-  *name = weaved::binder_utils::ToString16(device_name_);
+  *name = weaved::binder_utils::ToString16(GetStateSnapshot()->device_name);
   return android::binder::Status::ok();
 }
 
 android::binder::Status Manager::getDeviceDescription(
     android::String16* description) {
-  *description = weaved::binder_utils::ToString16(device_description_);
+  *description =
+      weaved::binder_utils::ToString16(GetStateSnapshot()->device_description);
   return android::binder::Status::ok();
 }
 
 android::binder::Status Manager::getDeviceLocation(
     android::String16* location) {
-  *location = weaved::binder_utils::ToString16(device_location_);
+  *location =
+      weaved::binder_utils::ToString16(GetStateSnapshot()->device_location);
   return android::binder::Status::ok();
 }
 
 android::binder::Status Manager::getOemName(android::String16* name) {
-  *name = weaved::binder_utils::ToString16(oem_name_);
+  *name = weaved::binder_utils::ToString16(GetStateSnapshot()->oem_name);
   return android::binder::Status::ok();
 }
 
 android::binder::Status Manager::getModelName(android::String16* name) {
-  *name = weaved::binder_utils::ToString16(model_name_);
+  *name = weaved::binder_utils::ToString16(GetStateSnapshot()->model_name);
   return android::binder::Status::ok();
 }
 
 android::binder::Status Manager::getModelId(android::String16* id) {
-  *id = weaved::binder_utils::ToString16(model_id_);
+  *id = weaved::binder_utils::ToString16(GetStateSnapshot()->model_id);
   return android::binder::Status::ok();
 }
 
 android::binder::Status Manager::getPairingSessionId(android::String16* id) {
-  *id = weaved::binder_utils::ToString16(pairing_session_id_);
+  *id =
+      weaved::binder_utils::ToString16(GetStateSnapshot()->pairing_session_id);
   return android::binder::Status::ok();
 }
 
 android::binder::Status Manager::getPairingMode(android::String16* mode) {
-  *mode = weaved::binder_utils::ToString16(pairing_mode_);
+  *mode = weaved::binder_utils::ToString16(GetStateSnapshot()->pairing_mode);
   return android::binder::Status::ok();
 }
 
 android::binder::Status Manager::getPairingCode(android::String16* code) {
-  *code = weaved::binder_utils::ToString16(pairing_code_);
+  *code = weaved::binder_utils::ToString16(GetStateSnapshot()->pairing_code);
   return android::binder::Status::ok();
 }
 
 android::binder::Status Manager::getState(android::String16* state) {
-  *state = weaved::binder_utils::ToString16(state_);
+  *state = weaved::binder_utils::ToString16(GetStateSnapshot()->state);
+  return android::binder::Status::ok();
+}
+
+android::binder::Status Manager::getAllProperties(
+    android::weave::ParcelableDictionary* properties) {
+  std::shared_ptr<const ManagerStateSnapshot> snapshot = GetStateSnapshot();
+  base::DictionaryValue* values = properties->mutable_dict();
+  for (const auto& entry : kStateProperties) {
+    values->SetStringWithoutPathExpansion(
+        weaved::binder::GetNotificationValueKey(entry.notification_id),
+        (*snapshot).*entry.property);
+  }
+  return android::binder::Status::ok();
+}
+
+android::binder::Status Manager::getDeviceInfo(
+    android::weave::DeviceInfo* info) {
+  std::shared_ptr<const ManagerStateSnapshot> snapshot = GetStateSnapshot();
+  for (const auto& entry : kStateProperties)
+    info->*entry.device_info_field = (*snapshot).*entry.property;
   return android::binder::Status::ok();
 }
 
 android::binder::Status Manager::getTraits(android::String16* traits) {
-  *traits = weaved::binder_utils::ToString16(device_->GetTraits());
+  std::shared_ptr<const JsonSnapshot> snapshot =
+      GetJsonSnapshot(&traits_cache_, &weave::Device::GetTraits);
+  if (!snapshot)
+    return ReportNoDevice();
+  *traits = snapshot->GetJson16();
   return android::binder::Status::ok();
 }
 
 android::binder::Status Manager::getComponents(android::String16* components) {
-  *components = weaved::binder_utils::ToString16(device_->GetComponents());
+  std::shared_ptr<const JsonSnapshot> snapshot =
+      GetJsonSnapshot(&components_cache_, &weave::Device::GetComponents);
+  if (!snapshot)
+    return ReportNoDevice();
+  *components = snapshot->GetJson16();
+  return android::binder::Status::ok();
+}
+
+android::binder::Status Manager::getTraitsIfChanged(
+    int64_t version,
+    android::weave::VersionedJson* traits) {
+  return GetVersionedJson(&traits_cache_, &weave::Device::GetTraits, version,
+                          traits);
+}
+
+android::binder::Status Manager::getComponentsIfChanged(
+    int64_t version,
+    android::weave::VersionedJson* components) {
+  return GetVersionedJson(&components_cache_, &weave::Device::GetComponents,
+                          version, components);
+}
+
+const android::String16& Manager::JsonSnapshot::GetJson16() const {
+  std::call_once(json16_once_, [this]() {
+    json16_ = weaved::binder_utils::ToString16(json);
+  });
+  return json16_;
+}
+
+void Manager::InvalidateJsonCache(JsonCache* cache) {
+  cache->version++;
+  std::atomic_store(&cache->snapshot,
+                    std::shared_ptr<const JsonSnapshot>{});
+}
+
+std::shared_ptr<const Manager::JsonSnapshot> Manager::GetJsonSnapshot(
+    JsonCache* cache,
+    DictionaryGetter getter) {
+  std::shared_ptr<const JsonSnapshot> snapshot =
+      std::atomic_load(&cache->snapshot);
+  if (!snapshot &&
+      !BinderDispatcher::RunOnMainThread(
+          base::Bind(&Manager::BuildJsonSnapshot, base::Unretained(this),
+                     cache, getter, &snapshot))) {
+    return nullptr;
+  }
+  return snapshot;
+}
+
+void Manager::BuildJsonSnapshot(JsonCache* cache,
+                                DictionaryGetter getter,
+                                std::shared_ptr<const JsonSnapshot>* snapshot) {
+  *snapshot = std::atomic_load(&cache->snapshot);
+  if (*snapshot || !device_)
+    return;
+  std::shared_ptr<JsonSnapshot> new_snapshot = std::make_shared<JsonSnapshot>();
+  new_snapshot->version = cache->version;
+  new_snapshot->json = weaved::binder_utils::ToJson((device_.get()->*getter)());
+  *snapshot = new_snapshot;
+  std::atomic_store(&cache->snapshot, *snapshot);
+}
+
+android::binder::Status Manager::GetVersionedJson(
+    JsonCache* cache,
+    DictionaryGetter getter,
+    int64_t version,
+    android::weave::VersionedJson* result) {
+  std::shared_ptr<const JsonSnapshot> snapshot =
+      GetJsonSnapshot(cache, getter);
+  if (!snapshot)
+    return ReportNoDevice();
+  result->version = snapshot->version;
+  result->changed = (version != snapshot->version);
+  if (result->changed)
+    result->json = snapshot->json;
   return android::binder::Status::ok();
 }
 
@@ -459,14 +699,15 @@ void Manager::CreateServicesForClients() {
   std::swap(pending_clients_copy, pending_clients_);
   for (const auto& client : pending_clients_copy) {
     android::sp<BinderWeaveService> service =
-        new BinderWeaveService{device_.get(), client};
+        new BinderWeaveService{device_.get(), client,
+                               options_.command_delivery_options};
     services_.emplace(client, service);
     client->onServiceConnected(service);
     android::BinderWrapper::Get()->RegisterForDeathNotifications(
         android::IInterface::asBinder(client),
-        base::Bind(&Manager::OnClientDisconnected,
-                   weak_ptr_factory_.GetWeakPtr(),
-                   client));
+        BinderDispatcher::BindToMainThread(
+            base::Bind(&Manager::OnClientDisconnected,
+                       weak_ptr_factory_.GetWeakPtr(), client)));
   }
 }
 
@@ -484,8 +725,158 @@ void Manager::NotifyServiceManagerChange(
     const std::vector<int>& notification_ids) {
   if (notification_ids.empty())
     return;
-  for (const auto& listener : notification_listeners_)
-    listener->notifyServiceManagerChange(notification_ids);
+  if (options_.notification_delay.is_zero())
+    return SendNotifications(notification_ids);
+
+  pending_notification_ids_.insert(notification_ids.begin(),
+                                   notification_ids.end());
+  if (notification_task_ != brillo::MessageLoop::kTaskIdNull)
+    return;
+  notification_task_ = brillo::MessageLoop::current()->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&Manager::SendPendingNotifications,
+                 weak_ptr_factory_.GetWeakPtr()),
+      options_.notification_delay);
+}
+
+void Manager::SendPendingNotifications() {
+  notification_task_ = brillo::MessageLoop::kTaskIdNull;
+  std::vector<int> notification_ids{pending_notification_ids_.begin(),
+                                    pending_notification_ids_.end()};
+  pending_notification_ids_.clear();
+  SendNotifications(notification_ids);
+}
+
+void Manager::SendNotifications(const std::vector<int>& notification_ids) {
+  // The values are collected once, for all the notifications any of the
+  // listeners receiving values are interested in. The COMPONENTS value
+  // depends on the listener, so it is added for each listener below.
+  std::set<int> value_ids;
+  for (const auto& pair : notification_listeners_) {
+    if (!pair.second.with_values)
+      continue;
+    for (int id : notification_ids) {
+      if (IsInNotificationMask(id, pair.second.mask))
+        value_ids.insert(id);
+    }
+  }
+  value_ids.erase(NotificationListener::COMPONENTS);
+  base::DictionaryValue values;
+  GetNotificationValues({value_ids.begin(), value_ids.end()}, &values);
+  std::unique_ptr<base::DictionaryValue> components_patch;
+  std::unique_ptr<base::DictionaryValue> components_tree;
+  bool components_sent = false;
+
+  for (auto& pair : notification_listeners_) {
+    std::vector<int> ids;
+    std::copy_if(notification_ids.begin(), notification_ids.end(),
+                 std::back_inserter(ids), [&pair](int id) {
+                   return IsInNotificationMask(id, pair.second.mask);
+                 });
+    if (ids.empty())
+      continue;
+    if (!pair.second.with_values) {
+      pair.first->notifyServiceManagerChange(ids);
+      continue;
+    }
+    bool listener_components =
+        std::find(ids.begin(), ids.end(), NotificationListener::COMPONENTS) !=
+        ids.end();
+    if (!listener_components && ids.size() == value_ids.size()) {
+      pair.first->notifyServiceManagerValues(
+          ids, android::weave::ParcelableDictionary{&values});
+      continue;
+    }
+    base::DictionaryValue listener_values;
+    for (int id : ids) {
+      const char* key = weaved::binder::GetNotificationValueKey(id);
+      const base::Value* value = nullptr;
+      if (values.GetWithoutPathExpansion(key, &value))
+        listener_values.SetWithoutPathExpansion(key, value->DeepCopy());
+    }
+    if (listener_components) {
+      listener_values.SetWithoutPathExpansion(
+          weaved::binder::GetNotificationValueKey(
+              NotificationListener::COMPONENTS),
+          GetComponentsNotificationValue(pair.second.components_version,
+                                         &components_patch, &components_tree)
+              .DeepCopy());
+      pair.second.components_version = components_cache_.version;
+      components_sent = true;
+    }
+    pair.first->notifyServiceManagerValues(
+        ids, android::weave::ParcelableDictionary{&listener_values});
+  }
+
+  if (components_sent)
+    UpdateNotifiedComponents(components_patch.get());
+}
+
+void Manager::UpdateNotifiedComponents(
+    const base::DictionaryValue* patch_value) {
+  if (notified_components_ &&
+      notified_components_version_ == components_cache_.version) {
+    return;
+  }
+  // Bringing the baseline up to date with the patch just sent is cheaper than
+  // copying the whole tree, which is only done when no patch was sent.
+  const base::ListValue* patch = nullptr;
+  if (!patch_value ||
+      !patch_value->GetList(weaved::binder::kComponentsPatch, &patch) ||
+      !weaved::json_patch::ApplyPatch(*patch, notified_components_.get())) {
+    notified_components_.reset(device_->GetComponents().DeepCopy());
+  }
+  notified_components_version_ = components_cache_.version;
+}
+
+void Manager::GetNotificationValues(const std::vector<int>& notification_ids,
+                                    base::DictionaryValue* values) {
+  std::shared_ptr<const ManagerStateSnapshot> snapshot = GetStateSnapshot();
+  for (int id : notification_ids) {
+    const char* key = weaved::binder::GetNotificationValueKey(id);
+    CHECK(key) << "Unknown notification ID " << id;
+    StateProperty property = GetStateProperty(id);
+    if (property) {
+      values->SetStringWithoutPathExpansion(key, (*snapshot).*property);
+      continue;
+    }
+    switch (id) {
+      case NotificationListener::TRAITS:
+        values->SetWithoutPathExpansion(key, device_->GetTraits().DeepCopy());
+        break;
+      case NotificationListener::COMPONENTS:
+        NOTREACHED() << "The COMPONENTS value depends on the listener";
+        break;
+    }
+  }
+}
+
+const base::DictionaryValue& Manager::GetComponentsNotificationValue(
+    int64_t listener_version,
+    std::unique_ptr<base::DictionaryValue>* patch,
+    std::unique_ptr<base::DictionaryValue>* tree) {
+  // Listeners that missed the last COMPONENTS value, e.g. because they were
+  // registered after it was sent, get the whole tree.
+  bool send_patch = notified_components_ &&
+                    listener_version == notified_components_version_;
+  std::unique_ptr<base::DictionaryValue>* value = send_patch ? patch : tree;
+  if (*value)
+    return **value;
+
+  value->reset(new base::DictionaryValue);
+  const base::DictionaryValue& components = device_->GetComponents();
+  (*value)->SetDouble(weaved::binder::kComponentsVersion,
+                      components_cache_.version);
+  if (send_patch) {
+    (*value)->SetDouble(weaved::binder::kComponentsBaseVersion,
+                        notified_components_version_);
+    (*value)->Set(weaved::binder::kComponentsPatch,
+                  weaved::json_patch::CreatePatch(*notified_components_,
+                                                  components).release());
+  } else {
+    (*value)->Set(weaved::binder::kComponentsTree, components.DeepCopy());
+  }
+  return **value;
 }
 
 }  // namespace buffet
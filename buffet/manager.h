@@ -15,7 +15,9 @@
 #ifndef BUFFET_MANAGER_H_
 #define BUFFET_MANAGER_H_
 
+#include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <vector>
@@ -23,24 +25,48 @@
 #include <base/files/file_path.h>
 #include <base/macros.h>
 #include <base/memory/weak_ptr.h>
+#include <base/time/time.h>
 #include <base/values.h>
 #include <brillo/dbus/async_event_sequencer.h>
 #include <brillo/errors/error.h>
+#include <brillo/message_loops/message_loop.h>
 #include <nativepower/power_manager_client.h>
 #include <weave/device.h>
 
 #include "android/weave/BnWeaveServiceManager.h"
 #include "buffet/binder_weave_service.h"
 #include "buffet/buffet_config.h"
+#include "buffet/http_transport_client.h"
+#include "common/device_info.h"
+#include "common/parcelable_dictionary.h"
+#include "common/versioned_json.h"
 
 namespace buffet {
 
 class BluetoothClient;
-class HttpTransportClient;
+class DefinitionLoader;
 class MdnsClient;
 class ShillClient;
 class WebServClient;
 
+// The state properties of the device returned by the IWeaveServiceManager
+// getters. A snapshot is never modified once published: each change publishes
+// a new one, so readers on any thread see a consistent set of values.
+struct ManagerStateSnapshot {
+  std::string cloud_id;
+  std::string device_id;
+  std::string device_name;
+  std::string device_description;
+  std::string device_location;
+  std::string oem_name;
+  std::string model_name;
+  std::string model_id;
+  std::string pairing_session_id;
+  std::string pairing_mode;
+  std::string pairing_code;
+  std::string state;
+};
+
 // The Manager is responsible for global state of Buffet.  It exposes
 // interfaces which affect the entire device such as device registration and
 // device state.
@@ -51,8 +77,14 @@ class Manager final : public android::weave::BnWeaveServiceManager {
     bool disable_privet = false;
     bool enable_ping = false;
     std::set<std::string> device_whitelist;
+    // Notifications to IWeaveServiceManagerNotificationListener are collected
+    // over this interval and sent in one batch, without duplicates. Zero
+    // sends each notification right away.
+    base::TimeDelta notification_delay = base::TimeDelta::FromMilliseconds(50);
 
     BuffetConfig::Options config_options;
+    HttpTransportClient::Options http_options;
+    BinderWeaveService::DeliveryOptions command_delivery_options;
   };
 
   Manager(const Options& options, const scoped_refptr<dbus::Bus>& bus);
@@ -61,9 +93,33 @@ class Manager final : public android::weave::BnWeaveServiceManager {
   void Start(brillo::dbus_utils::AsyncEventSequencer* sequencer);
   void Stop();
 
+  // Starts serving |device| instead of creating the weave device and its
+  // platform providers, for tests and benchmarks.
+  void StartForTesting(std::unique_ptr<weave::Device> device);
+
+  // Recreates the weave device while keeping the platform providers, the
+  // parsed definitions and the connected client services. Components
+  // registered by clients are re-added with their last known state.
+  void RestartDevice();
+
  private:
+  // Tears the manager down on the main thread before it is destroyed.
+  void Shutdown();
+  // Creates the platform providers and the weave device, or only recreates
+  // the device with RestartDevice() if it already exists.
   void RestartWeave(brillo::dbus_utils::AsyncEventSequencer* sequencer);
   void CreateDevice();
+  // Takes |device| over as the weave device: subscribes to its changes and
+  // creates the services of the pending clients.
+  void AttachDevice(std::unique_ptr<weave::Device> device);
+  void DestroyDevice();
+
+  // Serves the getters on the calling binder thread and the rest of the calls
+  // on the main thread (see BinderDispatcher).
+  android::status_t onTransact(uint32_t code,
+                               const android::Parcel& data,
+                               android::Parcel* reply,
+                               uint32_t flags) override;
 
   // Binder methods for IWeaveServiceManager:
   using WeaveServiceManagerNotificationListener =
@@ -72,6 +128,11 @@ class Manager final : public android::weave::BnWeaveServiceManager {
       const android::sp<android::weave::IWeaveClient>& client) override;
   android::binder::Status registerNotificationListener(
       const WeaveServiceManagerNotificationListener& listener) override;
+  android::binder::Status registerNotificationListenerWithValues(
+      const WeaveServiceManagerNotificationListener& listener) override;
+  android::binder::Status setNotificationMask(
+      const WeaveServiceManagerNotificationListener& listener,
+      int32_t mask) override;
   android::binder::Status getDeviceId(android::String16* id) override;
   android::binder::Status getCloudId(android::String16* id) override;
   android::binder::Status getDeviceName(android::String16* name) override;
@@ -86,8 +147,69 @@ class Manager final : public android::weave::BnWeaveServiceManager {
   android::binder::Status getPairingMode(android::String16* mode) override;
   android::binder::Status getPairingCode(android::String16* code) override;
   android::binder::Status getState(android::String16* state) override;
+  android::binder::Status getAllProperties(
+      android::weave::ParcelableDictionary* properties) override;
+  android::binder::Status getDeviceInfo(
+      android::weave::DeviceInfo* info) override;
   android::binder::Status getTraits(android::String16* traits) override;
   android::binder::Status getComponents(android::String16* components) override;
+  android::binder::Status getTraitsIfChanged(
+      int64_t version,
+      android::weave::VersionedJson* traits) override;
+  android::binder::Status getComponentsIfChanged(
+      int64_t version,
+      android::weave::VersionedJson* components) override;
+
+  // Serialized copy of the trait definitions or the component tree. It is
+  // immutable once published, so it can be read from any binder thread.
+  struct JsonSnapshot {
+    int64_t version;
+    std::string json;
+    // UTF-16 copy for the getTraits()/getComponents() callers only, built on
+    // first use.
+    const android::String16& GetJson16() const;
+
+   private:
+    mutable std::once_flag json16_once_;
+    mutable android::String16 json16_;
+  };
+
+  // The latest JsonSnapshot of the trait definitions or the component tree,
+  // built on first use and dropped whenever libweave reports a change.
+  struct JsonCache {
+    // Starts at a random per-process epoch (see Manager::Manager()) and is
+    // incremented on each change, so a version obtained from an earlier
+    // weaved process never matches. Only used on the main thread.
+    int64_t version{1};
+    // Accessed with std::atomic_load()/std::atomic_store().
+    std::shared_ptr<const JsonSnapshot> snapshot;
+  };
+  using DictionaryGetter =
+      const base::DictionaryValue& (weave::Device::*)() const;
+
+  static void InvalidateJsonCache(JsonCache* cache);
+  // Returns the snapshot in |cache|, building it on the main thread from the
+  // dictionary returned by |getter| if there is none. Returns nullptr if
+  // there is no device or the manager is shutting down. May be called on any
+  // thread.
+  std::shared_ptr<const JsonSnapshot> GetJsonSnapshot(JsonCache* cache,
+                                                      DictionaryGetter getter);
+  void BuildJsonSnapshot(JsonCache* cache,
+                         DictionaryGetter getter,
+                         std::shared_ptr<const JsonSnapshot>* snapshot);
+  android::binder::Status GetVersionedJson(
+      JsonCache* cache,
+      DictionaryGetter getter,
+      int64_t version,
+      android::weave::VersionedJson* result);
+
+  // May be called on any thread.
+  std::shared_ptr<const ManagerStateSnapshot> GetStateSnapshot() const;
+  // Publishes |snapshot| and notifies the listeners of the changed properties
+  // in |notification_ids|, if any.
+  void PublishStateSnapshot(
+      const std::shared_ptr<const ManagerStateSnapshot>& snapshot,
+      const std::vector<int>& notification_ids);
 
   void OnTraitDefsChanged();
   void OnComponentTreeChanged();
@@ -103,7 +225,31 @@ class Manager final : public android::weave::BnWeaveServiceManager {
       const android::sp<android::weave::IWeaveClient>& client);
   void OnNotificationListenerDestroyed(
       const WeaveServiceManagerNotificationListener& notification_listener);
+  void AddNotificationListener(
+      const WeaveServiceManagerNotificationListener& listener,
+      bool with_values);
+  // Queues |notification_ids| to be sent to the listeners once
+  // Options::notification_delay has passed.
   void NotifyServiceManagerChange(const std::vector<int>& notification_ids);
+  void SendPendingNotifications();
+  void SendNotifications(const std::vector<int>& notification_ids);
+  // Fills |values| with the current values of the properties in
+  // |notification_ids| for notifyServiceManagerValues().
+  void GetNotificationValues(const std::vector<int>& notification_ids,
+                             base::DictionaryValue* values);
+  // Returns the COMPONENTS notification value for a listener that last
+  // received the component tree at |listener_version|: the changes since the
+  // last such notification if that is the version the listener has, or the
+  // whole tree otherwise. The two kinds of values are built on first use and
+  // kept in |patch| and |tree|, for the other listeners.
+  const base::DictionaryValue& GetComponentsNotificationValue(
+      int64_t listener_version,
+      std::unique_ptr<base::DictionaryValue>* patch,
+      std::unique_ptr<base::DictionaryValue>* tree);
+  // Makes the current component tree the baseline of the next COMPONENTS
+  // patches, after a COMPONENTS value has been sent. |patch_value| is the
+  // patch value sent against the previous baseline, if any.
+  void UpdateNotifiedComponents(const base::DictionaryValue* patch_value);
   void OnRebootDevice(const std::weak_ptr<weave::Command>& cmd);
   void RebootDeviceNow();
 
@@ -114,6 +260,7 @@ class Manager final : public android::weave::BnWeaveServiceManager {
   std::unique_ptr<TaskRunner> task_runner_;
   std::unique_ptr<BluetoothClient> bluetooth_client_;
   std::unique_ptr<BuffetConfig> config_;
+  std::unique_ptr<DefinitionLoader> definition_loader_;
   std::unique_ptr<HttpTransportClient> http_client_;
   std::unique_ptr<ShillClient> shill_client_;
   std::unique_ptr<MdnsClient> mdns_client_;
@@ -123,22 +270,36 @@ class Manager final : public android::weave::BnWeaveServiceManager {
   std::vector<android::sp<android::weave::IWeaveClient>> pending_clients_;
   std::map<android::sp<android::weave::IWeaveClient>,
            android::sp<BinderWeaveService>> services_;
-  std::set<WeaveServiceManagerNotificationListener> notification_listeners_;
+  struct NotificationListenerInfo {
+    // Whether the listener receives notifyServiceManagerValues().
+    bool with_values{false};
+    // The notifications the listener is interested in, see
+    // IWeaveServiceManager.setNotificationMask().
+    int32_t mask{android::weave::IWeaveServiceManagerNotificationListener::
+                     ALL_NOTIFICATIONS_MASK};
+    // The version of the component tree in the last COMPONENTS value sent to
+    // the listener, or 0 if none.
+    int64_t components_version{0};
+  };
+  std::map<WeaveServiceManagerNotificationListener, NotificationListenerInfo>
+      notification_listeners_;
+  // The component tree as of the last COMPONENTS notification sent with
+  // values, and its version. Deltas sent to the listeners that received that
+  // notification are computed against it.
+  std::unique_ptr<base::DictionaryValue> notified_components_;
+  int64_t notified_components_version_{0};
+  // Notifications waiting for SendPendingNotifications().
+  std::set<int> pending_notification_ids_;
+  brillo::MessageLoop::TaskId notification_task_{
+      brillo::MessageLoop::kTaskIdNull};
   android::PowerManagerClient power_manager_client_;
 
-  // State properties.
-  std::string cloud_id_;
-  std::string device_id_;
-  std::string device_name_;
-  std::string device_description_;
-  std::string device_location_;
-  std::string oem_name_;
-  std::string model_name_;
-  std::string model_id_;
-  std::string pairing_session_id_;
-  std::string pairing_mode_;
-  std::string pairing_code_;
-  std::string state_;
+  // Only replaced on the main thread, with std::atomic_store().
+  std::shared_ptr<const ManagerStateSnapshot> state_snapshot_{
+      std::make_shared<ManagerStateSnapshot>()};
+
+  JsonCache traits_cache_;
+  JsonCache components_cache_;
 
   base::WeakPtrFactory<Manager> weak_ptr_factory_{this};
   DISALLOW_COPY_AND_ASSIGN(Manager);
@@ -0,0 +1,310 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/manager.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <binderwrapper/binder_wrapper.h>
+#include <binderwrapper/stub_binder_wrapper.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <weave/test/mock_device.h>
+#include <weave/test/unittest_utils.h>
+
+#include "common/binder_constants.h"
+#include "android/weave/BnWeaveServiceManagerNotificationListener.h"
+#include "common/binder_utils.h"
+#include "common/device_info.h"
+#include "common/json_patch.h"
+#include "common/parcelable_dictionary.h"
+
+using NotificationListener =
+    android::weave::IWeaveServiceManagerNotificationListener;
+using weaved::binder::GetNotificationValueKey;
+
+namespace buffet {
+
+using ::testing::_;
+using ::testing::Invoke;
+using ::testing::NiceMock;
+using ::testing::ReturnRef;
+
+namespace {
+
+// Records the notifications sent with values.
+class FakeNotificationListener
+    : public android::weave::BnWeaveServiceManagerNotificationListener {
+ public:
+  android::binder::Status notifyServiceManagerChange(
+      const std::vector<int32_t>& notification_ids) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status notifyServiceManagerValues(
+      const std::vector<int32_t>& notification_ids,
+      const android::weave::ParcelableDictionary& values) override {
+    this->values.emplace_back(values.dict().DeepCopy());
+    return android::binder::Status::ok();
+  }
+
+  std::vector<std::unique_ptr<base::DictionaryValue>> values;
+};
+
+}  // anonymous namespace
+
+class ManagerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    android::BinderWrapper::InitForTesting(new android::StubBinderWrapper);
+
+    settings_.cloud_id = "cloud_id";
+    settings_.device_id = "device_id";
+    settings_.name = "Test device";
+    settings_.description = "A device";
+    settings_.location = "Kitchen";
+    settings_.oem_name = "Brillo";
+    settings_.model_name = "Test model";
+    settings_.model_id = "AAAAA";
+
+    // Like libweave, the mock reports the current values on subscription.
+    device_ = new NiceMock<weave::test::MockDevice>;
+    ON_CALL(*device_, GetTraits()).WillByDefault(ReturnRef(traits_));
+    ON_CALL(*device_, GetComponents()).WillByDefault(ReturnRef(components_));
+    ON_CALL(*device_, AddComponentTreeChangedCallback(_))
+        .WillByDefault(Invoke([this](const base::Closure& callback) {
+          component_tree_callback_ = callback;
+        }));
+    ON_CALL(*device_, AddSettingsChangedCallback(_))
+        .WillByDefault(
+            Invoke([this](
+                       const weave::Device::SettingsChangedCallback& callback) {
+              settings_callback_ = callback;
+              callback.Run(settings_);
+            }));
+    ON_CALL(*device_, AddGcdStateChangedCallback(_))
+        .WillByDefault(
+            Invoke([](const weave::Device::GcdStateChangedCallback& callback) {
+              callback.Run(weave::GcdState::kConnected);
+            }));
+    ON_CALL(*device_, AddPairingChangedCallbacks(_, _))
+        .WillByDefault(
+            Invoke([](const weave::Device::PairingBeginCallback& begin,
+                      const weave::Device::PairingEndCallback& end) {
+              begin.Run("session_1", weave::PairingType::kPinCode,
+                        {'1', '2', '3', '4'});
+            }));
+
+    manager_ = CreateManager();
+    manager_->StartForTesting(std::unique_ptr<weave::Device>{device_});
+  }
+
+  static android::sp<Manager> CreateManager() {
+    Manager::Options options;
+    options.notification_delay = base::TimeDelta{};
+    return new Manager{options, nullptr};
+  }
+
+  void TearDown() override {
+    manager_.clear();
+    android::BinderWrapper::Destroy();
+  }
+
+  // The binder methods are private in Manager.
+  android::sp<android::weave::IWeaveServiceManager> service_manager() const {
+    return manager_;
+  }
+
+  static std::string GetProperty(
+      const android::weave::ParcelableDictionary& properties,
+      int notification_id) {
+    std::string value;
+    EXPECT_TRUE(properties.dict().GetStringWithoutPathExpansion(
+        GetNotificationValueKey(notification_id), &value))
+        << notification_id;
+    return value;
+  }
+
+  // Returns the COMPONENTS value of the notification |index| received by
+  // |listener|.
+  static const base::DictionaryValue* GetComponentsValue(
+      const FakeNotificationListener& listener,
+      size_t index) {
+    const base::DictionaryValue* value = nullptr;
+    if (index < listener.values.size()) {
+      listener.values[index]->GetDictionaryWithoutPathExpansion(
+          GetNotificationValueKey(NotificationListener::COMPONENTS), &value);
+    }
+    return value;
+  }
+
+  base::DictionaryValue traits_;
+  base::DictionaryValue components_;
+  base::Closure component_tree_callback_;
+  weave::Settings settings_;
+  weave::Device::SettingsChangedCallback settings_callback_;
+  // Owned by |manager_|.
+  NiceMock<weave::test::MockDevice>* device_{nullptr};
+  android::sp<Manager> manager_;
+};
+
+TEST_F(ManagerTest, GetAllProperties) {
+  android::weave::ParcelableDictionary properties;
+  EXPECT_TRUE(service_manager()->getAllProperties(&properties).isOk());
+  EXPECT_EQ(12u, properties.dict().size());
+  EXPECT_EQ("cloud_id",
+            GetProperty(properties, NotificationListener::CLOUD_ID));
+  EXPECT_EQ("device_id",
+            GetProperty(properties, NotificationListener::DEVICE_ID));
+  EXPECT_EQ("Test device",
+            GetProperty(properties, NotificationListener::DEVICE_NAME));
+  EXPECT_EQ("A device",
+            GetProperty(properties, NotificationListener::DEVICE_DESCRIPTION));
+  EXPECT_EQ("Kitchen",
+            GetProperty(properties, NotificationListener::DEVICE_LOCATION));
+  EXPECT_EQ("Brillo", GetProperty(properties, NotificationListener::OEM_NAME));
+  EXPECT_EQ("Test model",
+            GetProperty(properties, NotificationListener::MODEL_NAME));
+  EXPECT_EQ("AAAAA", GetProperty(properties, NotificationListener::MODEL_ID));
+  EXPECT_EQ("session_1",
+            GetProperty(properties, NotificationListener::PAIRING_SESSION_ID));
+  EXPECT_EQ("pinCode",
+            GetProperty(properties, NotificationListener::PAIRING_MODE));
+  EXPECT_EQ("1234",
+            GetProperty(properties, NotificationListener::PAIRING_CODE));
+  EXPECT_EQ("connected", GetProperty(properties, NotificationListener::STATE));
+}
+
+TEST_F(ManagerTest, GetAllPropertiesAfterChange) {
+  settings_.name = "Renamed device";
+  settings_callback_.Run(settings_);
+  android::weave::ParcelableDictionary properties;
+  EXPECT_TRUE(service_manager()->getAllProperties(&properties).isOk());
+  EXPECT_EQ("Renamed device",
+            GetProperty(properties, NotificationListener::DEVICE_NAME));
+  EXPECT_EQ("cloud_id",
+            GetProperty(properties, NotificationListener::CLOUD_ID));
+}
+
+TEST_F(ManagerTest, GetTraitsIfChanged) {
+  traits_.MergeDictionary(
+      weave::test::CreateDictionaryValue("{'robot': {}}").get());
+  android::weave::VersionedJson traits;
+  EXPECT_TRUE(service_manager()->getTraitsIfChanged(0, &traits).isOk());
+  EXPECT_TRUE(traits.changed);
+  EXPECT_EQ(R"({"robot":{}})", traits.json);
+
+  android::weave::VersionedJson unchanged;
+  EXPECT_TRUE(
+      service_manager()->getTraitsIfChanged(traits.version, &unchanged).isOk());
+  EXPECT_FALSE(unchanged.changed);
+  EXPECT_EQ(traits.version, unchanged.version);
+}
+
+TEST_F(ManagerTest, GetTraitsWithoutDevice) {
+  android::sp<android::weave::IWeaveServiceManager> manager = CreateManager();
+  android::String16 traits;
+  EXPECT_FALSE(manager->getTraits(&traits).isOk());
+  android::weave::VersionedJson components;
+  EXPECT_FALSE(manager->getComponentsIfChanged(0, &components).isOk());
+}
+
+TEST_F(ManagerTest, ComponentsNotificationPatches) {
+  android::sp<FakeNotificationListener> listener = new FakeNotificationListener;
+  EXPECT_TRUE(
+      service_manager()->registerNotificationListenerWithValues(listener)
+          .isOk());
+
+  components_.SetInteger("myComponent.state.robot.battery", 80);
+  component_tree_callback_.Run();
+  const base::DictionaryValue* first = GetComponentsValue(*listener, 0);
+  ASSERT_NE(nullptr, first);
+  const base::DictionaryValue* tree = nullptr;
+  ASSERT_TRUE(first->GetDictionary(weaved::binder::kComponentsTree, &tree));
+  EXPECT_TRUE(tree->Equals(&components_));
+  double first_version = 0;
+  EXPECT_TRUE(
+      first->GetDouble(weaved::binder::kComponentsVersion, &first_version));
+
+  // The listener has the last tree sent, so it only receives the changes.
+  components_.SetInteger("myComponent.state.robot.battery", 70);
+  component_tree_callback_.Run();
+  const base::DictionaryValue* second = GetComponentsValue(*listener, 1);
+  ASSERT_NE(nullptr, second);
+  EXPECT_FALSE(second->HasKey(weaved::binder::kComponentsTree));
+  double base_version = 0;
+  EXPECT_TRUE(
+      second->GetDouble(weaved::binder::kComponentsBaseVersion, &base_version));
+  EXPECT_EQ(first_version, base_version);
+  const base::ListValue* patch = nullptr;
+  ASSERT_TRUE(second->GetList(weaved::binder::kComponentsPatch, &patch));
+  std::unique_ptr<base::DictionaryValue> patched{tree->DeepCopy()};
+  EXPECT_TRUE(weaved::json_patch::ApplyPatch(*patch, patched.get()));
+  EXPECT_TRUE(patched->Equals(&components_));
+
+  // The baseline follows the patches sent.
+  components_.SetInteger("myComponent.state.robot.battery", 60);
+  component_tree_callback_.Run();
+  const base::DictionaryValue* third = GetComponentsValue(*listener, 2);
+  ASSERT_NE(nullptr, third);
+  ASSERT_TRUE(third->GetList(weaved::binder::kComponentsPatch, &patch));
+  EXPECT_TRUE(weaved::json_patch::ApplyPatch(*patch, patched.get()));
+  EXPECT_TRUE(patched->Equals(&components_));
+}
+
+TEST_F(ManagerTest, ComponentsNotificationMasked) {
+  android::sp<FakeNotificationListener> listener = new FakeNotificationListener;
+  EXPECT_TRUE(
+      service_manager()->registerNotificationListenerWithValues(listener)
+          .isOk());
+  EXPECT_TRUE(service_manager()
+                  ->setNotificationMask(listener,
+                                        NotificationListener::STATE_MASK)
+                  .isOk());
+  components_.SetInteger("myComponent.state.robot.battery", 80);
+  component_tree_callback_.Run();
+  EXPECT_TRUE(listener->values.empty());
+}
+
+TEST_F(ManagerTest, GetDeviceInfo) {
+  android::weave::DeviceInfo info;
+  EXPECT_TRUE(service_manager()->getDeviceInfo(&info).isOk());
+  EXPECT_EQ("cloud_id", info.cloud_id);
+  EXPECT_EQ("device_id", info.device_id);
+  EXPECT_EQ("Test device", info.name);
+  EXPECT_EQ("A device", info.description);
+  EXPECT_EQ("Kitchen", info.location);
+  EXPECT_EQ("Brillo", info.oem_name);
+  EXPECT_EQ("Test model", info.model_name);
+  EXPECT_EQ("AAAAA", info.model_id);
+  EXPECT_EQ("connected", info.state);
+  EXPECT_EQ("session_1", info.pairing_session_id);
+  EXPECT_EQ("pinCode", info.pairing_mode);
+  EXPECT_EQ("1234", info.pairing_code);
+}
+
+TEST_F(ManagerTest, GetDeviceInfoMatchesGetters) {
+  android::weave::DeviceInfo info;
+  EXPECT_TRUE(service_manager()->getDeviceInfo(&info).isOk());
+  android::String16 value;
+  EXPECT_TRUE(service_manager()->getDeviceName(&value).isOk());
+  EXPECT_EQ(info.name, weaved::binder_utils::ToString(value));
+  EXPECT_TRUE(service_manager()->getState(&value).isOk());
+  EXPECT_EQ(info.state, weaved::binder_utils::ToString(value));
+  EXPECT_TRUE(service_manager()->getPairingCode(&value).isOk());
+  EXPECT_EQ(info.pairing_code, weaved::binder_utils::ToString(value));
+}
+
+}  // namespace buffet
@@ -0,0 +1,83 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BUFFET_MPSC_QUEUE_H_
+#define BUFFET_MPSC_QUEUE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <base/macros.h>
+
+namespace buffet {
+
+// A lock-free multiple-producer, single-consumer queue. Push() may be called
+// from any thread. Producers prepend to a singly-linked list with a
+// compare-and-swap and the consumer takes the whole list at once with
+// PopAll(), so neither side ever waits for the other. Since the list is taken
+// in one atomic exchange, PopAll() is safe on any thread too, but the items
+// only come out in order for a single consumer.
+template <typename T>
+class MpscQueue final {
+ public:
+  MpscQueue() = default;
+  ~MpscQueue() { PopAll(); }
+
+  // Adds |item| to the queue. Returns true if the queue was empty, which the
+  // caller can use to wake up the consumer only when necessary.
+  bool Push(std::unique_ptr<T> item) {
+    Node* node = new Node{std::move(item), nullptr};
+    // |node| may be popped and deleted by the consumer as soon as it is
+    // published, so only |head| is used afterwards.
+    Node* head = head_.load(std::memory_order_relaxed);
+    do {
+      node->next = head;
+    } while (!head_.compare_exchange_weak(head, node,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed));
+    return head == nullptr;
+  }
+
+  // Removes all the items from the queue and returns them in the order they
+  // were pushed.
+  std::vector<std::unique_ptr<T>> PopAll() {
+    std::vector<std::unique_ptr<T>> items;
+    Node* node = head_.exchange(nullptr, std::memory_order_acquire);
+    while (node) {
+      items.push_back(std::move(node->item));
+      Node* next = node->next;
+      delete node;
+      node = next;
+    }
+    std::reverse(items.begin(), items.end());
+    return items;
+  }
+
+ private:
+  struct Node {
+    std::unique_ptr<T> item;
+    Node* next;
+  };
+
+  std::atomic<Node*> head_{nullptr};
+
+  DISALLOW_COPY_AND_ASSIGN(MpscQueue);
+};
+
+}  // namespace buffet
+
+#endif  // BUFFET_MPSC_QUEUE_H_
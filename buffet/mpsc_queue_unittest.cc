@@ -0,0 +1,101 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/mpsc_queue.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace buffet {
+
+TEST(MpscQueueTest, PopAllInOrder) {
+  MpscQueue<int> queue;
+  EXPECT_TRUE(queue.PopAll().empty());
+  EXPECT_TRUE(queue.Push(std::unique_ptr<int>{new int{1}}));
+  EXPECT_FALSE(queue.Push(std::unique_ptr<int>{new int{2}}));
+  EXPECT_FALSE(queue.Push(std::unique_ptr<int>{new int{3}}));
+
+  auto items = queue.PopAll();
+  ASSERT_EQ(3u, items.size());
+  EXPECT_EQ(1, *items[0]);
+  EXPECT_EQ(2, *items[1]);
+  EXPECT_EQ(3, *items[2]);
+
+  EXPECT_TRUE(queue.PopAll().empty());
+  EXPECT_TRUE(queue.Push(std::unique_ptr<int>{new int{4}}));
+}
+
+TEST(MpscQueueTest, ConcurrentProducers) {
+  const int kThreads = 4;
+  const int kItemsPerThread = 1000;
+  MpscQueue<int> queue;
+  std::vector<std::thread> producers;
+  for (int i = 0; i < kThreads; i++) {
+    producers.emplace_back([&queue, i]() {
+      for (int j = 0; j < kItemsPerThread; j++)
+        queue.Push(std::unique_ptr<int>{new int{i * kItemsPerThread + j}});
+    });
+  }
+
+  std::vector<int> last(kThreads, -1);
+  int count = 0;
+  while (count < kThreads * kItemsPerThread) {
+    for (const auto& item : queue.PopAll()) {
+      // Items of each producer come out in the order they were pushed.
+      int producer = *item / kItemsPerThread;
+      EXPECT_LT(last[producer], *item);
+      last[producer] = *item;
+      count++;
+    }
+  }
+  for (auto& producer : producers)
+    producer.join();
+  EXPECT_TRUE(queue.PopAll().empty());
+}
+
+TEST(MpscQueueTest, PushReportsEmptyWhilePopping) {
+  const int kThreads = 4;
+  const int kItemsPerThread = 10000;
+  MpscQueue<int> queue;
+  std::atomic<int> empty_pushes{0};
+  std::vector<std::thread> producers;
+  for (int i = 0; i < kThreads; i++) {
+    producers.emplace_back([&queue, &empty_pushes]() {
+      for (int j = 0; j < kItemsPerThread; j++) {
+        if (queue.Push(std::unique_ptr<int>{new int{j}}))
+          empty_pushes++;
+      }
+    });
+  }
+
+  // Each non-empty batch starts with exactly one push onto an empty queue,
+  // which is the one that wakes up the consumer.
+  int batches = 0;
+  int count = 0;
+  while (count < kThreads * kItemsPerThread) {
+    auto items = queue.PopAll();
+    if (!items.empty())
+      batches++;
+    count += items.size();
+  }
+  for (auto& producer : producers)
+    producer.join();
+  EXPECT_EQ(batches, empty_pushes.load());
+}
+
+}  // namespace buffet
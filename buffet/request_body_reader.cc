@@ -0,0 +1,113 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/request_body_reader.h"
+
+#include <memory>
+#include <utility>
+
+#include <base/bind.h>
+#include <base/logging.h>
+#include <brillo/errors/error.h>
+#include <brillo/http/http_request.h>
+
+namespace buffet {
+
+namespace {
+
+// The size of the buffer each asynchronous read of the body fills.
+const size_t kReadBufferSize = 16 * 1024;
+
+}  // anonymous namespace
+
+void RequestBodyReader::Read(brillo::StreamPtr stream,
+                             size_t max_size,
+                             base::TimeDelta inactivity_timeout,
+                             const DoneCallback& callback) {
+  (new RequestBodyReader{std::move(stream), max_size, inactivity_timeout,
+                         callback})->Start();
+}
+
+RequestBodyReader::RequestBodyReader(brillo::StreamPtr stream,
+                                     size_t max_size,
+                                     base::TimeDelta inactivity_timeout,
+                                     const DoneCallback& callback)
+    : stream_{std::move(stream)},
+      max_size_{max_size},
+      inactivity_timeout_{inactivity_timeout},
+      callback_{callback},
+      buffer_(kReadBufferSize) {}
+
+RequestBodyReader::~RequestBodyReader() {
+  brillo::MessageLoop::current()->CancelTask(timeout_task_);
+  if (stream_)
+    stream_->CancelPendingAsyncOperations();
+}
+
+void RequestBodyReader::Start() {
+  if (!stream_)
+    return Finish(brillo::http::status_code::Ok);
+  if (stream_->CanGetSize()) {
+    uint64_t size = stream_->GetRemainingSize();
+    if (size > max_size_)
+      return Finish(brillo::http::status_code::RequestEntityTooLarge);
+    body_.reserve(size);
+  }
+  ReadNext();
+}
+
+void RequestBodyReader::ReadNext() {
+  // Every chunk restarts the timer, so only an idle client times out.
+  brillo::MessageLoop::current()->CancelTask(timeout_task_);
+  timeout_task_ = brillo::MessageLoop::current()->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&RequestBodyReader::OnTimeout, base::Unretained(this)),
+      inactivity_timeout_);
+  brillo::ErrorPtr error;
+  if (!stream_->ReadAsync(
+          buffer_.data(), buffer_.size(),
+          base::Bind(&RequestBodyReader::OnRead, base::Unretained(this)),
+          base::Bind(&RequestBodyReader::OnError, base::Unretained(this)),
+          &error)) {
+    OnError(error.get());
+  }
+}
+
+void RequestBodyReader::OnRead(size_t size) {
+  if (size == 0)
+    return Finish(brillo::http::status_code::Ok);
+  if (body_.size() + size > max_size_)
+    return Finish(brillo::http::status_code::RequestEntityTooLarge);
+  body_.append(buffer_.data(), size);
+  ReadNext();
+}
+
+void RequestBodyReader::OnError(const brillo::Error* error) {
+  LOG(ERROR) << "Failed to read request body: "
+             << (error ? error->GetMessage() : "unknown error");
+  Finish(brillo::http::status_code::BadRequest);
+}
+
+void RequestBodyReader::OnTimeout() {
+  timeout_task_ = brillo::MessageLoop::kTaskIdNull;
+  LOG(WARNING) << "Timed out reading request body";
+  Finish(brillo::http::status_code::RequestTimeout);
+}
+
+void RequestBodyReader::Finish(int status_code) {
+  std::unique_ptr<RequestBodyReader> self{this};
+  callback_.Run(status_code, &body_);
+}
+
+}  // namespace buffet
@@ -0,0 +1,79 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BUFFET_REQUEST_BODY_READER_H_
+#define BUFFET_REQUEST_BODY_READER_H_
+
+#include <string>
+#include <vector>
+
+#include <base/callback.h>
+#include <base/macros.h>
+#include <base/time/time.h>
+#include <brillo/message_loops/message_loop.h>
+#include <brillo/streams/stream.h>
+
+namespace brillo {
+class Error;
+}
+
+namespace buffet {
+
+// Reads the body of an HTTP request asynchronously, so that a slow client
+// doesn't block the main loop. Bodies over |max_size| bytes, failing to read
+// or stalling for longer than |inactivity_timeout| are reported with the
+// status code to answer the request with. The reader owns itself and is
+// deleted once done.
+class RequestBodyReader {
+ public:
+  // Called with brillo::http::status_code::Ok and the whole body, or with an
+  // error status code. The callback may take the |body| over.
+  using DoneCallback = base::Callback<void(int status_code, std::string* body)>;
+
+  // |stream| is null for a request without a body.
+  static void Read(brillo::StreamPtr stream,
+                   size_t max_size,
+                   base::TimeDelta inactivity_timeout,
+                   const DoneCallback& callback);
+
+ private:
+  RequestBodyReader(brillo::StreamPtr stream,
+                    size_t max_size,
+                    base::TimeDelta inactivity_timeout,
+                    const DoneCallback& callback);
+  ~RequestBodyReader();
+
+  void Start();
+  void ReadNext();
+  void OnRead(size_t size);
+  void OnError(const brillo::Error* error);
+  void OnTimeout();
+  // Reports |status_code| and the body read so far to the callback and
+  // deletes the reader, which cancels the pending read and the timeout.
+  void Finish(int status_code);
+
+  brillo::StreamPtr stream_;
+  size_t max_size_;
+  base::TimeDelta inactivity_timeout_;
+  DoneCallback callback_;
+  std::string body_;
+  std::vector<char> buffer_;
+  brillo::MessageLoop::TaskId timeout_task_{brillo::MessageLoop::kTaskIdNull};
+
+  DISALLOW_COPY_AND_ASSIGN(RequestBodyReader);
+};
+
+}  // namespace buffet
+
+#endif  // BUFFET_REQUEST_BODY_READER_H_
@@ -0,0 +1,128 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/request_body_reader.h"
+
+#include <memory>
+#include <string>
+
+#include <base/bind.h>
+#include <base/test/simple_test_clock.h>
+#include <brillo/http/http_request.h>
+#include <brillo/message_loops/fake_message_loop.h>
+#include <brillo/streams/fake_stream.h>
+#include <brillo/streams/memory_stream.h>
+#include <gtest/gtest.h>
+
+namespace buffet {
+
+namespace {
+
+const size_t kMaxSize = 10;
+
+}  // anonymous namespace
+
+class RequestBodyReaderTest : public ::testing::Test {
+ protected:
+  void SetUp() override { message_loop_.SetAsCurrent(); }
+
+  void Read(brillo::StreamPtr stream) {
+    RequestBodyReader::Read(
+        std::move(stream), kMaxSize, base::TimeDelta::FromSeconds(10),
+        base::Bind(&RequestBodyReaderTest::OnDone, base::Unretained(this)));
+  }
+
+  void OnDone(int status_code, std::string* body) {
+    EXPECT_EQ(0, status_code_);
+    status_code_ = status_code;
+    body_ = *body;
+  }
+
+  // Returns a stream with an unknown size, which delivers the data added to
+  // it with the delays given.
+  std::unique_ptr<brillo::FakeStream> CreateFakeStream() {
+    return std::unique_ptr<brillo::FakeStream>{new brillo::FakeStream{
+        brillo::Stream::AccessMode::READ, &clock_}};
+  }
+
+  // Runs the message loop, advancing the clock to the next task as needed.
+  void RunLoop() {
+    while (message_loop_.RunOnce(true)) {
+    }
+  }
+
+  base::SimpleTestClock clock_;
+  brillo::FakeMessageLoop message_loop_{&clock_};
+  int status_code_{0};
+  std::string body_;
+};
+
+TEST_F(RequestBodyReaderTest, ReadsBody) {
+  Read(brillo::MemoryStream::OpenCopyOf(std::string{"body"}, nullptr));
+  RunLoop();
+  EXPECT_EQ(brillo::http::status_code::Ok, status_code_);
+  EXPECT_EQ("body", body_);
+}
+
+TEST_F(RequestBodyReaderTest, NoBody) {
+  Read(nullptr);
+  EXPECT_EQ(brillo::http::status_code::Ok, status_code_);
+  EXPECT_EQ("", body_);
+}
+
+TEST_F(RequestBodyReaderTest, RejectsBodyOfKnownSizeOverLimit) {
+  Read(brillo::MemoryStream::OpenCopyOf(std::string(kMaxSize + 1, 'a'),
+                                        nullptr));
+  EXPECT_EQ(brillo::http::status_code::RequestEntityTooLarge, status_code_);
+}
+
+TEST_F(RequestBodyReaderTest, RejectsStreamedBodyOverLimit) {
+  auto stream = CreateFakeStream();
+  stream->AddReadPacketString({}, "123456");
+  stream->AddReadPacketString({}, "123456");
+  Read(std::move(stream));
+  RunLoop();
+  EXPECT_EQ(brillo::http::status_code::RequestEntityTooLarge, status_code_);
+}
+
+TEST_F(RequestBodyReaderTest, ReadsSlowBody) {
+  // Each chunk arrives before the inactivity timeout.
+  auto stream = CreateFakeStream();
+  stream->AddReadPacketString(base::TimeDelta::FromSeconds(6), "abc");
+  stream->AddReadPacketString(base::TimeDelta::FromSeconds(6), "def");
+  Read(std::move(stream));
+  RunLoop();
+  EXPECT_EQ(brillo::http::status_code::Ok, status_code_);
+  EXPECT_EQ("abcdef", body_);
+}
+
+TEST_F(RequestBodyReaderTest, TimesOutStalledBody) {
+  auto stream = CreateFakeStream();
+  stream->AddReadPacketString({}, "abc");
+  stream->AddReadPacketString(base::TimeDelta::FromSeconds(20), "def");
+  Read(std::move(stream));
+  RunLoop();
+  EXPECT_EQ(brillo::http::status_code::RequestTimeout, status_code_);
+}
+
+TEST_F(RequestBodyReaderTest, ReportsReadError) {
+  auto stream = CreateFakeStream();
+  stream->AddReadPacketString({}, "abc");
+  stream->QueueReadError({});
+  Read(std::move(stream));
+  RunLoop();
+  EXPECT_EQ(brillo::http::status_code::BadRequest, status_code_);
+}
+
+}  // namespace buffet
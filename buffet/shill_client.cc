@@ -46,6 +46,17 @@ namespace {
 
 void IgnoreDetachEvent() {}
 
+void OnSocketConnected(const std::string& host,
+                       const Network::OpenSslSocketCallback& callback,
+                       std::unique_ptr<weave::Stream> raw_stream,
+                       weave::ErrorPtr error) {
+  if (!raw_stream) {
+    callback.Run(nullptr, std::move(error));
+    return;
+  }
+  SocketStream::TlsConnect(std::move(raw_stream), host, callback);
+}
+
 bool GetStateForService(ServiceProxy* service, string* state) {
   CHECK(service) << "|service| was nullptr in GetStateForService()";
   VariantDictionary properties;
@@ -575,19 +586,8 @@ void ShillClient::OpenSslSocket(const std::string& host,
                                 const OpenSslSocketCallback& callback) {
   if (disable_xmpp_)
     return;
-  std::unique_ptr<weave::Stream> raw_stream{
-      SocketStream::ConnectBlocking(host, port)};
-  if (!raw_stream) {
-    brillo::ErrorPtr error;
-    brillo::errors::system::AddSystemError(&error, FROM_HERE, errno);
-    weave::ErrorPtr weave_error;
-    ConvertError(*error.get(), &weave_error);
-    base::MessageLoop::current()->PostTask(
-        FROM_HERE, base::Bind(callback, nullptr, base::Passed(&weave_error)));
-    return;
-  }
-
-  SocketStream::TlsConnect(std::move(raw_stream), host, callback);
+  SocketStream::ConnectAsync(host, port,
+                             base::Bind(&OnSocketConnected, host, callback));
 }
 
 }  // namespace buffet
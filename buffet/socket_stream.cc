@@ -13,19 +13,27 @@
 // limitations under the License.
 
 #include <arpa/inet.h>
+#include <algorithm>
+#include <deque>
 #include <map>
 #include <netdb.h>
 #include <string>
+#include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <vector>
 
 #include <base/bind.h>
 #include <base/bind_helpers.h>
 #include <base/files/file_util.h>
+#include <base/memory/weak_ptr.h>
 #include <base/message_loop/message_loop.h>
 #include <base/strings/stringprintf.h>
+#include <base/threading/worker_pool.h>
 #include <brillo/bind_lambda.h>
+#include <brillo/errors/error_codes.h>
+#include <brillo/message_loops/message_loop.h>
 #include <brillo/streams/file_stream.h>
 #include <brillo/streams/tls_stream.h>
 
@@ -63,34 +71,270 @@ std::string GetIPAddress(const sockaddr* sa) {
   return addr;
 }
 
-int ConnectSocket(const std::string& host, uint16_t port) {
+// Delay before starting a connection attempt to the next address while the
+// previous attempts are still in progress ("Happy Eyeballs", RFC 6555).
+const int kConnectAttemptDelayMs = 250;
+// Time after which a single connection attempt is abandoned.
+const int kConnectAttemptTimeoutSeconds = 10;
+
+struct ResolvedAddress {
+  sockaddr_storage address;
+  socklen_t address_length;
+  int family;
+  int socket_type;
+  int protocol;
+};
+
+struct ResolveResult {
+  int error{0};
+  std::vector<ResolvedAddress> addresses;
+};
+
+// Runs on a worker thread. Resolves |host| and orders the addresses so that
+// address families alternate, starting with the family of the first address
+// returned by the resolver.
+void ResolveHost(const std::string& host,
+                 uint16_t port,
+                 ResolveResult* result) {
   std::string service = std::to_string(port);
   addrinfo hints = {0, AF_UNSPEC, SOCK_STREAM};
-  addrinfo* result = nullptr;
-  if (getaddrinfo(host.c_str(), service.c_str(), &hints, &result)) {
-    PLOG(WARNING) << "Failed to resolve host name: " << host;
-    return -1;
+  addrinfo* info_list = nullptr;
+  result->error = getaddrinfo(host.c_str(), service.c_str(), &hints,
+                              &info_list);
+  if (result->error)
+    return;
+
+  std::deque<ResolvedAddress> primary;
+  std::deque<ResolvedAddress> secondary;
+  for (const addrinfo* info = info_list; info; info = info->ai_next) {
+    ResolvedAddress address;
+    memcpy(&address.address, info->ai_addr, info->ai_addrlen);
+    address.address_length = info->ai_addrlen;
+    address.family = info->ai_family;
+    address.socket_type = info->ai_socktype;
+    address.protocol = info->ai_protocol;
+    if (primary.empty() || primary.front().family == info->ai_family)
+      primary.push_back(address);
+    else
+      secondary.push_back(address);
   }
+  freeaddrinfo(info_list);
 
-  int socket_fd = -1;
-  for (const addrinfo* info = result; info != nullptr; info = info->ai_next) {
-    socket_fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
-    if (socket_fd < 0)
-      continue;
+  while (!primary.empty() || !secondary.empty()) {
+    for (auto* queue : {&primary, &secondary}) {
+      if (!queue->empty()) {
+        result->addresses.push_back(queue->front());
+        queue->pop_front();
+      }
+    }
+  }
+}
 
-    std::string addr = GetIPAddress(info->ai_addr);
-    LOG(INFO) << "Connecting to address: " << addr;
-    if (connect(socket_fd, info->ai_addr, info->ai_addrlen) == 0)
-      break;  // Success.
+// Performs the asynchronous connection for SocketStream::ConnectAsync().
+// The object owns itself and is destroyed once |callback_| has been called.
+class AsyncConnector final {
+ public:
+  AsyncConnector(const std::string& host,
+                 uint16_t port,
+                 const SocketStream::ConnectCallback& callback)
+      : host_{host}, port_{port}, callback_{callback} {}
 
-    PLOG(WARNING) << "Failed to connect to address: " << addr;
-    close(socket_fd);
-    socket_fd = -1;
+  ~AsyncConnector() {
+    for (const Attempt& attempt : attempts_)
+      CloseAttempt(attempt);
+    CancelTask(&next_attempt_task_);
   }
 
-  freeaddrinfo(result);
-  return socket_fd;
-}
+  void Start() {
+    ResolveResult* result = new ResolveResult;
+    bool posted = base::WorkerPool::PostTaskAndReply(
+        FROM_HERE, base::Bind(&ResolveHost, host_, port_, result),
+        base::Bind(&AsyncConnector::OnResolved, weak_ptr_factory_.GetWeakPtr(),
+                   base::Owned(result)),
+        true /* task_is_slow */);
+    if (!posted) {
+      last_error_ = EAGAIN;
+      Finish(-1);
+    }
+  }
+
+ private:
+  struct Attempt {
+    int socket_fd;
+    std::string address;
+    brillo::MessageLoop::TaskId watch_task;
+    brillo::MessageLoop::TaskId timeout_task;
+  };
+
+  void OnResolved(ResolveResult* result) {
+    if (result->error) {
+      LOG(WARNING) << "Failed to resolve host name: " << host_ << ": "
+                   << gai_strerror(result->error);
+      weave::ErrorPtr error;
+      weave::Error::AddTo(&error, FROM_HERE, "dns_resolution_failed",
+                          gai_strerror(result->error));
+      return Finish(-1, std::move(error));
+    }
+    addresses_ = std::move(result->addresses);
+    StartNextAttempt();
+  }
+
+  void StartNextAttempt() {
+    CancelTask(&next_attempt_task_);
+    while (next_address_ < addresses_.size()) {
+      const ResolvedAddress& info = addresses_[next_address_++];
+      int socket_fd =
+          socket(info.family, info.socket_type | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                 info.protocol);
+      if (socket_fd < 0) {
+        last_error_ = errno;
+        continue;
+      }
+
+      std::string address =
+          GetIPAddress(reinterpret_cast<const sockaddr*>(&info.address));
+      LOG(INFO) << "Connecting to address: " << address;
+      if (connect(socket_fd, reinterpret_cast<const sockaddr*>(&info.address),
+                  info.address_length) == 0) {
+        return Finish(socket_fd);
+      }
+      if (errno != EINPROGRESS) {
+        last_error_ = errno;
+        PLOG(WARNING) << "Failed to connect to address: " << address;
+        close(socket_fd);
+        continue;
+      }
+
+      Attempt attempt;
+      attempt.socket_fd = socket_fd;
+      attempt.address = address;
+      attempt.watch_task = brillo::MessageLoop::current()->WatchFileDescriptor(
+          FROM_HERE, socket_fd, brillo::MessageLoop::kWatchWrite, false,
+          base::Bind(&AsyncConnector::OnSocketWritable,
+                     weak_ptr_factory_.GetWeakPtr(), socket_fd));
+      attempt.timeout_task = brillo::MessageLoop::current()->PostDelayedTask(
+          FROM_HERE,
+          base::Bind(&AsyncConnector::OnAttemptTimeout,
+                     weak_ptr_factory_.GetWeakPtr(), socket_fd),
+          base::TimeDelta::FromSeconds(kConnectAttemptTimeoutSeconds));
+      attempts_.push_back(attempt);
+
+      if (next_address_ < addresses_.size()) {
+        next_attempt_task_ = brillo::MessageLoop::current()->PostDelayedTask(
+            FROM_HERE,
+            base::Bind(&AsyncConnector::StartNextAttempt,
+                       weak_ptr_factory_.GetWeakPtr()),
+            base::TimeDelta::FromMilliseconds(kConnectAttemptDelayMs));
+      }
+      return;
+    }
+
+    // No more addresses to try. Fail if nothing is in progress either.
+    if (attempts_.empty())
+      Finish(-1);
+  }
+
+  void OnSocketWritable(int socket_fd) {
+    auto it = FindAttempt(socket_fd);
+    if (it == attempts_.end())
+      return;
+    it->watch_task = brillo::MessageLoop::kTaskIdNull;
+    int socket_error = 0;
+    socklen_t length = sizeof(socket_error);
+    if (getsockopt(socket_fd, SOL_SOCKET, SO_ERROR, &socket_error, &length))
+      socket_error = errno;
+    if (socket_error == 0) {
+      CancelTask(&it->timeout_task);
+      attempts_.erase(it);
+      return Finish(socket_fd);
+    }
+    LOG(WARNING) << "Failed to connect to address: " << it->address << ": "
+                 << strerror(socket_error);
+    last_error_ = socket_error;
+    FailAttempt(it);
+  }
+
+  void OnAttemptTimeout(int socket_fd) {
+    auto it = FindAttempt(socket_fd);
+    if (it == attempts_.end())
+      return;
+    it->timeout_task = brillo::MessageLoop::kTaskIdNull;
+    LOG(WARNING) << "Timed out connecting to address: " << it->address;
+    last_error_ = ETIMEDOUT;
+    FailAttempt(it);
+  }
+
+  void FailAttempt(std::vector<Attempt>::iterator it) {
+    CloseAttempt(*it);
+    attempts_.erase(it);
+    // Move on to the next address right away instead of waiting for the
+    // attempt delay to expire.
+    if (attempts_.empty())
+      StartNextAttempt();
+  }
+
+  std::vector<Attempt>::iterator FindAttempt(int socket_fd) {
+    return std::find_if(attempts_.begin(), attempts_.end(),
+                        [socket_fd](const Attempt& attempt) {
+                          return attempt.socket_fd == socket_fd;
+                        });
+  }
+
+  void CloseAttempt(const Attempt& attempt) {
+    brillo::MessageLoop::TaskId watch_task = attempt.watch_task;
+    brillo::MessageLoop::TaskId timeout_task = attempt.timeout_task;
+    CancelTask(&watch_task);
+    CancelTask(&timeout_task);
+    close(attempt.socket_fd);
+  }
+
+  static void CancelTask(brillo::MessageLoop::TaskId* task_id) {
+    if (*task_id != brillo::MessageLoop::kTaskIdNull) {
+      brillo::MessageLoop::current()->CancelTask(*task_id);
+      *task_id = brillo::MessageLoop::kTaskIdNull;
+    }
+  }
+
+  // Reports the result of the connection to the callback and destroys this
+  // object. |socket_fd| is the connected socket or -1 on failure.
+  void Finish(int socket_fd, weave::ErrorPtr error = nullptr) {
+    std::unique_ptr<AsyncConnector> self{this};
+    std::unique_ptr<weave::Stream> stream;
+    if (socket_fd >= 0) {
+      auto ptr = brillo::FileStream::FromFileDescriptor(socket_fd, true,
+                                                        nullptr);
+      if (ptr) {
+        stream.reset(new SocketStream{std::move(ptr)});
+      } else {
+        last_error_ = errno;
+        close(socket_fd);
+      }
+    }
+    if (!stream && !error) {
+      brillo::ErrorPtr brillo_error;
+      brillo::errors::system::AddSystemError(&brillo_error, FROM_HERE,
+                                             last_error_ ? last_error_ : EIO);
+      ConvertError(*brillo_error, &error);
+    }
+    // Post the callback so that the caller is never called back re-entrantly.
+    base::MessageLoop::current()->PostTask(
+        FROM_HERE, base::Bind(callback_, base::Passed(&stream),
+                              base::Passed(&error)));
+  }
+
+  const std::string host_;
+  const uint16_t port_;
+  const SocketStream::ConnectCallback callback_;
+  std::vector<ResolvedAddress> addresses_;
+  size_t next_address_{0};
+  std::vector<Attempt> attempts_;
+  brillo::MessageLoop::TaskId next_attempt_task_{
+      brillo::MessageLoop::kTaskIdNull};
+  int last_error_{0};
+
+  base::WeakPtrFactory<AsyncConnector> weak_ptr_factory_{this};
+  DISALLOW_COPY_AND_ASSIGN(AsyncConnector);
+};
 
 void OnSuccess(const Network::OpenSslSocketCallback& callback,
                brillo::StreamPtr tls_stream) {
@@ -142,19 +386,10 @@ void SocketStream::CancelPendingOperations() {
   ptr_->CancelPendingAsyncOperations();
 }
 
-std::unique_ptr<weave::Stream> SocketStream::ConnectBlocking(
-    const std::string& host,
-    uint16_t port) {
-  int socket_fd = ConnectSocket(host, port);
-  if (socket_fd <= 0)
-    return nullptr;
-
-  auto ptr_ = brillo::FileStream::FromFileDescriptor(socket_fd, true, nullptr);
-  if (ptr_)
-    return std::unique_ptr<Stream>{new SocketStream{std::move(ptr_)}};
-
-  close(socket_fd);
-  return nullptr;
+void SocketStream::ConnectAsync(const std::string& host,
+                                uint16_t port,
+                                const ConnectCallback& callback) {
+  (new AsyncConnector{host, port, callback})->Start();
 }
 
 void SocketStream::TlsConnect(std::unique_ptr<Stream> socket,
@@ -41,8 +41,19 @@ class SocketStream : public weave::Stream {
 
   void CancelPendingOperations() override;
 
-  static std::unique_ptr<weave::Stream> ConnectBlocking(const std::string& host,
-                                                        uint16_t port);
+  using ConnectCallback =
+      base::Callback<void(std::unique_ptr<weave::Stream> stream,
+                          weave::ErrorPtr error)>;
+
+  // Resolves |host| and connects to |port| without blocking the message loop.
+  // Name resolution is done on a worker thread, and connection attempts to
+  // the resolved addresses are made with non-blocking sockets, starting a new
+  // attempt every 250 ms (alternating between IPv6 and IPv4 addresses) until
+  // one of them succeeds. The first established connection is passed to
+  // |callback|.
+  static void ConnectAsync(const std::string& host,
+                           uint16_t port,
+                           const ConnectCallback& callback);
 
   static void TlsConnect(
       std::unique_ptr<weave::Stream> socket,
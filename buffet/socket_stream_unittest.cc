@@ -0,0 +1,115 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffet/socket_stream.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <memory>
+#include <string>
+
+#include <base/bind.h>
+#include <base/files/scoped_file.h>
+#include <base/message_loop/message_loop.h>
+#include <brillo/bind_lambda.h>
+#include <brillo/message_loops/base_message_loop.h>
+#include <brillo/message_loops/message_loop_utils.h>
+#include <gtest/gtest.h>
+
+namespace buffet {
+
+namespace {
+
+// Returns a TCP socket bound to a free loopback port, and the port.
+base::ScopedFD BindLoopbackSocket(uint16_t* port) {
+  base::ScopedFD socket_fd{socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+  EXPECT_TRUE(socket_fd.is_valid());
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  EXPECT_EQ(0, bind(socket_fd.get(), reinterpret_cast<sockaddr*>(&address),
+                    length));
+  EXPECT_EQ(0, getsockname(socket_fd.get(),
+                           reinterpret_cast<sockaddr*>(&address), &length));
+  *port = ntohs(address.sin_port);
+  return socket_fd;
+}
+
+}  // anonymous namespace
+
+class SocketStreamTest : public ::testing::Test {
+ protected:
+  void SetUp() override { message_loop_.SetAsCurrent(); }
+
+  // Connects to |host| and runs the message loop until the connection
+  // completes.
+  void Connect(const std::string& host, uint16_t port) {
+    SocketStream::ConnectAsync(
+        host, port,
+        base::Bind(&SocketStreamTest::OnConnected, base::Unretained(this)));
+    // The result is never reported re-entrantly.
+    EXPECT_FALSE(done_);
+    brillo::MessageLoopRunUntil(&message_loop_,
+                                base::TimeDelta::FromSeconds(30),
+                                base::Bind([this]() { return done_; }));
+    EXPECT_TRUE(done_);
+  }
+
+  void OnConnected(std::unique_ptr<weave::Stream> stream,
+                   weave::ErrorPtr error) {
+    EXPECT_FALSE(done_);
+    done_ = true;
+    stream_ = std::move(stream);
+    error_ = std::move(error);
+  }
+
+  base::MessageLoopForIO base_loop_;
+  brillo::BaseMessageLoop message_loop_{&base_loop_};
+  bool done_{false};
+  std::unique_ptr<weave::Stream> stream_;
+  weave::ErrorPtr error_;
+};
+
+TEST_F(SocketStreamTest, ConnectAsync) {
+  uint16_t port = 0;
+  base::ScopedFD listen_fd = BindLoopbackSocket(&port);
+  ASSERT_EQ(0, listen(listen_fd.get(), 1));
+
+  Connect("127.0.0.1", port);
+  EXPECT_NE(nullptr, stream_.get());
+  EXPECT_EQ(nullptr, error_.get());
+}
+
+TEST_F(SocketStreamTest, ConnectAsyncRefused) {
+  uint16_t port = 0;
+  // Bound, but not listening.
+  base::ScopedFD socket_fd = BindLoopbackSocket(&port);
+
+  Connect("127.0.0.1", port);
+  EXPECT_EQ(nullptr, stream_.get());
+  EXPECT_NE(nullptr, error_.get());
+}
+
+TEST_F(SocketStreamTest, ConnectAsyncResolutionFailure) {
+  // The .invalid top level domain never resolves (RFC 2606).
+  Connect("weaved.invalid", 443);
+  EXPECT_EQ(nullptr, stream_.get());
+  ASSERT_NE(nullptr, error_.get());
+  EXPECT_EQ("dns_resolution_failed", error_->GetCode());
+}
+
+}  // namespace buffet
@@ -0,0 +1,466 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// In-process microbenchmarks for the weaved IPC paths. The daemon side
+// (Manager, BinderWeaveService, BinderCommandProxy) runs against a mock
+// weave::Device and libweaved talks to it through a stub BinderWrapper, so
+// binder calls are direct virtual calls and parcel marshalling is measured
+// separately. allocs/op counts the calls to any form of operator new, not
+// the allocations made with malloc() directly.
+//
+// Usage: weaved_benchmark [--iterations=N] [--filter=substring]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <base/at_exit.h>
+#include <base/bind.h>
+#include <base/command_line.h>
+#include <base/logging.h>
+#include <base/message_loop/message_loop.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/values.h>
+#include <binder/Parcel.h>
+#include <binderwrapper/binder_wrapper.h>
+#include <binderwrapper/stub_binder_wrapper.h>
+#include <brillo/bind_lambda.h>
+#include <brillo/message_loops/base_message_loop.h>
+#include <gmock/gmock.h>
+#include <weave/test/mock_command.h>
+#include <weave/test/mock_device.h>
+#include <weave/test/unittest_utils.h>
+
+#include "android/weave/BnWeaveClient.h"
+#include "buffet/binder_command_proxy.h"
+#include "buffet/binder_weave_service.h"
+#include "buffet/manager.h"
+#include "common/binder_constants.h"
+#include "common/binder_utils.h"
+#include "common/command_snapshot.h"
+#include "common/device_info.h"
+#include "common/parcelable_dictionary.h"
+#include "common/versioned_json.h"
+#include "libweaved/command.h"
+#include "libweaved/service.h"
+
+using ::testing::_;
+using ::testing::Invoke;
+using ::testing::NiceMock;
+using ::testing::Return;
+using ::testing::ReturnRef;
+using ::testing::ReturnRefOfCopy;
+using weave::test::CreateDictionaryValue;
+using weaved::binder_utils::ToString16;
+
+namespace {
+
+// Number of allocations made through operator new by the process, sampled
+// around each benchmark to report allocations per operation. All the
+// replaceable forms of operator new are counted; allocations made directly
+// with malloc(), e.g. by C libraries, are not.
+std::atomic<size_t> g_allocation_count{0};
+
+void* CountedAllocate(size_t size) {
+  g_allocation_count.fetch_add(1, std::memory_order_relaxed);
+  return std::malloc(size ? size : 1);
+}
+
+}  // anonymous namespace
+
+void* operator new(size_t size) {
+  void* ptr = CountedAllocate(size);
+  if (!ptr)
+    throw std::bad_alloc{};
+  return ptr;
+}
+
+void* operator new[](size_t size) {
+  void* ptr = CountedAllocate(size);
+  if (!ptr)
+    throw std::bad_alloc{};
+  return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return CountedAllocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return CountedAllocate(size);
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+  std::free(ptr);
+}
+
+namespace buffet {
+
+namespace {
+
+const char kComponent[] = "myComponent";
+
+const char kTraits[] = R"({
+  'robot': {
+    'commands': {
+      'jump': {
+        'parameters': {'height': {'type': 'integer'}},
+        'progress': {'percent': {'type': 'integer'}},
+        'results': {'distance': {'type': 'number'}}
+      }
+    },
+    'state': {
+      'status': {'type': 'string'},
+      'battery': {'type': 'integer'},
+      'position': {'type': 'object'}
+    }
+  }
+})";
+
+const char kState[] = R"({
+  'robot': {
+    'status': 'idle',
+    'battery': 87,
+    'position': {'x': 1.5, 'y': -2.25, 'heading': 90}
+  }
+})";
+
+using Clock = std::chrono::steady_clock;
+
+class Benchmark {
+ public:
+  Benchmark(size_t iterations, const std::string& filter)
+      : iterations_{iterations}, filter_{filter} {}
+
+  // Runs |body| |iterations_| times after a short warm-up and prints the mean
+  // time and allocations per operation along with the p50/p99 latencies.
+  void Run(const std::string& name, const std::function<void()>& body) {
+    if (!filter_.empty() && name.find(filter_) == std::string::npos)
+      return;
+    for (size_t i = 0; i < iterations_ / 10 + 1; i++)
+      body();
+
+    std::vector<int64_t> samples(iterations_);
+    size_t allocations = g_allocation_count.load();
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < iterations_; i++) {
+      Clock::time_point op_start = Clock::now();
+      body();
+      samples[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       Clock::now() - op_start).count();
+    }
+    int64_t total = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        Clock::now() - start).count();
+    allocations = g_allocation_count.load() - allocations;
+
+    std::sort(samples.begin(), samples.end());
+    printf("%-40s %10.0f ns/op %8.1f allocs/op %10lld p50 %10lld p99\n",
+           name.c_str(), static_cast<double>(total) / iterations_,
+           static_cast<double>(allocations) / iterations_,
+           static_cast<long long>(samples[samples.size() / 2]),
+           static_cast<long long>(samples[samples.size() * 99 / 100]));
+  }
+
+ private:
+  size_t iterations_;
+  std::string filter_;
+};
+
+class NullWeaveClient : public android::weave::BnWeaveClient {
+ public:
+  android::binder::Status onServiceConnected(
+      const android::sp<android::weave::IWeaveService>& service) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status onCommand(
+      const android::String16& componentName,
+      const android::String16& commandName,
+      const android::sp<android::weave::IWeaveCommand>& command) override {
+    return android::binder::Status::ok();
+  }
+};
+
+void SetUpMockCommand(weave::test::MockCommand* command,
+                      const base::DictionaryValue& parameters,
+                      const base::DictionaryValue& empty) {
+  ON_CALL(*command, GetID())
+      .WillByDefault(ReturnRefOfCopy<std::string>("cmd_1"));
+  ON_CALL(*command, GetName())
+      .WillByDefault(ReturnRefOfCopy<std::string>("robot.jump"));
+  ON_CALL(*command, GetComponent())
+      .WillByDefault(ReturnRefOfCopy<std::string>(kComponent));
+  ON_CALL(*command, GetState())
+      .WillByDefault(Return(weave::Command::State::kQueued));
+  ON_CALL(*command, GetOrigin())
+      .WillByDefault(Return(weave::Command::Origin::kLocal));
+  ON_CALL(*command, GetParameters()).WillByDefault(ReturnRef(parameters));
+  ON_CALL(*command, GetProgress()).WillByDefault(ReturnRef(empty));
+  ON_CALL(*command, GetResults()).WillByDefault(ReturnRef(empty));
+  ON_CALL(*command, SetProgress(_, _)).WillByDefault(Return(true));
+  ON_CALL(*command, Complete(_, _)).WillByDefault(Return(true));
+}
+
+void RunConversionBenchmarks(Benchmark* benchmark) {
+  auto state = CreateDictionaryValue(kState);
+  android::String16 state_json = ToString16(*state);
+
+  benchmark->Run("binder_utils/ToString16", [&state] {
+    ToString16(*state);
+  });
+  benchmark->Run("binder_utils/ParseDictionary", [&state_json] {
+    std::unique_ptr<base::DictionaryValue> dict;
+    weaved::binder_utils::ParseDictionary(state_json, &dict);
+  });
+  benchmark->Run("parcel/ParcelableDictionary", [&state] {
+    android::Parcel parcel;
+    android::weave::ParcelableDictionary{state.get()}.writeToParcel(&parcel);
+    parcel.setDataPosition(0);
+    android::weave::ParcelableDictionary result;
+    result.readFromParcel(&parcel);
+  });
+  std::string state_utf8 = weaved::binder_utils::ToJson(*state);
+  benchmark->Run("parcel/CommandSnapshot", [&state_utf8] {
+    android::weave::CommandSnapshot snapshot;
+    snapshot.id = "cmd_1";
+    snapshot.name = "robot.jump";
+    snapshot.parameters = state_utf8;
+    android::Parcel parcel;
+    snapshot.writeToParcel(&parcel);
+    parcel.setDataPosition(0);
+    android::weave::CommandSnapshot result;
+    result.readFromParcel(&parcel);
+  });
+}
+
+void RunDaemonBenchmarks(
+    Benchmark* benchmark,
+    weave::Device* device,
+    const android::sp<android::weave::IWeaveServiceManager>& manager) {
+  auto state = CreateDictionaryValue(kState);
+  android::String16 state_json = ToString16(*state);
+  android::String16 component = ToString16(kComponent);
+  android::sp<android::weave::IWeaveService> service =
+      new BinderWeaveService{device, new NullWeaveClient};
+
+  benchmark->Run("BinderWeaveService/updateState", [&] {
+    service->updateState(component, state_json);
+  });
+  benchmark->Run("BinderWeaveService/setStateProperties", [&] {
+    service->setStateProperties(
+        component, android::weave::ParcelableDictionary{state.get()});
+  });
+
+  base::DictionaryValue parameters;
+  parameters.SetInteger("height", 53);
+  base::DictionaryValue empty;
+  auto command = std::make_shared<NiceMock<weave::test::MockCommand>>();
+  SetUpMockCommand(command.get(), parameters, empty);
+  android::sp<android::weave::IWeaveCommand> proxy =
+      new BinderCommandProxy{command};
+  android::String16 progress = ToString16(R"({"robot":{"percent":50}})");
+
+  benchmark->Run("BinderCommandProxy/getSnapshot", [&] {
+    android::weave::CommandSnapshot snapshot;
+    proxy->getSnapshot(&snapshot);
+  });
+  benchmark->Run("BinderCommandProxy/setProgress", [&] {
+    proxy->setProgress(progress);
+  });
+
+  benchmark->Run("WeaveServiceManager/getComponents", [&] {
+    android::String16 components;
+    manager->getComponents(&components);
+  });
+  // Measures the common case of a client whose copy is up to date.
+  android::weave::VersionedJson current_components;
+  manager->getComponentsIfChanged(0, &current_components);
+  benchmark->Run("WeaveServiceManager/getComponentsIfChanged", [&] {
+    android::weave::VersionedJson components;
+    manager->getComponentsIfChanged(current_components.version, &components);
+  });
+  benchmark->Run("WeaveServiceManager/getTraits", [&] {
+    android::String16 traits;
+    manager->getTraits(&traits);
+  });
+  benchmark->Run("WeaveServiceManager/getDeviceName", [&] {
+    android::String16 name;
+    manager->getDeviceName(&name);
+  });
+  benchmark->Run("WeaveServiceManager/getAllProperties", [&] {
+    android::weave::ParcelableDictionary properties;
+    manager->getAllProperties(&properties);
+  });
+  benchmark->Run("WeaveServiceManager/getDeviceInfo", [&] {
+    android::weave::DeviceInfo info;
+    manager->getDeviceInfo(&info);
+  });
+}
+
+// Measures the round trips from libweaved through the daemon to the mock
+// device: state updates and delivery of a command to a client handler.
+void RunClientBenchmarks(
+    Benchmark* benchmark,
+    NiceMock<weave::test::MockDevice>* device,
+    const android::sp<android::weave::IWeaveServiceManager>& manager,
+    android::StubBinderWrapper* binder_wrapper,
+    brillo::BaseMessageLoop* message_loop) {
+  weave::Device::CommandHandlerCallback device_handler;
+  ON_CALL(*device, AddCommandHandler(kComponent, "robot.jump", _))
+      .WillByDefault(testing::SaveArg<2>(&device_handler));
+
+  binder_wrapper->SetBinderForService(
+      weaved::binder::kWeaveServiceName,
+      android::IInterface::asBinder(manager));
+
+  std::weak_ptr<weaved::Service> weak_service;
+  auto subscription = weaved::Service::Connect(
+      message_loop,
+      base::Bind([&weak_service](const std::weak_ptr<weaved::Service>& s) {
+        weak_service = s;
+      }));
+  while (!weak_service.lock())
+    message_loop->RunOnce(false);
+  std::shared_ptr<weaved::Service> service = weak_service.lock();
+
+  service->AddComponent(kComponent, {"robot"}, nullptr);
+  size_t commands_handled = 0;
+  service->AddCommandHandler(
+      kComponent, "robot", "jump",
+      base::Bind([&commands_handled](std::unique_ptr<weaved::Command> cmd) {
+        cmd->GetParameter<int>("height");
+        cmd->Complete({}, nullptr);
+        commands_handled++;
+      }));
+  // The handler is registered with weaved from a message loop task.
+  while (device_handler.is_null())
+    message_loop->RunOnce(false);
+
+  // libweaved does not send unchanged values, so each iteration changes the
+  // battery level to measure the full round trip.
+  auto state = CreateDictionaryValue(kState);
+  int battery = 0;
+  benchmark->Run("libweaved/SetStateProperties", [&] {
+    state->SetInteger("robot.battery", ++battery % 100);
+    service->SetStateProperties(kComponent, *state, nullptr);
+  });
+  benchmark->Run("libweaved/SetStateProperty", [&] {
+    service->SetStateProperty(kComponent, "robot", "battery",
+                              base::FundamentalValue{++battery % 100},
+                              nullptr);
+  });
+
+  base::DictionaryValue parameters;
+  parameters.SetInteger("height", 53);
+  base::DictionaryValue empty;
+  auto command = std::make_shared<NiceMock<weave::test::MockCommand>>();
+  SetUpMockCommand(command.get(), parameters, empty);
+  benchmark->Run("libweaved/CommandDelivery", [&] {
+    device_handler.Run(command);
+  });
+  CHECK_GT(commands_handled, 0u);
+  binder_wrapper->SetBinderForService(weaved::binder::kWeaveServiceName,
+                                      nullptr);
+}
+
+}  // anonymous namespace
+
+}  // namespace buffet
+
+int main(int argc, char** argv) {
+  base::AtExitManager exit_manager;
+  base::CommandLine::Init(argc, argv);
+  ::testing::InitGoogleMock(&argc, argv);
+
+  const base::CommandLine* cl = base::CommandLine::ForCurrentProcess();
+  size_t iterations = 10000;
+  if (cl->HasSwitch("iterations") &&
+      !base::StringToSizeT(cl->GetSwitchValueASCII("iterations"),
+                           &iterations)) {
+    LOG(ERROR) << "Invalid --iterations value";
+    return 1;
+  }
+  buffet::Benchmark benchmark{std::max<size_t>(iterations, 1),
+                              cl->GetSwitchValueASCII("filter")};
+
+  base::MessageLoopForIO base_loop;
+  brillo::BaseMessageLoop message_loop{&base_loop};
+  message_loop.SetAsCurrent();
+  android::StubBinderWrapper* binder_wrapper = new android::StubBinderWrapper;
+  android::BinderWrapper::InitForTesting(binder_wrapper);
+
+  auto traits = CreateDictionaryValue(buffet::kTraits);
+  auto components = CreateDictionaryValue(R"({
+    'myComponent': {
+      'traits': ['robot'],
+      'state': {'robot': {'status': 'idle', 'battery': 87}}
+    }
+  })");
+  weave::Settings settings;
+  settings.cloud_id = "cloud_id";
+  settings.device_id = "device_id";
+  settings.name = "Benchmark device";
+  settings.oem_name = "Brillo";
+  settings.model_name = "Brillo";
+  settings.model_id = "AAAAA";
+  // Owned by the manager.
+  auto device = new NiceMock<weave::test::MockDevice>;
+  ON_CALL(*device, GetTraits()).WillByDefault(ReturnRef(*traits));
+  ON_CALL(*device, GetComponents()).WillByDefault(ReturnRef(*components));
+  ON_CALL(*device, AddComponent(_, _, _)).WillByDefault(Return(true));
+  ON_CALL(*device, SetStateProperties(_, _, _)).WillByDefault(Return(true));
+  ON_CALL(*device, SetStatePropertiesFromJson(_, _, _))
+      .WillByDefault(Return(true));
+  // Like libweave, report the current values right away, so that the
+  // manager serves a populated state snapshot.
+  ON_CALL(*device, AddSettingsChangedCallback(_))
+      .WillByDefault(
+          Invoke([&settings](
+                     const weave::Device::SettingsChangedCallback& callback) {
+            callback.Run(settings);
+          }));
+  ON_CALL(*device, AddGcdStateChangedCallback(_))
+      .WillByDefault(
+          Invoke([](const weave::Device::GcdStateChangedCallback& callback) {
+            callback.Run(weave::GcdState::kConnected);
+          }));
+
+  android::sp<buffet::Manager> manager =
+      new buffet::Manager{buffet::Manager::Options{}, nullptr};
+  manager->StartForTesting(std::unique_ptr<weave::Device>{device});
+
+  buffet::RunConversionBenchmarks(&benchmark);
+  buffet::RunDaemonBenchmarks(&benchmark, device, manager);
+  buffet::RunClientBenchmarks(&benchmark, device, manager, binder_wrapper,
+                              &message_loop);
+  return 0;
+}
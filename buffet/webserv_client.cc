@@ -17,12 +17,18 @@
 #include <memory>
 #include <string>
 
+#include <base/bind.h>
+#include <base/logging.h>
+#include <brillo/http/http_request.h>
+#include <brillo/mime_utils.h>
+#include <brillo/streams/memory_stream.h>
 #include <libwebserv/protocol_handler.h>
 #include <libwebserv/request.h>
 #include <libwebserv/response.h>
 #include <libwebserv/server.h>
 
 #include "buffet/dbus_constants.h"
+#include "buffet/request_body_reader.h"
 #include "buffet/socket_stream.h"
 
 namespace buffet {
@@ -31,6 +37,14 @@ namespace {
 
 using weave::provider::HttpServer;
 
+// Request bodies larger than this are rejected without reaching libweave.
+// Privet requests are small JSON documents, so this is generous.
+const size_t kMaxRequestBodySize = 128 * 1024;
+
+// Requests whose body doesn't make progress for this long are answered with
+// 408 Request Timeout, so that a stalled client can't hold on to the reader.
+const int kBodyReadInactivityTimeoutSeconds = 10;
+
 class RequestImpl : public HttpServer::Request {
  public:
   explicit RequestImpl(std::unique_ptr<libwebserv::Request> request,
@@ -45,26 +59,9 @@ class RequestImpl : public HttpServer::Request {
     return request_->GetFirstHeader(name);
   }
 
-  // TODO(avakulenko): Remove this method and rewrite all call sites in libweave
-  // to use GetDataStream() instead.
-  std::string GetData() override {
-    if (request_data_)
-      return *request_data_;
-
-    request_data_.reset(new std::string);
-    auto stream = request_->GetDataStream();
-    if (stream) {
-      if (stream->CanGetSize())
-        request_data_->reserve(stream->GetRemainingSize());
-      std::vector<char> buffer(16 * 1024);  // 16K seems to be good enough.
-      size_t sz = 0;
-      while (stream->ReadBlocking(buffer.data(), buffer.size(), &sz, nullptr) &&
-             sz > 0) {
-        request_data_->append(buffer.data(), buffer.data() + sz);
-      }
-    }
-    return *request_data_;
-  }
+  // Returns the body read by RequestBodyReader before the request was handed
+  // to libweave, so this never blocks.
+  std::string GetData() override { return request_data_; }
 
   void SendReply(int status_code,
                  const std::string& data,
@@ -74,18 +71,37 @@ class RequestImpl : public HttpServer::Request {
 
   std::unique_ptr<weave::Stream> GetDataStream() const {
     auto stream = std::unique_ptr<weave::Stream>{
-        new SocketStream{request_->GetDataStream()}};
+        new SocketStream{brillo::MemoryStream::OpenRef(request_data_,
+                                                       nullptr)}};
     return stream;
   }
 
+  std::string* mutable_data() { return &request_data_; }
+
  private:
   std::unique_ptr<libwebserv::Request> request_;
   std::unique_ptr<libwebserv::Response> response_;
-  mutable std::unique_ptr<std::string> request_data_;
+  std::string request_data_;
 
   DISALLOW_COPY_AND_ASSIGN(RequestImpl);
 };
 
+// Passes |request| on to |callback| once RequestBodyReader has read its body,
+// or answers it with the error |status_code|.
+void OnBodyRead(std::unique_ptr<RequestImpl> request,
+                const HttpServer::RequestHandlerCallback& callback,
+                int status_code,
+                std::string* body) {
+  if (status_code != brillo::http::status_code::Ok) {
+    LOG(WARNING) << "Rejecting request for " << request->GetPath()
+                 << " with status " << status_code;
+    request->SendReply(status_code, "", brillo::mime::text::kPlain);
+    return;
+  }
+  request->mutable_data()->swap(*body);
+  callback.Run(std::move(request));
+}
+
 }  // namespace
 
 WebServClient::WebServClient(
@@ -143,9 +159,20 @@ brillo::Blob WebServClient::GetHttpsCertificateFingerprint() const {
 void WebServClient::OnRequest(const RequestHandlerCallback& callback,
                               std::unique_ptr<libwebserv::Request> request,
                               std::unique_ptr<libwebserv::Response> response) {
-  std::unique_ptr<Request> weave_request{
+  brillo::StreamPtr body_stream = request->GetDataStream();
+  std::unique_ptr<RequestImpl> weave_request{
       new RequestImpl{std::move(request), std::move(response)}};
-  callback.Run(std::move(weave_request));
+  RequestBodyReader::Read(
+      std::move(body_stream), kMaxRequestBodySize,
+      base::TimeDelta::FromSeconds(kBodyReadInactivityTimeoutSeconds),
+      base::Bind(&OnBodyRead, base::Passed(&weave_request),
+                 base::Bind(&WebServClient::OnRequestBodyRead,
+                            weak_ptr_factory_.GetWeakPtr(), callback)));
+}
+
+void WebServClient::OnRequestBodyRead(const RequestHandlerCallback& callback,
+                                      std::unique_ptr<Request> request) {
+  callback.Run(std::move(request));
 }
 
 void WebServClient::OnProtocolHandlerConnected(
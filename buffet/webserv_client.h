@@ -64,6 +64,8 @@ class WebServClient : public weave::provider::HttpServer {
   void OnRequest(const RequestHandlerCallback& callback,
                  std::unique_ptr<libwebserv::Request> request,
                  std::unique_ptr<libwebserv::Response> response);
+  void OnRequestBodyRead(const RequestHandlerCallback& callback,
+                         std::unique_ptr<Request> request);
 
   void OnProtocolHandlerConnected(
       libwebserv::ProtocolHandler* protocol_handler);
@@ -14,10 +14,53 @@
 
 #include "common/binder_constants.h"
 
+#include "android/weave/IWeaveServiceManagerNotificationListener.h"
+
 namespace weaved {
 namespace binder {
 
 const char kWeaveServiceName[] = "weave_service";
 
+const char* GetNotificationValueKey(int notification_id) {
+  using NotificationListener =
+      android::weave::IWeaveServiceManagerNotificationListener;
+  switch (notification_id) {
+    case NotificationListener::CLOUD_ID:
+      return "cloudId";
+    case NotificationListener::DEVICE_ID:
+      return "deviceId";
+    case NotificationListener::DEVICE_NAME:
+      return "deviceName";
+    case NotificationListener::DEVICE_DESCRIPTION:
+      return "deviceDescription";
+    case NotificationListener::DEVICE_LOCATION:
+      return "deviceLocation";
+    case NotificationListener::OEM_NAME:
+      return "oemName";
+    case NotificationListener::MODEL_NAME:
+      return "modelName";
+    case NotificationListener::MODEL_ID:
+      return "modelId";
+    case NotificationListener::PAIRING_SESSION_ID:
+      return "pairingSessionId";
+    case NotificationListener::PAIRING_MODE:
+      return "pairingMode";
+    case NotificationListener::PAIRING_CODE:
+      return "pairingCode";
+    case NotificationListener::TRAITS:
+      return "traits";
+    case NotificationListener::COMPONENTS:
+      return "components";
+    case NotificationListener::STATE:
+      return "state";
+  }
+  return nullptr;
+}
+
+const char kComponentsVersion[] = "version";
+const char kComponentsBaseVersion[] = "baseVersion";
+const char kComponentsPatch[] = "patch";
+const char kComponentsTree[] = "tree";
+
 }  // namespace binder
 }  // namespace weaved
@@ -20,6 +20,25 @@ namespace binder {
 
 extern const char kWeaveServiceName[];
 
+// Returns the key under which the value of the property with the given
+// IWeaveServiceManagerNotificationListener notification ID is sent by
+// notifyServiceManagerValues(), or nullptr for an unknown ID.
+const char* GetNotificationValueKey(int notification_id);
+
+// The value sent for COMPONENTS is a dictionary with the version of the
+// component tree (see IWeaveServiceManager.getComponentsIfChanged()) and
+// either a JSON-patch-style list of changes against the tree at
+// |kComponentsBaseVersion| (see common/json_patch.h), or the full tree.
+// A listener only receives changes against the tree of the previous
+// COMPONENTS value it received. It receives the full tree with its first
+// COMPONENTS value, or when it has missed any since (e.g. because of its
+// notification mask). Versions are sent as doubles, since base::Value has no
+// 64-bit integers.
+extern const char kComponentsVersion[];
+extern const char kComponentsBaseVersion[];
+extern const char kComponentsPatch[];
+extern const char kComponentsTree[];
+
 }  // namespace binder
 }  // namespace weaved
 
@@ -38,19 +38,29 @@ bool StatusToError(android::binder::Status status, brillo::ErrorPtr* error) {
 }
 
 android::String16 ToString16(const base::Value& value) {
+  return ToString16(ToJson(value));
+}
+
+std::string ToJson(const base::Value& value) {
   std::string json;
   base::JSONWriter::Write(value, &json);
-  return ToString16(json);
+  return json;
 }
 
 android::binder::Status ParseDictionary(
     const android::String16& json,
     std::unique_ptr<base::DictionaryValue>* dict) {
+  return ParseDictionary(ToString(json), dict);
+}
+
+android::binder::Status ParseDictionary(
+    const std::string& json,
+    std::unique_ptr<base::DictionaryValue>* dict) {
   int error = 0;
   std::string message;
   std::unique_ptr<base::Value> value{
-      base::JSONReader::ReadAndReturnError(ToString(json), base::JSON_PARSE_RFC,
-                                           &error, &message)
+      base::JSONReader::ReadAndReturnError(json, base::JSON_PARSE_RFC, &error,
+                                           &message)
           .release()};
   base::DictionaryValue* dict_value = nullptr;
   if (!value || !value->GetAsDictionary(&dict_value)) {
@@ -62,5 +72,29 @@ android::binder::Status ParseDictionary(
   return android::binder::Status::ok();
 }
 
+android::status_t WriteUtf8String(android::Parcel* parcel,
+                                  const std::string& value) {
+  android::status_t status =
+      parcel->writeInt32(static_cast<int32_t>(value.size()));
+  if (status != android::OK)
+    return status;
+  return parcel->write(value.data(), value.size());
+}
+
+android::status_t ReadUtf8String(const android::Parcel* parcel,
+                                 std::string* value) {
+  int32_t size = 0;
+  android::status_t status = parcel->readInt32(&size);
+  if (status != android::OK)
+    return status;
+  if (size < 0)
+    return android::BAD_VALUE;
+  const char* data = static_cast<const char*>(parcel->readInplace(size));
+  if (!data && size > 0)
+    return android::NOT_ENOUGH_DATA;
+  value->assign(data, size);
+  return android::OK;
+}
+
 }  // namespace binder_utils
 }  // namespace weaved
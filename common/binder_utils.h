@@ -19,9 +19,11 @@
 #include <string>
 
 #include <base/values.h>
+#include <binder/Parcel.h>
 #include <binder/Status.h>
 #include <utils/String8.h>
 #include <utils/String16.h>
+#include <utils/Unicode.h>
 #include <brillo/errors/error.h>
 
 namespace weave {
@@ -44,23 +46,50 @@ android::binder::Status ToStatus(bool success, weave::ErrorPtr* error);
 bool StatusToError(android::binder::Status status, brillo::ErrorPtr* error);
 
 // Converts binder's UTF16 string into a regular UTF8-encoded standard string.
+// Transcodes straight into the result instead of going through String8.
 inline std::string ToString(const android::String16& value) {
-  return android::String8{value}.string();
+  ssize_t size = utf16_to_utf8_length(value.string(), value.size());
+  if (size <= 0)
+    return std::string{};
+  // utf16_to_utf8() appends a terminating null character, which |dst_len|
+  // must account for.
+  std::string result(size + 1, '\0');
+  utf16_to_utf8(value.string(), value.size(), &result.front(), result.size());
+  result.resize(size);
+  return result;
 }
 
 // Converts regular UTF8-encoded standard string into a binder's UTF16 string.
 inline android::String16 ToString16(const std::string& value) {
-  return android::String16{value.c_str()};
+  return android::String16{value.data(), value.size()};
 }
 
 // Serializes a dictionary to a string for transferring over binder.
 android::String16 ToString16(const base::Value& value);
 
+// Serializes a dictionary to a UTF-8 encoded JSON string.
+std::string ToJson(const base::Value& value);
+
 // De-serializes a dictionary from a binder string.
 android::binder::Status ParseDictionary(
     const android::String16& json,
     std::unique_ptr<base::DictionaryValue>* dict);
 
+// De-serializes a dictionary from a UTF-8 encoded JSON string.
+android::binder::Status ParseDictionary(
+    const std::string& json,
+    std::unique_ptr<base::DictionaryValue>* dict);
+
+// Writes a UTF-8 string to |parcel| as is, as a length followed by the raw
+// bytes. Unlike Parcel::writeString16() this needs no transcoding on either
+// side, so it is used by the hand-written parcelables for their strings.
+android::status_t WriteUtf8String(android::Parcel* parcel,
+                                  const std::string& value);
+
+// Reads a string written by WriteUtf8String().
+android::status_t ReadUtf8String(const android::Parcel* parcel,
+                                 std::string* value);
+
 }  // namespace binder_utils
 }  // namespace weaved
 
@@ -0,0 +1,46 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "common/command_snapshot.h"
+
+#include "common/binder_utils.h"
+
+using weaved::binder_utils::ReadUtf8String;
+using weaved::binder_utils::WriteUtf8String;
+
+namespace android {
+namespace weave {
+
+status_t CommandSnapshot::writeToParcel(Parcel* parcel) const {
+  for (const std::string* value : {&id, &name, &component, &state, &origin,
+                                   &parameters, &progress, &results}) {
+    status_t status = WriteUtf8String(parcel, *value);
+    if (status != OK)
+      return status;
+  }
+  return OK;
+}
+
+status_t CommandSnapshot::readFromParcel(const Parcel* parcel) {
+  for (std::string* value : {&id, &name, &component, &state, &origin,
+                             &parameters, &progress, &results}) {
+    status_t status = ReadUtf8String(parcel, value);
+    if (status != OK)
+      return status;
+  }
+  return OK;
+}
+
+}  // namespace weave
+}  // namespace android
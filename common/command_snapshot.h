@@ -0,0 +1,54 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COMMON_COMMAND_SNAPSHOT_H_
+#define COMMON_COMMAND_SNAPSHOT_H_
+
+#include <string>
+
+#include <binder/Parcel.h>
+#include <binder/Parcelable.h>
+
+namespace android {
+namespace weave {
+
+// A copy of all the properties of a weave command, returned by
+// IWeaveCommand::getSnapshot() so that clients can read the command in one
+// binder transaction instead of calling each of the individual getters.
+// The values use the same format as the respective getters, that is state and
+// origin are enum strings and parameters, progress and results are
+// JSON-encoded dictionaries, but are sent as UTF-8 to avoid transcoding.
+class CommandSnapshot : public Parcelable {
+ public:
+  CommandSnapshot() = default;
+  ~CommandSnapshot() override = default;
+
+  // Parcelable implementation.
+  status_t writeToParcel(Parcel* parcel) const override;
+  status_t readFromParcel(const Parcel* parcel) override;
+
+  std::string id;
+  std::string name;
+  std::string component;
+  std::string state;
+  std::string origin;
+  std::string parameters;
+  std::string progress;
+  std::string results;
+};
+
+}  // namespace weave
+}  // namespace android
+
+#endif  // COMMON_COMMAND_SNAPSHOT_H_
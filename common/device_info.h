@@ -0,0 +1,56 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COMMON_DEVICE_INFO_H_
+#define COMMON_DEVICE_INFO_H_
+
+#include <string>
+
+#include <binder/Parcel.h>
+#include <binder/Parcelable.h>
+
+namespace android {
+namespace weave {
+
+// The identity, GCD state and pairing info of the device, returned by
+// IWeaveServiceManager::getDeviceInfo() so that clients can read them in one
+// binder transaction instead of calling each of the individual getters.
+// The values are the same as those returned by the respective getters.
+class DeviceInfo : public Parcelable {
+ public:
+  DeviceInfo() = default;
+  ~DeviceInfo() override = default;
+
+  // Parcelable implementation.
+  status_t writeToParcel(Parcel* parcel) const override;
+  status_t readFromParcel(const Parcel* parcel) override;
+
+  std::string cloud_id;
+  std::string device_id;
+  std::string name;
+  std::string description;
+  std::string location;
+  std::string oem_name;
+  std::string model_name;
+  std::string model_id;
+  std::string state;
+  std::string pairing_session_id;
+  std::string pairing_mode;
+  std::string pairing_code;
+};
+
+}  // namespace weave
+}  // namespace android
+
+#endif  // COMMON_DEVICE_INFO_H_
@@ -0,0 +1,75 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "common/device_info.h"
+
+#include <gtest/gtest.h>
+
+namespace android {
+namespace weave {
+
+namespace {
+
+DeviceInfo CreateDeviceInfo() {
+  DeviceInfo info;
+  info.cloud_id = "cloud_id";
+  info.device_id = "device_id";
+  info.name = "Café device";
+  info.description = "";
+  info.location = "Kitchen";
+  info.oem_name = "Brillo";
+  info.model_name = "Test model";
+  info.model_id = "AAAAA";
+  info.state = "connected";
+  info.pairing_session_id = "session_1";
+  info.pairing_mode = "pinCode";
+  info.pairing_code = "1234";
+  return info;
+}
+
+}  // anonymous namespace
+
+TEST(DeviceInfoTest, RoundTrip) {
+  DeviceInfo info = CreateDeviceInfo();
+  Parcel parcel;
+  EXPECT_EQ(OK, info.writeToParcel(&parcel));
+  parcel.setDataPosition(0);
+  DeviceInfo result;
+  EXPECT_EQ(OK, result.readFromParcel(&parcel));
+  EXPECT_EQ(info.cloud_id, result.cloud_id);
+  EXPECT_EQ(info.device_id, result.device_id);
+  EXPECT_EQ(info.name, result.name);
+  EXPECT_EQ(info.description, result.description);
+  EXPECT_EQ(info.location, result.location);
+  EXPECT_EQ(info.oem_name, result.oem_name);
+  EXPECT_EQ(info.model_name, result.model_name);
+  EXPECT_EQ(info.model_id, result.model_id);
+  EXPECT_EQ(info.state, result.state);
+  EXPECT_EQ(info.pairing_session_id, result.pairing_session_id);
+  EXPECT_EQ(info.pairing_mode, result.pairing_mode);
+  EXPECT_EQ(info.pairing_code, result.pairing_code);
+  EXPECT_EQ(parcel.dataSize(), parcel.dataPosition());
+}
+
+TEST(DeviceInfoTest, Truncated) {
+  Parcel parcel;
+  EXPECT_EQ(OK, CreateDeviceInfo().writeToParcel(&parcel));
+  parcel.setDataSize(parcel.dataSize() - sizeof(int32_t));
+  parcel.setDataPosition(0);
+  DeviceInfo result;
+  EXPECT_NE(OK, result.readFromParcel(&parcel));
+}
+
+}  // namespace weave
+}  // namespace android
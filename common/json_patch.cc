@@ -0,0 +1,143 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "common/json_patch.h"
+
+#include <string>
+#include <vector>
+
+#include <base/strings/string_util.h>
+#include <brillo/strings/string_utils.h>
+
+namespace weaved {
+namespace json_patch {
+
+namespace {
+
+const char kOp[] = "op";
+const char kPath[] = "path";
+const char kValue[] = "value";
+const char kAdd[] = "add";
+const char kRemove[] = "remove";
+const char kReplace[] = "replace";
+
+// Escapes a dictionary key for use as a JSON Pointer reference token.
+std::string EscapeToken(const std::string& key) {
+  std::string token = key;
+  base::ReplaceSubstringsAfterOffset(&token, 0, "~", "~0");
+  base::ReplaceSubstringsAfterOffset(&token, 0, "/", "~1");
+  return token;
+}
+
+std::string UnescapeToken(const std::string& token) {
+  std::string key = token;
+  base::ReplaceSubstringsAfterOffset(&key, 0, "~1", "/");
+  base::ReplaceSubstringsAfterOffset(&key, 0, "~0", "~");
+  return key;
+}
+
+void AddOperation(const char* op,
+                  const std::string& path,
+                  const base::Value* value,
+                  base::ListValue* patch) {
+  base::DictionaryValue* operation = new base::DictionaryValue;
+  operation->SetString(kOp, op);
+  operation->SetString(kPath, path);
+  if (value)
+    operation->Set(kValue, value->DeepCopy());
+  patch->Append(operation);
+}
+
+void Diff(const base::DictionaryValue& from,
+          const base::DictionaryValue& to,
+          const std::string& path,
+          base::ListValue* patch) {
+  for (base::DictionaryValue::Iterator it(from); !it.IsAtEnd(); it.Advance()) {
+    std::string item_path = path + "/" + EscapeToken(it.key());
+    const base::Value* to_value = nullptr;
+    if (!to.GetWithoutPathExpansion(it.key(), &to_value)) {
+      AddOperation(kRemove, item_path, nullptr, patch);
+      continue;
+    }
+    const base::DictionaryValue* from_dict = nullptr;
+    const base::DictionaryValue* to_dict = nullptr;
+    if (it.value().GetAsDictionary(&from_dict) &&
+        to_value->GetAsDictionary(&to_dict)) {
+      Diff(*from_dict, *to_dict, item_path, patch);
+    } else if (!it.value().Equals(to_value)) {
+      AddOperation(kReplace, item_path, to_value, patch);
+    }
+  }
+  for (base::DictionaryValue::Iterator it(to); !it.IsAtEnd(); it.Advance()) {
+    if (!from.HasKey(it.key())) {
+      AddOperation(kAdd, path + "/" + EscapeToken(it.key()), &it.value(),
+                   patch);
+    }
+  }
+}
+
+bool ApplyOperation(const base::DictionaryValue& operation,
+                    base::DictionaryValue* dict) {
+  std::string op;
+  std::string path;
+  if (!operation.GetString(kOp, &op) || !operation.GetString(kPath, &path) ||
+      path.empty() || path[0] != '/') {
+    return false;
+  }
+  std::vector<std::string> tokens =
+      brillo::string_utils::Split(path.substr(1), "/", false, false);
+  if (tokens.empty())
+    return false;
+  base::DictionaryValue* parent = dict;
+  for (size_t i = 0; i + 1 < tokens.size(); i++) {
+    if (!parent->GetDictionaryWithoutPathExpansion(UnescapeToken(tokens[i]),
+                                                   &parent)) {
+      return false;
+    }
+  }
+  std::string key = UnescapeToken(tokens.back());
+  if (op == kRemove)
+    return parent->RemoveWithoutPathExpansion(key, nullptr);
+
+  const base::Value* value = nullptr;
+  if (!operation.GetWithoutPathExpansion(kValue, &value))
+    return false;
+  if (op == kReplace && !parent->HasKey(key))
+    return false;
+  if (op != kAdd && op != kReplace)
+    return false;
+  parent->SetWithoutPathExpansion(key, value->DeepCopy());
+  return true;
+}
+
+}  // anonymous namespace
+
+std::unique_ptr<base::ListValue> CreatePatch(const base::DictionaryValue& from,
+                                             const base::DictionaryValue& to) {
+  std::unique_ptr<base::ListValue> patch{new base::ListValue};
+  Diff(from, to, "", patch.get());
+  return patch;
+}
+
+bool ApplyPatch(const base::ListValue& patch, base::DictionaryValue* dict) {
+  for (const auto& item : patch) {
+    const base::DictionaryValue* operation = nullptr;
+    if (!item->GetAsDictionary(&operation) || !ApplyOperation(*operation, dict))
+      return false;
+  }
+  return true;
+}
+
+}  // namespace json_patch
+}  // namespace weaved
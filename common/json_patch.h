@@ -0,0 +1,42 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COMMON_JSON_PATCH_H_
+#define COMMON_JSON_PATCH_H_
+
+#include <memory>
+
+#include <base/values.h>
+
+namespace weaved {
+namespace json_patch {
+
+// Computes the changes needed to turn |from| into |to| as a list of
+// JSON Patch (RFC 6902) style operations. Each operation is a dictionary
+// with an "op" ("add", "remove" or "replace"), a JSON Pointer (RFC 6901)
+// "path" and, except for "remove", the new "value". Dictionaries are
+// compared recursively, any other changed value (including lists) is
+// replaced as a whole.
+std::unique_ptr<base::ListValue> CreatePatch(const base::DictionaryValue& from,
+                                             const base::DictionaryValue& to);
+
+// Applies a |patch| created by CreatePatch() to |dict|. Returns false if the
+// patch is malformed or does not match |dict|, in which case |dict| may have
+// been partially modified and should be re-fetched.
+bool ApplyPatch(const base::ListValue& patch, base::DictionaryValue* dict);
+
+}  // namespace json_patch
+}  // namespace weaved
+
+#endif  // COMMON_JSON_PATCH_H_
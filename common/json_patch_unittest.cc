@@ -0,0 +1,73 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "common/json_patch.h"
+
+#include <gtest/gtest.h>
+#include <weave/test/unittest_utils.h>
+
+namespace weaved {
+namespace json_patch {
+
+using weave::test::CreateDictionaryValue;
+using weave::test::CreateValue;
+using weave::test::IsEqualValue;
+
+TEST(JsonPatchTest, NoChanges) {
+  auto dict = CreateDictionaryValue("{'a': {'b': [1, 2]}, 'c': 'd'}");
+  EXPECT_TRUE(CreatePatch(*dict, *dict)->empty());
+}
+
+TEST(JsonPatchTest, CreatePatch) {
+  auto from = CreateDictionaryValue(R"({
+    'comp': {'state': {'t': {'p1': 1, 'p2': [1], 'p3': 'x'}}},
+    'gone': true
+  })");
+  auto to = CreateDictionaryValue(R"({
+    'comp': {'state': {'t': {'p1': 2, 'p2': [1, 2], 'p4': {'x/y~': 1}}}},
+    'new': null
+  })");
+  auto expected = CreateValue(R"([
+    {'op': 'replace', 'path': '/comp/state/t/p1', 'value': 2},
+    {'op': 'replace', 'path': '/comp/state/t/p2', 'value': [1, 2]},
+    {'op': 'remove', 'path': '/comp/state/t/p3'},
+    {'op': 'add', 'path': '/comp/state/t/p4', 'value': {'x/y~': 1}},
+    {'op': 'remove', 'path': '/gone'},
+    {'op': 'add', 'path': '/new', 'value': null}
+  ])");
+  EXPECT_TRUE(IsEqualValue(*expected, *CreatePatch(*from, *to)));
+}
+
+TEST(JsonPatchTest, ApplyPatch) {
+  auto from = CreateDictionaryValue(R"({
+    'comp': {'state': {'t': {'p1': 1, 'a/b': 'x', 'c~d': 'y'}}}
+  })");
+  auto to = CreateDictionaryValue(R"({
+    'comp': {'state': {'t': {'p1': 2, 'a/b': 'z'}}, 'traits': ['t']}
+  })");
+  auto patch = CreatePatch(*from, *to);
+  EXPECT_TRUE(ApplyPatch(*patch, from.get()));
+  EXPECT_TRUE(IsEqualValue(*to, *from));
+}
+
+TEST(JsonPatchTest, ApplyPatchMismatch) {
+  auto dict = CreateDictionaryValue("{'a': 1}");
+  auto patch = CreateValue("[{'op': 'replace', 'path': '/b/c', 'value': 1}]");
+  const base::ListValue* list = nullptr;
+  ASSERT_TRUE(patch->GetAsList(&list));
+  EXPECT_FALSE(ApplyPatch(*list, dict.get()));
+}
+
+}  // namespace json_patch
+}  // namespace weaved
@@ -0,0 +1,238 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "common/parcelable_dictionary.h"
+
+#include <string>
+
+#include <base/logging.h>
+
+#include "common/binder_utils.h"
+
+using weaved::binder_utils::ReadUtf8String;
+using weaved::binder_utils::WriteUtf8String;
+
+namespace android {
+namespace weave {
+
+namespace {
+
+// Value type tags used on the wire. These are deliberately independent of
+// base::Value::Type so that the parcel format does not change along with
+// libchrome.
+enum ValueTag : int32_t {
+  kNull = 0,
+  kBoolean = 1,
+  kInteger = 2,
+  kDouble = 3,
+  kString = 4,
+  kList = 5,
+  kDictionary = 6,
+};
+
+// Guards against stack exhaustion when reading malformed parcels.
+const int kMaxNestingDepth = 64;
+
+status_t WriteValue(Parcel* parcel, const base::Value& value);
+
+status_t WriteDictionary(Parcel* parcel, const base::DictionaryValue& dict) {
+  status_t status = parcel->writeInt32(static_cast<int32_t>(dict.size()));
+  for (base::DictionaryValue::Iterator it(dict);
+       status == OK && !it.IsAtEnd(); it.Advance()) {
+    status = WriteUtf8String(parcel, it.key());
+    if (status == OK)
+      status = WriteValue(parcel, it.value());
+  }
+  return status;
+}
+
+status_t WriteValue(Parcel* parcel, const base::Value& value) {
+  switch (value.GetType()) {
+    case base::Value::TYPE_NULL:
+      return parcel->writeInt32(kNull);
+    case base::Value::TYPE_BOOLEAN: {
+      bool bool_value = false;
+      CHECK(value.GetAsBoolean(&bool_value));
+      status_t status = parcel->writeInt32(kBoolean);
+      return status == OK ? parcel->writeInt32(bool_value ? 1 : 0) : status;
+    }
+    case base::Value::TYPE_INTEGER: {
+      int int_value = 0;
+      CHECK(value.GetAsInteger(&int_value));
+      status_t status = parcel->writeInt32(kInteger);
+      return status == OK ? parcel->writeInt32(int_value) : status;
+    }
+    case base::Value::TYPE_DOUBLE: {
+      double double_value = 0.0;
+      CHECK(value.GetAsDouble(&double_value));
+      status_t status = parcel->writeInt32(kDouble);
+      return status == OK ? parcel->writeDouble(double_value) : status;
+    }
+    case base::Value::TYPE_STRING: {
+      std::string string_value;
+      CHECK(value.GetAsString(&string_value));
+      status_t status = parcel->writeInt32(kString);
+      return status == OK ? WriteUtf8String(parcel, string_value) : status;
+    }
+    case base::Value::TYPE_LIST: {
+      const base::ListValue* list = nullptr;
+      CHECK(value.GetAsList(&list));
+      status_t status = parcel->writeInt32(kList);
+      if (status == OK)
+        status = parcel->writeInt32(static_cast<int32_t>(list->GetSize()));
+      for (auto it = list->begin(); status == OK && it != list->end(); ++it)
+        status = WriteValue(parcel, **it);
+      return status;
+    }
+    case base::Value::TYPE_DICTIONARY: {
+      const base::DictionaryValue* dict = nullptr;
+      CHECK(value.GetAsDictionary(&dict));
+      status_t status = parcel->writeInt32(kDictionary);
+      return status == OK ? WriteDictionary(parcel, *dict) : status;
+    }
+    default:
+      LOG(ERROR) << "Unsupported value type: " << value.GetType();
+      return BAD_TYPE;
+  }
+}
+
+status_t ReadValue(const Parcel* parcel,
+                   int depth,
+                   std::unique_ptr<base::Value>* value);
+
+status_t ReadDictionary(const Parcel* parcel,
+                        int depth,
+                        base::DictionaryValue* dict) {
+  if (depth > kMaxNestingDepth)
+    return BAD_VALUE;
+  int32_t size = 0;
+  status_t status = parcel->readInt32(&size);
+  if (status == OK && size < 0)
+    status = BAD_VALUE;
+  for (int32_t i = 0; status == OK && i < size; i++) {
+    std::string key;
+    std::unique_ptr<base::Value> item;
+    status = ReadUtf8String(parcel, &key);
+    if (status == OK)
+      status = ReadValue(parcel, depth + 1, &item);
+    if (status == OK)
+      dict->SetWithoutPathExpansion(key, item.release());
+  }
+  return status;
+}
+
+status_t ReadValue(const Parcel* parcel,
+                   int depth,
+                   std::unique_ptr<base::Value>* value) {
+  if (depth > kMaxNestingDepth)
+    return BAD_VALUE;
+  int32_t tag = 0;
+  status_t status = parcel->readInt32(&tag);
+  if (status != OK)
+    return status;
+  switch (tag) {
+    case kNull:
+      value->reset(base::Value::CreateNullValue().release());
+      return OK;
+    case kBoolean: {
+      int32_t bool_value = 0;
+      status = parcel->readInt32(&bool_value);
+      if (status == OK)
+        value->reset(new base::FundamentalValue(bool_value != 0));
+      return status;
+    }
+    case kInteger: {
+      int32_t int_value = 0;
+      status = parcel->readInt32(&int_value);
+      if (status == OK)
+        value->reset(new base::FundamentalValue(int_value));
+      return status;
+    }
+    case kDouble: {
+      double double_value = 0.0;
+      status = parcel->readDouble(&double_value);
+      if (status == OK)
+        value->reset(new base::FundamentalValue(double_value));
+      return status;
+    }
+    case kString: {
+      std::string string_value;
+      status = ReadUtf8String(parcel, &string_value);
+      if (status == OK)
+        value->reset(new base::StringValue(string_value));
+      return status;
+    }
+    case kList: {
+      int32_t size = 0;
+      status = parcel->readInt32(&size);
+      if (status == OK && size < 0)
+        status = BAD_VALUE;
+      std::unique_ptr<base::ListValue> list{new base::ListValue};
+      for (int32_t i = 0; status == OK && i < size; i++) {
+        std::unique_ptr<base::Value> item;
+        status = ReadValue(parcel, depth + 1, &item);
+        if (status == OK)
+          list->Append(item.release());
+      }
+      if (status == OK)
+        value->reset(list.release());
+      return status;
+    }
+    case kDictionary: {
+      std::unique_ptr<base::DictionaryValue> dict{new base::DictionaryValue};
+      status = ReadDictionary(parcel, depth, dict.get());
+      if (status == OK)
+        value->reset(dict.release());
+      return status;
+    }
+  }
+  LOG(ERROR) << "Unexpected value type tag in parcel: " << tag;
+  return BAD_TYPE;
+}
+
+}  // anonymous namespace
+
+ParcelableDictionary::ParcelableDictionary()
+    : owned_dict_{new base::DictionaryValue}, dict_{owned_dict_.get()} {}
+
+ParcelableDictionary::ParcelableDictionary(const base::DictionaryValue* dict)
+    : dict_{dict} {}
+
+ParcelableDictionary::~ParcelableDictionary() {}
+
+base::DictionaryValue* ParcelableDictionary::mutable_dict() {
+  CHECK(owned_dict_) << "The dictionary is not owned by this object";
+  return owned_dict_.get();
+}
+
+std::unique_ptr<base::DictionaryValue> ParcelableDictionary::ReleaseDict() {
+  CHECK(owned_dict_) << "The dictionary is not owned by this object";
+  std::unique_ptr<base::DictionaryValue> dict = std::move(owned_dict_);
+  owned_dict_.reset(new base::DictionaryValue);
+  dict_ = owned_dict_.get();
+  return dict;
+}
+
+status_t ParcelableDictionary::writeToParcel(Parcel* parcel) const {
+  return WriteDictionary(parcel, *dict_);
+}
+
+status_t ParcelableDictionary::readFromParcel(const Parcel* parcel) {
+  owned_dict_.reset(new base::DictionaryValue);
+  dict_ = owned_dict_.get();
+  return ReadDictionary(parcel, 0, owned_dict_.get());
+}
+
+}  // namespace weave
+}  // namespace android
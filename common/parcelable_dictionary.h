@@ -0,0 +1,66 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COMMON_PARCELABLE_DICTIONARY_H_
+#define COMMON_PARCELABLE_DICTIONARY_H_
+
+#include <memory>
+
+#include <base/macros.h>
+#include <base/values.h>
+#include <binder/Parcel.h>
+#include <binder/Parcelable.h>
+
+namespace android {
+namespace weave {
+
+// A binder-transferable wrapper around base::DictionaryValue.
+// Unlike the JSON strings used elsewhere in the weave binder interfaces, the
+// dictionary is written to the parcel in a typed binary form (null, boolean,
+// integer, double, UTF-8 string, list and nested dictionary values), so
+// neither side has to serialize, transcode or parse JSON text.
+class ParcelableDictionary : public Parcelable {
+ public:
+  // Creates an empty dictionary. Used by binder when reading from a parcel.
+  ParcelableDictionary();
+  // Wraps an existing |dict| for writing it into a parcel without making a
+  // copy. The caller retains ownership of |dict| and it must outlive this
+  // object.
+  explicit ParcelableDictionary(const base::DictionaryValue* dict);
+  ~ParcelableDictionary() override;
+
+  // Parcelable implementation.
+  status_t writeToParcel(Parcel* parcel) const override;
+  status_t readFromParcel(const Parcel* parcel) override;
+
+  const base::DictionaryValue& dict() const { return *dict_; }
+  // Returns the owned dictionary for filling it in, e.g. in a binder method
+  // returning a ParcelableDictionary.
+  base::DictionaryValue* mutable_dict();
+
+  // Transfers the dictionary read by readFromParcel() to the caller, leaving
+  // this object with an empty one.
+  std::unique_ptr<base::DictionaryValue> ReleaseDict();
+
+ private:
+  std::unique_ptr<base::DictionaryValue> owned_dict_;
+  const base::DictionaryValue* dict_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParcelableDictionary);
+};
+
+}  // namespace weave
+}  // namespace android
+
+#endif  // COMMON_PARCELABLE_DICTIONARY_H_
@@ -0,0 +1,78 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "common/parcelable_dictionary.h"
+
+#include <gtest/gtest.h>
+#include <weave/test/unittest_utils.h>
+
+namespace android {
+namespace weave {
+
+using ::weave::test::CreateDictionaryValue;
+using ::weave::test::IsEqualValue;
+
+namespace {
+
+std::unique_ptr<base::DictionaryValue> RoundTrip(
+    const base::DictionaryValue& dict) {
+  Parcel parcel;
+  EXPECT_EQ(OK, ParcelableDictionary{&dict}.writeToParcel(&parcel));
+  parcel.setDataPosition(0);
+  ParcelableDictionary result;
+  EXPECT_EQ(OK, result.readFromParcel(&parcel));
+  return std::unique_ptr<base::DictionaryValue>{result.dict().DeepCopy()};
+}
+
+}  // anonymous namespace
+
+TEST(ParcelableDictionaryTest, Empty) {
+  base::DictionaryValue dict;
+  EXPECT_TRUE(IsEqualValue(dict, *RoundTrip(dict)));
+}
+
+TEST(ParcelableDictionaryTest, AllTypes) {
+  auto dict = CreateDictionaryValue(R"({
+    'null': null,
+    'bool': true,
+    'int': -42,
+    'double': 2.5,
+    'string': 'café',
+    'list': [1, 'two', [3], {'four': 4}],
+    'trait': {'nested': {'prop': false}}
+  })");
+  EXPECT_TRUE(IsEqualValue(*dict, *RoundTrip(*dict)));
+}
+
+TEST(ParcelableDictionaryTest, KeysWithDots) {
+  base::DictionaryValue dict;
+  dict.SetWithoutPathExpansion("trait.prop", new base::FundamentalValue(1));
+  auto result = RoundTrip(dict);
+  int value = 0;
+  EXPECT_TRUE(result->GetIntegerWithoutPathExpansion("trait.prop", &value));
+  EXPECT_EQ(1, value);
+}
+
+TEST(ParcelableDictionaryTest, Truncated) {
+  auto dict = CreateDictionaryValue("{'string': 'value', 'int': 1}");
+  Parcel parcel;
+  EXPECT_EQ(OK, ParcelableDictionary{dict.get()}.writeToParcel(&parcel));
+  parcel.setDataSize(parcel.dataSize() - sizeof(int32_t));
+  parcel.setDataPosition(0);
+  ParcelableDictionary result;
+  EXPECT_NE(OK, result.readFromParcel(&parcel));
+}
+
+}  // namespace weave
+}  // namespace android
@@ -0,0 +1,46 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "common/versioned_json.h"
+
+#include "common/binder_utils.h"
+
+using weaved::binder_utils::ReadUtf8String;
+using weaved::binder_utils::WriteUtf8String;
+
+namespace android {
+namespace weave {
+
+status_t VersionedJson::writeToParcel(Parcel* parcel) const {
+  status_t status = parcel->writeInt64(version);
+  if (status == OK)
+    status = parcel->writeInt32(changed ? 1 : 0);
+  if (status == OK)
+    status = WriteUtf8String(parcel, json);
+  return status;
+}
+
+status_t VersionedJson::readFromParcel(const Parcel* parcel) {
+  status_t status = parcel->readInt64(&version);
+  int32_t changed_value = 0;
+  if (status == OK)
+    status = parcel->readInt32(&changed_value);
+  changed = (changed_value != 0);
+  if (status == OK)
+    status = ReadUtf8String(parcel, &json);
+  return status;
+}
+
+}  // namespace weave
+}  // namespace android
@@ -0,0 +1,49 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COMMON_VERSIONED_JSON_H_
+#define COMMON_VERSIONED_JSON_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include <binder/Parcel.h>
+#include <binder/Parcelable.h>
+
+namespace android {
+namespace weave {
+
+// A JSON document tagged with the version of the data it was serialized from,
+// returned by the IWeaveServiceManager::get*IfChanged() methods. If the
+// caller already has the current |version|, |changed| is false and |json| is
+// left empty. |json| is sent as UTF-8.
+class VersionedJson : public Parcelable {
+ public:
+  VersionedJson() = default;
+  ~VersionedJson() override = default;
+
+  // Parcelable implementation.
+  status_t writeToParcel(Parcel* parcel) const override;
+  status_t readFromParcel(const Parcel* parcel) override;
+
+  int64_t version{0};
+  bool changed{false};
+  std::string json;
+};
+
+}  // namespace weave
+}  // namespace android
+
+#endif  // COMMON_VERSIONED_JSON_H_
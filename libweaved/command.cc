@@ -14,11 +14,14 @@
 
 #include "libweaved/command.h"
 
+#include <vector>
+
 #include "android/weave/IWeaveCommand.h"
 #include "common/binder_utils.h"
+#include "common/command_snapshot.h"
+#include "common/parcelable_dictionary.h"
 
 using weaved::binder_utils::ParseDictionary;
-using weaved::binder_utils::ToString;
 using weaved::binder_utils::ToString16;
 using weaved::binder_utils::StatusToError;
 
@@ -58,34 +61,19 @@ Command::Command(const android::sp<android::weave::IWeaveCommand>& proxy)
 Command::~Command() {}
 
 std::string Command::GetID() const {
-  std::string id;
-  android::String16 id16;
-  if (binder_proxy_->getId(&id16).isOk())
-    id.assign(ToString(id16));
-  return id;
+  return GetSnapshot().id;
 }
 
 std::string Command::GetName() const {
-  std::string name;
-  android::String16 name16;
-  if (binder_proxy_->getId(&name16).isOk())
-    name.assign(ToString(name16));
-  return name;
+  return GetSnapshot().name;
 }
 
 std::string Command::GetComponent() const {
-  std::string component;
-  android::String16 component16;
-  if (binder_proxy_->getId(&component16).isOk())
-    component.assign(ToString(component16));
-  return component;
+  return GetSnapshot().component;
 }
 
 Command::State Command::GetState() const {
-  std::string state;
-  android::String16 state16;
-  if (binder_proxy_->getState(&state16).isOk())
-    state.assign(ToString(state16));
+  const std::string& state = GetSnapshot().state;
   if (state == "queued")
     return Command::State::kQueued;
   else if (state == "inProgress")
@@ -107,10 +95,7 @@ Command::State Command::GetState() const {
 }
 
 Command::Origin Command::GetOrigin() const {
-  std::string origin;
-  android::String16 origin16;
-  if (binder_proxy_->getState(&origin16).isOk())
-    origin.assign(ToString(origin16));
+  const std::string& origin = GetSnapshot().origin;
   if (origin == "local")
     return Command::Origin::kLocal;
   else if (origin == "cloud")
@@ -120,29 +105,97 @@ Command::Origin Command::GetOrigin() const {
 }
 
 const base::DictionaryValue& Command::GetParameters() const {
-  if (!parameter_cache_) {
-    android::String16 params_string16;
-    if (!binder_proxy_->getParameters(&params_string16).isOk() ||
-        !ParseDictionary(params_string16, &parameter_cache_).isOk()) {
-      parameter_cache_.reset(new base::DictionaryValue);
-    }
+  if (parameter_cache_)
+    return *parameter_cache_;
+  return GetCachedDictionary(GetSnapshot().parameters, &parameter_cache_);
+}
+
+const base::DictionaryValue& Command::GetProgress() const {
+  if (progress_cache_)
+    return *progress_cache_;
+  return GetCachedDictionary(GetSnapshot().progress, &progress_cache_);
+}
+
+const base::DictionaryValue& Command::GetResults() const {
+  if (results_cache_)
+    return *results_cache_;
+  return GetCachedDictionary(GetSnapshot().results, &results_cache_);
+}
+
+const base::DictionaryValue& Command::GetCachedDictionary(
+    const std::string& json,
+    std::unique_ptr<base::DictionaryValue>* cache) const {
+  // Nothing is cached from a failed snapshot retrieval, so that the next call
+  // tries again.
+  if (!snapshot_)
+    return empty_dictionary_;
+  if (!ParseDictionary(json, cache).isOk())
+    cache->reset(new base::DictionaryValue);
+  return **cache;
+}
+
+const android::weave::CommandSnapshot& Command::GetSnapshot() const {
+  if (snapshot_)
+    return *snapshot_;
+  std::unique_ptr<android::weave::CommandSnapshot> snapshot{
+      new android::weave::CommandSnapshot};
+  if (!binder_proxy_->getSnapshot(snapshot.get()).isOk()) {
+    LOG(WARNING) << "Failed to retrieve weave command properties";
+    if (!empty_snapshot_)
+      empty_snapshot_.reset(new android::weave::CommandSnapshot);
+    return *empty_snapshot_;
   }
-  return *parameter_cache_;
+  snapshot_ = std::move(snapshot);
+  return *snapshot_;
 }
 
 bool Command::SetProgress(const base::DictionaryValue& progress,
                           brillo::ErrorPtr* error) {
-  return StatusToError(binder_proxy_->setProgress(ToString16(progress)), error);
+  android::binder::Status status;
+  if (!progress_cache_) {
+    // The current progress is unknown, send all of it.
+    status = binder_proxy_->setProgress(ToString16(progress));
+  } else {
+    base::DictionaryValue changed;
+    std::vector<android::String16> removed;
+    for (base::DictionaryValue::Iterator it(progress); !it.IsAtEnd();
+         it.Advance()) {
+      const base::Value* value = nullptr;
+      if (!progress_cache_->GetWithoutPathExpansion(it.key(), &value) ||
+          !it.value().Equals(value)) {
+        changed.SetWithoutPathExpansion(it.key(), it.value().DeepCopy());
+      }
+    }
+    for (base::DictionaryValue::Iterator it(*progress_cache_); !it.IsAtEnd();
+         it.Advance()) {
+      if (!progress.HasKey(it.key()))
+        removed.push_back(ToString16(it.key()));
+    }
+    // The call is made even if nothing changed, since it also resumes a
+    // paused command.
+    status = binder_proxy_->updateProgress(
+        android::weave::ParcelableDictionary{&changed}, removed);
+  }
+  snapshot_.reset();
+  if (!StatusToError(status, error))
+    return false;
+  progress_cache_.reset(progress.DeepCopy());
+  return true;
 }
 
 bool Command::Complete(const base::DictionaryValue& results,
                        brillo::ErrorPtr* error) {
-  return StatusToError(binder_proxy_->complete(ToString16(results)), error);
+  snapshot_.reset();
+  if (!StatusToError(binder_proxy_->complete(ToString16(results)), error))
+    return false;
+  results_cache_.reset(results.DeepCopy());
+  return true;
 }
 
 bool Command::Abort(const std::string& error_code,
                     const std::string& error_message,
                     brillo::ErrorPtr* error) {
+  snapshot_.reset();
   return StatusToError(binder_proxy_->abort(ToString16(error_code),
                                             ToString16(error_message)),
                        error);
@@ -161,16 +214,19 @@ bool Command::AbortWithCustomError(android::binder::Status status,
 }
 
 bool Command::Cancel(brillo::ErrorPtr* error) {
+  snapshot_.reset();
   return StatusToError(binder_proxy_->cancel(), error);
 }
 
 bool Command::Pause(brillo::ErrorPtr* error) {
+  snapshot_.reset();
   return StatusToError(binder_proxy_->pause(), error);
 }
 
 bool Command::SetError(const std::string& error_code,
                        const std::string& error_message,
                        brillo::ErrorPtr* error) {
+  snapshot_.reset();
   return StatusToError(binder_proxy_->setError(ToString16(error_code),
                                                ToString16(error_message)),
                        error);
@@ -15,9 +15,11 @@
 #ifndef LIBWEAVED_COMMAND_H_
 #define LIBWEAVED_COMMAND_H_
 
+#include <memory>
 #include <string>
 
 #include <base/macros.h>
+#include <base/values.h>
 #include <binder/Status.h>
 #include <brillo/errors/error.h>
 #include <brillo/value_conversion.h>
@@ -26,6 +28,7 @@
 
 namespace android {
 namespace weave {
+class CommandSnapshot;
 class IWeaveCommand;
 }  // namespace weave
 }  // namespace android
@@ -51,6 +54,13 @@ class LIBWEAVED_EXPORT Command final {
 
   ~Command();
 
+  // The command properties below are fetched from weaved in a single binder
+  // call the first time any of them is accessed and are cached afterwards.
+  // The cached copy is discarded (and re-fetched on next access) after each
+  // call that modifies the command, such as SetProgress() or Complete().
+  // The parameters, progress and results are kept across these calls, as
+  // only this client changes them.
+
   // Returns the full command ID.
   std::string GetID() const;
 
@@ -75,16 +85,29 @@ class LIBWEAVED_EXPORT Command final {
   // is of incorrect type.
   template <typename T>
   T GetParameter(const std::string& name) const {
-    const base::DictionaryValue& parameters = GetParameters();
-    T param_value{};
-    const base::Value* value = nullptr;
-    if (parameters.Get(name, &value))
-      brillo::FromValue(*value, &param_value);
-    return param_value;
+    return GetValue<T>(GetParameters(), name);
+  }
+
+  // Returns the command progress, as last set by SetProgress().
+  const base::DictionaryValue& GetProgress() const;
+
+  // Returns the command results, as set by Complete().
+  const base::DictionaryValue& GetResults() const;
+
+  // Helper functions to get a progress or result property of type T, similar
+  // to GetParameter().
+  template <typename T>
+  T GetProgressValue(const std::string& name) const {
+    return GetValue<T>(GetProgress(), name);
+  }
+  template <typename T>
+  T GetResult(const std::string& name) const {
+    return GetValue<T>(GetResults(), name);
   }
 
   // Updates the command progress. The |progress| should match the schema.
-  // Returns false if |progress| value is incorrect.
+  // Returns false if |progress| value is incorrect. Only the properties that
+  // differ from the current progress are sent to weaved.
   bool SetProgress(const base::DictionaryValue& progress,
                    brillo::ErrorPtr* error);
 
@@ -140,9 +163,43 @@ class LIBWEAVED_EXPORT Command final {
   explicit Command(const android::sp<android::weave::IWeaveCommand>& proxy);
 
  private:
+  friend class CommandTest;
   friend class ServiceImpl;
+
+  // Returns the value of property |name| of |dict| as type T, or the default
+  // value for T if the property is missing or is of a different type.
+  template <typename T>
+  static T GetValue(const base::DictionaryValue& dict,
+                    const std::string& name) {
+    T result{};
+    const base::Value* value = nullptr;
+    if (dict.Get(name, &value))
+      brillo::FromValue(*value, &result);
+    return result;
+  }
+
+  // Returns the cached snapshot of the command properties, retrieving it from
+  // weaved if necessary. Returns an empty snapshot, which is not cached, if
+  // weaved can't be reached.
+  const android::weave::CommandSnapshot& GetSnapshot() const;
+
+  // Returns the dictionary in |cache|, parsing it from the snapshot |json|
+  // first if necessary. Returns an empty dictionary without caching it if
+  // there is no snapshot.
+  const base::DictionaryValue& GetCachedDictionary(
+      const std::string& json,
+      std::unique_ptr<base::DictionaryValue>* cache) const;
+
   android::sp<android::weave::IWeaveCommand> binder_proxy_;
+  mutable std::unique_ptr<android::weave::CommandSnapshot> snapshot_;
+  // Returned by GetSnapshot() when the retrieval fails. Never modified, so
+  // references to it stay valid.
+  mutable std::unique_ptr<android::weave::CommandSnapshot> empty_snapshot_;
+  const base::DictionaryValue empty_dictionary_;
   mutable std::unique_ptr<base::DictionaryValue> parameter_cache_;
+  // Local mirrors of the command progress and results.
+  mutable std::unique_ptr<base::DictionaryValue> progress_cache_;
+  mutable std::unique_ptr<base::DictionaryValue> results_cache_;
 
   DISALLOW_COPY_AND_ASSIGN(Command);
 };
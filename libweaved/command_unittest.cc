@@ -0,0 +1,227 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "libweaved/command.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <brillo/errors/error.h>
+#include <gtest/gtest.h>
+#include <weave/test/unittest_utils.h>
+
+#include "android/weave/BnWeaveCommand.h"
+#include "common/binder_utils.h"
+#include "common/command_snapshot.h"
+#include "common/parcelable_dictionary.h"
+
+using weave::test::CreateDictionaryValue;
+using weaved::binder_utils::ToJson;
+using weaved::binder_utils::ToString;
+
+namespace weaved {
+
+namespace {
+
+// Serves a fixed snapshot and records the updates made by the client.
+class FakeWeaveCommand : public android::weave::BnWeaveCommand {
+ public:
+  android::binder::Status getId(android::String16* id) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getName(android::String16* name) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getComponent(
+      android::String16* component) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getState(android::String16* state) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getOrigin(android::String16* origin) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getParameters(
+      android::String16* parameters) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getProgress(android::String16* progress) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getResults(android::String16* results) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getSnapshot(
+      android::weave::CommandSnapshot* snapshot) override {
+    snapshot_calls++;
+    if (fail) return Error();
+    *snapshot = this->snapshot;
+    return android::binder::Status::ok();
+  }
+  android::binder::Status setProgress(
+      const android::String16& progress) override {
+    updates.push_back("set " + ToString(progress));
+    return fail ? Error() : android::binder::Status::ok();
+  }
+  android::binder::Status updateProgress(
+      const android::weave::ParcelableDictionary& changed,
+      const std::vector<android::String16>& removed) override {
+    std::string update = "update " + ToJson(changed.dict());
+    for (const android::String16& name : removed)
+      update += " -" + ToString(name);
+    updates.push_back(update);
+    return fail ? Error() : android::binder::Status::ok();
+  }
+  android::binder::Status complete(const android::String16& results) override {
+    updates.push_back("complete " + ToString(results));
+    return fail ? Error() : android::binder::Status::ok();
+  }
+  android::binder::Status abort(
+      const android::String16& errorCode,
+      const android::String16& errorMessage) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status cancel() override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status pause() override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status setError(
+      const android::String16& errorCode,
+      const android::String16& errorMessage) override {
+    return android::binder::Status::ok();
+  }
+
+  android::weave::CommandSnapshot snapshot;
+  int snapshot_calls{0};
+  // The progress and results updates, in order.
+  std::vector<std::string> updates;
+  // Makes all the calls above fail.
+  bool fail{false};
+
+ private:
+  static android::binder::Status Error() {
+    return android::binder::Status::fromServiceSpecificError(
+        1, android::String8{"Command is gone"});
+  }
+};
+
+}  // anonymous namespace
+
+class CommandTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    proxy_ = new FakeWeaveCommand;
+    proxy_->snapshot.id = "1234";
+    proxy_->snapshot.name = "robot.jump";
+    proxy_->snapshot.component = "myComponent";
+    proxy_->snapshot.state = "inProgress";
+    proxy_->snapshot.origin = "cloud";
+    proxy_->snapshot.parameters = R"({"height":53})";
+    proxy_->snapshot.progress = "{}";
+    proxy_->snapshot.results = "{}";
+  }
+
+  // Command's constructor is only accessible to friends.
+  std::unique_ptr<Command> CreateCommand() {
+    return std::unique_ptr<Command>{new Command{proxy_}};
+  }
+
+  android::sp<FakeWeaveCommand> proxy_;
+};
+
+TEST_F(CommandTest, PropertiesAreFetchedOnce) {
+  auto command = CreateCommand();
+  EXPECT_EQ("1234", command->GetID());
+  EXPECT_EQ("robot.jump", command->GetName());
+  EXPECT_EQ("myComponent", command->GetComponent());
+  EXPECT_EQ(Command::State::kInProgress, command->GetState());
+  EXPECT_EQ(Command::Origin::kCloud, command->GetOrigin());
+  EXPECT_EQ(53, command->GetParameter<int>("height"));
+  EXPECT_EQ(1, proxy_->snapshot_calls);
+
+  // Changing the command discards the snapshot, but not the parameters.
+  EXPECT_TRUE(command->Pause(nullptr));
+  proxy_->snapshot.state = "paused";
+  EXPECT_EQ(53, command->GetParameter<int>("height"));
+  EXPECT_EQ(1, proxy_->snapshot_calls);
+  EXPECT_EQ(Command::State::kPaused, command->GetState());
+  EXPECT_EQ(2, proxy_->snapshot_calls);
+}
+
+TEST_F(CommandTest, FailedSnapshotIsRetried) {
+  auto command = CreateCommand();
+  proxy_->fail = true;
+  EXPECT_EQ("", command->GetID());
+  EXPECT_TRUE(command->GetParameters().empty());
+
+  proxy_->fail = false;
+  EXPECT_EQ("1234", command->GetID());
+  EXPECT_EQ(53, command->GetParameter<int>("height"));
+}
+
+TEST_F(CommandTest, SetProgressSendsDifference) {
+  auto command = CreateCommand();
+  // The current progress is not known yet, so all of it is sent.
+  EXPECT_TRUE(command->SetProgress(
+      *CreateDictionaryValue("{'done': 10, 'step': 'download'}"), nullptr));
+  EXPECT_TRUE(command->SetProgress(
+      *CreateDictionaryValue("{'done': 20, 'step': 'download'}"), nullptr));
+  EXPECT_TRUE(command->SetProgress(
+      *CreateDictionaryValue("{'done': 20, 'eta': 5}"), nullptr));
+  EXPECT_EQ((std::vector<std::string>{
+                R"(set {"done":10,"step":"download"})",
+                R"(update {"done":20})",
+                R"(update {"eta":5} -step)"}),
+            proxy_->updates);
+
+  // The progress is mirrored locally.
+  EXPECT_EQ(20, command->GetProgressValue<int>("done"));
+  EXPECT_EQ(5, command->GetProgressValue<int>("eta"));
+  EXPECT_EQ(0, proxy_->snapshot_calls);
+}
+
+TEST_F(CommandTest, SetProgressStartsFromFetchedProgress) {
+  proxy_->snapshot.progress = R"({"done":10})";
+  auto command = CreateCommand();
+  EXPECT_EQ(10, command->GetProgressValue<int>("done"));
+  EXPECT_TRUE(command->SetProgress(
+      *CreateDictionaryValue("{'done': 10, 'eta': 5}"), nullptr));
+  EXPECT_EQ(std::vector<std::string>{R"(update {"eta":5})"},
+            proxy_->updates);
+}
+
+TEST_F(CommandTest, FailedUpdatesAreNotMirrored) {
+  auto command = CreateCommand();
+  EXPECT_TRUE(command->SetProgress(*CreateDictionaryValue("{'done': 10}"),
+                                   nullptr));
+  proxy_->fail = true;
+  brillo::ErrorPtr error;
+  EXPECT_FALSE(command->SetProgress(*CreateDictionaryValue("{'done': 20}"),
+                                    &error));
+  EXPECT_NE(nullptr, error.get());
+  EXPECT_EQ(10, command->GetProgressValue<int>("done"));
+  EXPECT_FALSE(
+      command->Complete(*CreateDictionaryValue("{'height': 53}"), nullptr));
+
+  proxy_->fail = false;
+  EXPECT_TRUE(
+      command->Complete(*CreateDictionaryValue("{'height': 53}"), nullptr));
+  EXPECT_EQ(53, command->GetResult<int>("height"));
+}
+
+}  // namespace weaved
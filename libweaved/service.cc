@@ -15,9 +15,13 @@
 #include "libweaved/service.h"
 
 #include <algorithm>
+#include <map>
+#include <utility>
+#include <unordered_map>
 
 #include <base/bind.h>
 #include <base/memory/weak_ptr.h>
+#include <base/rand_util.h>
 #include <base/strings/stringprintf.h>
 #include <binderwrapper/binder_wrapper.h>
 #include <brillo/message_loops/message_loop.h>
@@ -29,6 +33,7 @@
 #include "android/weave/IWeaveServiceManager.h"
 #include "common/binder_constants.h"
 #include "common/binder_utils.h"
+#include "common/parcelable_dictionary.h"
 
 using weaved::binder_utils::StatusToError;
 using weaved::binder_utils::ToString;
@@ -80,13 +85,97 @@ using weaved::binder_utils::ToString16;
 // is started as if the client just invoked Service::Connect() again on the new
 // instance of ServiceImpl.
 
+// The components, command handlers and state the client registers are recorded
+// in a RegistrationJournal owned by ServiceSubscription. When the connection is
+// re-established, the journal is replayed before the client callback is
+// invoked, and the client's own repeated registrations become no-ops.
+
 namespace weaved {
 
 namespace {
+
+// Delays between attempts to connect to weaved. The delay doubles after each
+// failed attempt, up to the maximum. The first retries are short so that a
+// restarted weaved is picked up almost immediately.
+const int kInitialConnectRetryDelayMs = 5;
+const int kMaxConnectRetryDelayMs = 1000;
+
+// Returns the number of individual property values in a state dictionary.
+size_t CountStateProperties(const base::DictionaryValue& dict) {
+  size_t count = 0;
+  for (base::DictionaryValue::Iterator it(dict); !it.IsAtEnd(); it.Advance()) {
+    const base::DictionaryValue* child = nullptr;
+    if (it.value().GetAsDictionary(&child))
+      count += CountStateProperties(*child);
+    else
+      count++;
+  }
+  return count;
+}
+
+// Converts a list of UTF-8 strings to a list of String16.
+std::vector<android::String16> ToString16List(
+    const std::vector<std::string>& values) {
+  std::vector<android::String16> result;
+  result.reserve(values.size());
+  for (const std::string& value : values)
+    result.push_back(ToString16(value));
+  return result;
+}
+
+// Returns true if every property value in |dict| is already set to the same
+// value in |state|.
+bool ContainsState(const base::DictionaryValue& state,
+                   const base::DictionaryValue& dict) {
+  for (base::DictionaryValue::Iterator it(dict); !it.IsAtEnd(); it.Advance()) {
+    const base::Value* value = nullptr;
+    if (!state.GetWithoutPathExpansion(it.key(), &value))
+      return false;
+    const base::DictionaryValue* dict_child = nullptr;
+    const base::DictionaryValue* state_child = nullptr;
+    if (it.value().GetAsDictionary(&dict_child) &&
+        value->GetAsDictionary(&state_child)) {
+      if (!ContainsState(*state_child, *dict_child))
+        return false;
+    } else if (!it.value().Equals(value)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Everything a client has registered with weaved. The journal outlives the
+// individual connections, so that the registrations can be replayed when the
+// connection to weaved is re-established.
+struct RegistrationJournal {
+  // Components and their traits, in the order they were added.
+  std::vector<Service::ComponentTraits> components;
+
+  // Command handlers, keyed by component name and then by the full command
+  // name, or a "<trait>.*"/"*" wildcard for the default handlers.
+  using CommandHandlerMap =
+      std::unordered_map<std::string, Service::CommandHandlerCallback>;
+  std::unordered_map<std::string, CommandHandlerMap> command_handlers;
+
+  // The last known state of each component.
+  std::map<std::string, std::unique_ptr<base::DictionaryValue>> state;
+
+  // Returns the traits of |component|, or nullptr if it was not added yet.
+  const std::vector<std::string>* FindComponent(
+      const std::string& component) const {
+    for (const auto& pair : components) {
+      if (pair.first == component)
+        return &pair.second;
+    }
+    return nullptr;
+  }
+};
+
 // An implementation for service subscription. This object keeps a reference to
 // the actual instance of weaved service object. This is generally the only hard
 // reference to the shared pointer to the service object. The client receives
-// a weak pointer only.
+// a weak pointer only. The subscription also owns the registration journal
+// shared by the consecutive service instances.
 class ServiceSubscription : public Service::Subscription {
  public:
   ServiceSubscription() = default;
@@ -96,7 +185,11 @@ class ServiceSubscription : public Service::Subscription {
     service_ = service;
   }
 
+  RegistrationJournal* journal() { return &journal_; }
+
  private:
+  // |journal_| is declared first so that it outlives |service_|.
+  RegistrationJournal journal_;
   std::shared_ptr<Service> service_;
   DISALLOW_COPY_AND_ASSIGN(ServiceSubscription);
 };
@@ -148,6 +241,9 @@ class NotificationListener
   // Implementation for IWeaveServiceManagerNotificationListener interface.
   android::binder::Status notifyServiceManagerChange(
       const std::vector<int>& notificationIds) override;
+  android::binder::Status notifyServiceManagerValues(
+      const std::vector<int>& notificationIds,
+      const android::weave::ParcelableDictionary& values) override;
 
   std::weak_ptr<ServiceImpl> service_;
 
@@ -179,10 +275,16 @@ class ServiceImpl : public std::enable_shared_from_this<ServiceImpl>,
   bool AddComponent(const std::string& component,
                     const std::vector<std::string>& traits,
                     brillo::ErrorPtr* error) override;
+  bool AddComponents(const std::vector<ComponentTraits>& components,
+                     brillo::ErrorPtr* error) override;
   void AddCommandHandler(const std::string& component,
                          const std::string& trait_name,
                          const std::string& command_name,
                          const CommandHandlerCallback& callback) override;
+  void AddDefaultCommandHandler(
+      const std::string& component,
+      const std::string& trait_name,
+      const CommandHandlerCallback& callback) override;
   bool SetStateProperties(const std::string& component,
                           const base::DictionaryValue& dict,
                           brillo::ErrorPtr* error) override;
@@ -191,6 +293,9 @@ class ServiceImpl : public std::enable_shared_from_this<ServiceImpl>,
                         const std::string& property_name,
                         const base::Value& value,
                         brillo::ErrorPtr* error) override;
+  void SetStateCoalescing(base::TimeDelta flush_interval,
+                          size_t max_pending_properties) override;
+  bool Flush(brillo::ErrorPtr* error) override;
   void SetPairingInfoListener(const PairingInfoCallback& callback) override;
 
   // Helper method called from Service::Connect() to initiate binder connection
@@ -198,7 +303,8 @@ class ServiceImpl : public std::enable_shared_from_this<ServiceImpl>,
   // TryConnecting() method.
   void BeginConnect();
 
-  // A callback method for WeaveClient::onServiceConnected().
+  // A callback method for WeaveClient::onServiceConnected(). Replays the
+  // registration journal before invoking the client's connection callback.
   void OnServiceConnected(
       const android::sp<android::weave::IWeaveService>& service);
 
@@ -207,15 +313,24 @@ class ServiceImpl : public std::enable_shared_from_this<ServiceImpl>,
                  const std::string& command_name,
                  const android::sp<android::weave::IWeaveCommand>& command);
 
-  // A callback method for NotificationListener::notifyServiceManagerChange().
-  void OnNotification(const std::vector<int>& notification_ids);
+  // A callback method for NotificationListener. |values| are the new values
+  // sent with notifyServiceManagerValues(), or nullptr if they have to be
+  // fetched from the service manager.
+  void OnNotification(const std::vector<int>& notification_ids,
+                      const base::DictionaryValue* values);
 
  private:
   // Connects to weaved daemon over binder if the service manager is available
   // and weaved daemon itself is ready to accept connections. If not, schedules
-  // another retry after a delay (1 second).
+  // another retry with a jittered exponential backoff (see
+  // GetConnectRetryDelay()).
   void TryConnecting();
 
+  // Returns the delay before the next connection attempt and doubles the
+  // base delay for the attempt after it. The delay is randomized by +/-50%
+  // so that clients waiting for weaved do not wake up in lockstep.
+  base::TimeDelta GetConnectRetryDelay();
+
   // A callback for weaved connection termination. When binder service manager
   // notifies client of weaved binder object destruction (e.g. weaved quits),
   // this callback is invoked and initiates re-connection process.
@@ -229,6 +344,58 @@ class ServiceImpl : public std::enable_shared_from_this<ServiceImpl>,
   // the binder connection to the service.
   void ReconnectOnServiceDisconnection();
 
+  // Re-registers the components, command handlers and state recorded in the
+  // registration journal with a freshly connected weaved.
+  void ReplayJournal();
+
+  // Adds |components| to weaved in one call. |errors| receives an error
+  // message for each component, empty if the component was added. Returns
+  // false if the call itself failed.
+  bool SendComponents(const std::vector<ComponentTraits>& components,
+                      std::vector<android::String16>* errors,
+                      brillo::ErrorPtr* error);
+
+  // Registers the command handlers, given as (component, command) pairs, with
+  // weaved in one call. Failures are logged and the failed handlers are
+  // removed from the journal, so that adding them again retries.
+  void SendCommandHandlers(
+      const std::vector<std::pair<std::string, std::string>>& handlers);
+
+  // Registers the command handlers added since the last call.
+  void SendPendingCommandHandlers();
+
+  // Sends the state update for |component| to weaved.
+  bool SendStateProperties(const std::string& component,
+                           const base::DictionaryValue& dict,
+                           brillo::ErrorPtr* error);
+
+  // Flushes the pending state updates when the coalescing interval expires.
+  void OnStateFlushTimer();
+
+  // Reads the string property for |notification_id| from the notification
+  // |values|, or from the service manager if |values| is nullptr.
+  bool GetNotificationValue(int notification_id,
+                            const base::DictionaryValue* values,
+                            std::string* value) const;
+
+  // Adds |callback| to the command handler index in the journal and registers
+  // the command with weaved, unless the command is already registered, in
+  // which case the existing handler is replaced. |command_name| is either a
+  // full command name or a wildcard ("<trait>.*" or "*").
+  void RegisterCommandHandler(const std::string& component,
+                              const std::string& command_name,
+                              const CommandHandlerCallback& callback);
+
+  // Removes the handler for |command_name| of |component| from the journal.
+  void RemoveCommandHandler(const std::string& component,
+                            const std::string& command_name);
+
+  // Returns the handler for |command_name| of |component|, falling back to
+  // the trait and component default handlers, or nullptr if there are none.
+  const CommandHandlerCallback* FindCommandHandler(
+      const std::string& component,
+      const std::string& command_name) const;
+
   android::BinderWrapper* binder_wrapper_;
   brillo::MessageLoop* message_loop_;
   ServiceSubscription* service_subscription_;
@@ -237,13 +404,25 @@ class ServiceImpl : public std::enable_shared_from_this<ServiceImpl>,
   android::sp<android::weave::IWeaveService> weave_service_;
   PairingInfoCallback pairing_info_callback_;
   PairingInfo pairing_info_;
-
-  struct CommandHandlerEntry {
-    std::string component;
-    std::string command_name;
-    CommandHandlerCallback callback;
-  };
-  std::vector<CommandHandlerEntry> command_handlers_;
+  int connect_retry_delay_ms_{kInitialConnectRetryDelayMs};
+  // Owned by |service_subscription_|.
+  RegistrationJournal* journal_;
+
+  // Command handlers, as (component, command) pairs, not yet registered with
+  // weaved (see SendPendingCommandHandlers()).
+  std::vector<std::pair<std::string, std::string>> pending_command_handlers_;
+  brillo::MessageLoop::TaskId command_handler_task_{
+      brillo::MessageLoop::kTaskIdNull};
+
+  // State coalescing parameters (see Service::SetStateCoalescing()) and the
+  // pending state updates, keyed by component name.
+  base::TimeDelta state_flush_interval_;
+  size_t max_pending_state_properties_{0};
+  std::map<std::string, std::unique_ptr<base::DictionaryValue>> pending_state_;
+  // The number of distinct property values in |pending_state_|.
+  size_t pending_state_property_count_{0};
+  brillo::MessageLoop::TaskId state_flush_task_{
+      brillo::MessageLoop::kTaskIdNull};
 
   base::WeakPtrFactory<ServiceImpl> weak_ptr_factory_{this};
   DISALLOW_COPY_AND_ASSIGN(ServiceImpl);
@@ -284,7 +463,16 @@ android::binder::Status NotificationListener::notifyServiceManagerChange(
     const std::vector<int>& notificationIds) {
   auto service_proxy = service_.lock();
   if (service_proxy)
-    service_proxy->OnNotification(notificationIds);
+    service_proxy->OnNotification(notificationIds, nullptr);
+  return android::binder::Status::ok();
+}
+
+android::binder::Status NotificationListener::notifyServiceManagerValues(
+    const std::vector<int>& notificationIds,
+    const android::weave::ParcelableDictionary& values) {
+  auto service_proxy = service_.lock();
+  if (service_proxy)
+    service_proxy->OnNotification(notificationIds, &values.dict());
   return android::binder::Status::ok();
 }
 
@@ -295,11 +483,14 @@ ServiceImpl::ServiceImpl(android::BinderWrapper* binder_wrapper,
     : binder_wrapper_{binder_wrapper},
       message_loop_{message_loop},
       service_subscription_{service_subscription},
-      connection_callback_{connection_callback} {
+      connection_callback_{connection_callback},
+      journal_{service_subscription->journal()} {
 }
 
 ServiceImpl::~ServiceImpl() {
   if (weave_service_.get()) {
+    if (!pending_state_.empty())
+      Flush(nullptr);
     android::sp<android::IBinder> binder =
         android::IInterface::asBinder(weave_service_);
     binder_wrapper_->UnregisterForDeathNotifications(binder);
@@ -310,15 +501,72 @@ bool ServiceImpl::AddComponent(const std::string& component,
                                const std::vector<std::string>& traits,
                                brillo::ErrorPtr* error) {
   CHECK(weave_service_.get());
-  std::vector<android::String16> trait_list;
-  auto to_string16 = [](const std::string& name) {
-    return android::String16{name.c_str()};
-  };
-  std::transform(traits.begin(), traits.end(), std::back_inserter(trait_list),
-                 to_string16);
-  return StatusToError(weave_service_->addComponent(to_string16(component),
-                                                    trait_list),
-                       error);
+  // Components from the journal are re-added by ReplayJournal(), so adding
+  // them again on reconnect is a no-op.
+  const std::vector<std::string>* journal_traits =
+      journal_->FindComponent(component);
+  if (journal_traits && *journal_traits == traits)
+    return true;
+  if (!StatusToError(weave_service_->addComponent(ToString16(component),
+                                                  ToString16List(traits)),
+                     error)) {
+    return false;
+  }
+  journal_->components.emplace_back(component, traits);
+  return true;
+}
+
+bool ServiceImpl::AddComponents(const std::vector<ComponentTraits>& components,
+                                brillo::ErrorPtr* error) {
+  CHECK(weave_service_.get());
+  std::vector<ComponentTraits> new_components;
+  for (const auto& component : components) {
+    const std::vector<std::string>* journal_traits =
+        journal_->FindComponent(component.first);
+    if (!journal_traits || *journal_traits != component.second)
+      new_components.push_back(component);
+  }
+  if (new_components.empty())
+    return true;
+
+  std::vector<android::String16> errors;
+  if (!SendComponents(new_components, &errors, error))
+    return false;
+  bool success = true;
+  for (size_t i = 0; i < new_components.size(); i++) {
+    const std::string& name = new_components[i].first;
+    if (i < errors.size() && errors[i].size() == 0) {
+      journal_->components.push_back(new_components[i]);
+      continue;
+    }
+    std::string message =
+        i < errors.size() ? ToString(errors[i]) : "No result from weaved";
+    brillo::Error::AddToPrintf(error, FROM_HERE, "weaved", "add_component",
+                               "Failed to add component '%s': %s",
+                               name.c_str(), message.c_str());
+    success = false;
+  }
+  return success;
+}
+
+bool ServiceImpl::SendComponents(
+    const std::vector<ComponentTraits>& components,
+    std::vector<android::String16>* errors,
+    brillo::ErrorPtr* error) {
+  std::vector<android::String16> names;
+  std::vector<int32_t> trait_counts;
+  std::vector<android::String16> traits;
+  names.reserve(components.size());
+  trait_counts.reserve(components.size());
+  for (const auto& component : components) {
+    names.push_back(ToString16(component.first));
+    trait_counts.push_back(static_cast<int32_t>(component.second.size()));
+    for (const std::string& trait : component.second)
+      traits.push_back(ToString16(trait));
+  }
+  return StatusToError(
+      weave_service_->addComponents(names, trait_counts, traits, errors),
+      error);
 }
 
 void ServiceImpl::AddCommandHandler(const std::string& component,
@@ -326,21 +574,111 @@ void ServiceImpl::AddCommandHandler(const std::string& component,
                                     const std::string& command_name,
                                     const CommandHandlerCallback& callback) {
   CHECK(!component.empty() && !command_name.empty());
-  CHECK(weave_service_.get());
-
   std::string full_command_name =
       base::StringPrintf("%s.%s", trait_name.c_str(), command_name.c_str());
+  RegisterCommandHandler(component, full_command_name, callback);
+}
+
+void ServiceImpl::AddDefaultCommandHandler(
+    const std::string& component,
+    const std::string& trait_name,
+    const CommandHandlerCallback& callback) {
+  CHECK(!component.empty());
+  std::string wildcard = trait_name.empty() ? "*" : trait_name + ".*";
+  RegisterCommandHandler(component, wildcard, callback);
+}
 
-  CommandHandlerEntry entry;
-  entry.component = component;
-  entry.command_name = full_command_name;
-  entry.callback = callback;
-  command_handlers_.push_back(std::move(entry));
+void ServiceImpl::RegisterCommandHandler(
+    const std::string& component,
+    const std::string& command_name,
+    const CommandHandlerCallback& callback) {
+  CHECK(weave_service_.get());
+  RegistrationJournal::CommandHandlerMap& handlers =
+      journal_->command_handlers[component];
+  auto it = handlers.find(command_name);
+  if (it != handlers.end()) {
+    it->second = callback;
+    return;
+  }
+  handlers.emplace(command_name, callback);
 
-  auto status = weave_service_->registerCommandHandler(
-      android::String16{component.c_str()},
-      android::String16{full_command_name.c_str()});
-  CHECK(status.isOk());
+  pending_command_handlers_.emplace_back(component, command_name);
+  if (command_handler_task_ == brillo::MessageLoop::kTaskIdNull) {
+    command_handler_task_ = message_loop_->PostTask(
+        FROM_HERE,
+        base::Bind(&ServiceImpl::SendPendingCommandHandlers,
+                   weak_ptr_factory_.GetWeakPtr()));
+  }
+}
+
+void ServiceImpl::SendPendingCommandHandlers() {
+  command_handler_task_ = brillo::MessageLoop::kTaskIdNull;
+  std::vector<std::pair<std::string, std::string>> handlers;
+  std::swap(handlers, pending_command_handlers_);
+  SendCommandHandlers(handlers);
+}
+
+void ServiceImpl::SendCommandHandlers(
+    const std::vector<std::pair<std::string, std::string>>& handlers) {
+  if (handlers.empty())
+    return;
+  std::vector<android::String16> components;
+  std::vector<android::String16> commands;
+  components.reserve(handlers.size());
+  commands.reserve(handlers.size());
+  for (const auto& pair : handlers) {
+    components.push_back(ToString16(pair.first));
+    commands.push_back(ToString16(pair.second));
+  }
+  std::vector<android::String16> errors;
+  brillo::ErrorPtr error;
+  if (!StatusToError(
+          weave_service_->registerCommandHandlers(components, commands,
+                                                  &errors),
+          &error)) {
+    LOG(ERROR) << "Failed to register command handlers: "
+               << error->GetMessage();
+    for (const auto& pair : handlers)
+      RemoveCommandHandler(pair.first, pair.second);
+    return;
+  }
+  for (size_t i = 0; i < handlers.size(); i++) {
+    if (i < errors.size() && errors[i].size() == 0)
+      continue;
+    LOG(ERROR) << "Failed to register command handler '" << handlers[i].second
+               << "' of component '" << handlers[i].first << "': "
+               << (i < errors.size() ? ToString(errors[i]) : "no result");
+    RemoveCommandHandler(handlers[i].first, handlers[i].second);
+  }
+}
+
+void ServiceImpl::RemoveCommandHandler(const std::string& component,
+                                       const std::string& command_name) {
+  auto component_it = journal_->command_handlers.find(component);
+  if (component_it == journal_->command_handlers.end())
+    return;
+  component_it->second.erase(command_name);
+  if (component_it->second.empty())
+    journal_->command_handlers.erase(component_it);
+}
+
+const Service::CommandHandlerCallback* ServiceImpl::FindCommandHandler(
+    const std::string& component,
+    const std::string& command_name) const {
+  auto component_it = journal_->command_handlers.find(component);
+  if (component_it == journal_->command_handlers.end())
+    return nullptr;
+  const RegistrationJournal::CommandHandlerMap& handlers =
+      component_it->second;
+  auto it = handlers.find(command_name);
+  if (it == handlers.end()) {
+    size_t pos = command_name.find('.');
+    if (pos != std::string::npos)
+      it = handlers.find(command_name.substr(0, pos) + ".*");
+  }
+  if (it == handlers.end())
+    it = handlers.find("*");
+  return it != handlers.end() ? &it->second : nullptr;
 }
 
 bool ServiceImpl::SetStateProperties(const std::string& component,
@@ -348,9 +686,60 @@ bool ServiceImpl::SetStateProperties(const std::string& component,
                                      brillo::ErrorPtr* error) {
   CHECK(!component.empty());
   CHECK(weave_service_.get());
-  return StatusToError(weave_service_->updateState(ToString16(component),
-                                                   ToString16(dict)),
-                       error);
+  std::unique_ptr<base::DictionaryValue>& known_state =
+      journal_->state[component];
+  if (!known_state)
+    known_state.reset(new base::DictionaryValue);
+  // Skip the updates weaved already has or receives with the next flush, e.g.
+  // the state re-sent by the client after the journal has been replayed on
+  // reconnect. The journal only records the values weaved has accepted.
+  const base::DictionaryValue* expected_state = known_state.get();
+  std::unique_ptr<base::DictionaryValue> merged_state;
+  auto pending_it = pending_state_.find(component);
+  if (pending_it != pending_state_.end()) {
+    merged_state.reset(known_state->DeepCopy());
+    merged_state->MergeDictionary(pending_it->second.get());
+    expected_state = merged_state.get();
+  }
+  if (ContainsState(*expected_state, dict))
+    return true;
+
+  if (state_flush_interval_.is_zero()) {
+    if (!SendStateProperties(component, dict, error))
+      return false;
+    known_state->MergeDictionary(&dict);
+    return true;
+  }
+
+  std::unique_ptr<base::DictionaryValue>& pending = pending_state_[component];
+  if (!pending)
+    pending.reset(new base::DictionaryValue);
+  // Count the distinct pending properties, so that repeated updates of the
+  // same property don't trigger an early flush.
+  pending_state_property_count_ -= CountStateProperties(*pending);
+  pending->MergeDictionary(&dict);
+  pending_state_property_count_ += CountStateProperties(*pending);
+  if (max_pending_state_properties_ > 0 &&
+      pending_state_property_count_ >= max_pending_state_properties_) {
+    return Flush(error);
+  }
+  if (state_flush_task_ == brillo::MessageLoop::kTaskIdNull) {
+    state_flush_task_ = message_loop_->PostDelayedTask(
+        FROM_HERE,
+        base::Bind(&ServiceImpl::OnStateFlushTimer,
+                   weak_ptr_factory_.GetWeakPtr()),
+        state_flush_interval_);
+  }
+  return true;
+}
+
+bool ServiceImpl::SendStateProperties(const std::string& component,
+                                      const base::DictionaryValue& dict,
+                                      brillo::ErrorPtr* error) {
+  return StatusToError(
+      weave_service_->setStateProperties(
+          ToString16(component), android::weave::ParcelableDictionary{&dict}),
+      error);
 }
 
 bool ServiceImpl::SetStateProperty(const std::string& component,
@@ -365,6 +754,50 @@ bool ServiceImpl::SetStateProperty(const std::string& component,
   return SetStateProperties(component, dict, error);
 }
 
+void ServiceImpl::SetStateCoalescing(base::TimeDelta flush_interval,
+                                     size_t max_pending_properties) {
+  state_flush_interval_ = flush_interval;
+  max_pending_state_properties_ = max_pending_properties;
+  if (state_flush_interval_.is_zero() && !pending_state_.empty()) {
+    brillo::ErrorPtr error;
+    if (!Flush(&error))
+      LOG(ERROR) << "Failed to update device state: " << error->GetMessage();
+  }
+}
+
+bool ServiceImpl::Flush(brillo::ErrorPtr* error) {
+  if (state_flush_task_ != brillo::MessageLoop::kTaskIdNull) {
+    message_loop_->CancelTask(state_flush_task_);
+    state_flush_task_ = brillo::MessageLoop::kTaskIdNull;
+  }
+  CHECK(weave_service_.get());
+  std::map<std::string, std::unique_ptr<base::DictionaryValue>> pending_state;
+  std::swap(pending_state, pending_state_);
+  pending_state_property_count_ = 0;
+  bool success = true;
+  for (const auto& pair : pending_state) {
+    // Rejected values are dropped, so that they are neither replayed on
+    // reconnect nor mistaken for the current state by SetStateProperties().
+    if (!SendStateProperties(pair.first, *pair.second, error)) {
+      success = false;
+      continue;
+    }
+    std::unique_ptr<base::DictionaryValue>& known_state =
+        journal_->state[pair.first];
+    if (!known_state)
+      known_state.reset(new base::DictionaryValue);
+    known_state->MergeDictionary(pair.second.get());
+  }
+  return success;
+}
+
+void ServiceImpl::OnStateFlushTimer() {
+  state_flush_task_ = brillo::MessageLoop::kTaskIdNull;
+  brillo::ErrorPtr error;
+  if (!Flush(&error))
+    LOG(ERROR) << "Failed to update device state: " << error->GetMessage();
+}
+
 void ServiceImpl::SetPairingInfoListener(const PairingInfoCallback& callback) {
   pairing_info_callback_ = callback;
   if (!pairing_info_callback_.is_null() &&
@@ -384,36 +817,70 @@ void ServiceImpl::BeginConnect() {
 void ServiceImpl::OnServiceConnected(
     const android::sp<android::weave::IWeaveService>& service) {
   weave_service_ = service;
+  ReplayJournal();
   connection_callback_.Run(shared_from_this());
 }
 
+void ServiceImpl::ReplayJournal() {
+  if (!journal_->components.empty()) {
+    std::vector<android::String16> errors;
+    brillo::ErrorPtr error;
+    if (!SendComponents(journal_->components, &errors, &error)) {
+      LOG(ERROR) << "Failed to re-add components: " << error->GetMessage();
+    } else {
+      for (size_t i = 0; i < errors.size(); i++) {
+        if (errors[i].size() > 0) {
+          LOG(ERROR) << "Failed to re-add component '"
+                     << journal_->components[i].first
+                     << "': " << ToString(errors[i]);
+        }
+      }
+    }
+  }
+  for (const auto& pair : journal_->state) {
+    brillo::ErrorPtr error;
+    if (!pair.second->empty() &&
+        !SendStateProperties(pair.first, *pair.second, &error)) {
+      LOG(ERROR) << "Failed to restore state of component '" << pair.first
+                 << "': " << error->GetMessage();
+    }
+  }
+  std::vector<std::pair<std::string, std::string>> handlers;
+  for (const auto& component : journal_->command_handlers) {
+    for (const auto& handler : component.second)
+      handlers.emplace_back(component.first, handler.first);
+  }
+  SendCommandHandlers(handlers);
+}
+
 void ServiceImpl::OnCommand(
     const std::string& component_name,
     const std::string& command_name,
     const android::sp<android::weave::IWeaveCommand>& command) {
   VLOG(2) << "Weave command received for component '" << component_name << "': "
           << command_name;
-  for (const auto& entry : command_handlers_) {
-    if (entry.component == component_name &&
-        entry.command_name == command_name) {
-      std::unique_ptr<Command> command_instance{new Command{command}};
-      return entry.callback.Run(std::move(command_instance));
-    }
+  const CommandHandlerCallback* callback =
+      FindCommandHandler(component_name, command_name);
+  if (callback) {
+    std::unique_ptr<Command> command_instance{new Command{command}};
+    return callback->Run(std::move(command_instance));
   }
   LOG(WARNING) << "Unexpected command notification. Command = " << command_name
                << ", component = " << component_name;
 }
 
 void ServiceImpl::TryConnecting() {
-  LOG(INFO) << "Connecting to weave service over binder";
+  VLOG(1) << "Connecting to weave service over binder";
   android::sp<android::IBinder> binder =
       binder_wrapper_->GetService(weaved::binder::kWeaveServiceName);
   if (!binder.get()) {
-    LOG(WARNING) << "Weave service is not available yet. Will try again later";
+    base::TimeDelta delay = GetConnectRetryDelay();
+    VLOG(1) << "Weave service is not available yet. Will try again in "
+            << delay.InMilliseconds() << " ms";
     message_loop_->PostDelayedTask(
         FROM_HERE,
         base::Bind(&ServiceImpl::TryConnecting, weak_ptr_factory_.GetWeakPtr()),
-        base::TimeDelta::FromSeconds(1));
+        delay);
     return;
   }
 
@@ -431,7 +898,20 @@ void ServiceImpl::TryConnecting() {
   weave_service_manager_->connect(weave_client);
   android::sp<NotificationListener> notification_listener =
       new NotificationListener{shared_from_this()};
-  weave_service_manager_->registerNotificationListener(notification_listener);
+  weave_service_manager_->registerNotificationListenerWithValues(
+      notification_listener);
+  // Only the pairing info is tracked (see OnNotification()).
+  weave_service_manager_->setNotificationMask(
+      notification_listener,
+      android::weave::IWeaveServiceManagerNotificationListener::PAIRING_MASK);
+}
+
+base::TimeDelta ServiceImpl::GetConnectRetryDelay() {
+  int delay_ms = connect_retry_delay_ms_ / 2 +
+                 base::RandInt(0, connect_retry_delay_ms_);
+  connect_retry_delay_ms_ =
+      std::min(connect_retry_delay_ms_ * 2, kMaxConnectRetryDelayMs);
+  return base::TimeDelta::FromMilliseconds(delay_ms);
 }
 
 void ServiceImpl::OnWeaveServiceDisconnected() {
@@ -456,32 +936,28 @@ void ServiceImpl::ReconnectOnServiceDisconnection() {
   // because the object is destroyed now.
 }
 
-void ServiceImpl::OnNotification(const std::vector<int>& notification_ids) {
+void ServiceImpl::OnNotification(const std::vector<int>& notification_ids,
+                                 const base::DictionaryValue* values) {
   bool pairing_info_changed = false;
   using NotificationListener =
       android::weave::IWeaveServiceManagerNotificationListener;
-  android::String16 string_value;
   for (int id : notification_ids) {
+    std::string* field = nullptr;
     switch (id) {
       case NotificationListener::PAIRING_SESSION_ID:
-        if (weave_service_manager_->getPairingSessionId(&string_value).isOk()) {
-          pairing_info_changed = true;
-          pairing_info_.session_id = ToString(string_value);
-        }
+        field = &pairing_info_.session_id;
         break;
       case NotificationListener::PAIRING_MODE:
-        if (weave_service_manager_->getPairingMode(&string_value).isOk()) {
-          pairing_info_changed = true;
-          pairing_info_.pairing_mode = ToString(string_value);
-        }
+        field = &pairing_info_.pairing_mode;
         break;
       case NotificationListener::PAIRING_CODE:
-        if (weave_service_manager_->getPairingCode(&string_value).isOk()) {
-          pairing_info_changed = true;
-          pairing_info_.pairing_code = ToString(string_value);
-        }
+        field = &pairing_info_.pairing_code;
         break;
+      default:
+        continue;
     }
+    if (GetNotificationValue(id, values, field))
+      pairing_info_changed = true;
   }
 
   if (!pairing_info_changed || pairing_info_callback_.is_null())
@@ -495,6 +971,37 @@ void ServiceImpl::OnNotification(const std::vector<int>& notification_ids) {
   }
 }
 
+bool ServiceImpl::GetNotificationValue(int notification_id,
+                                       const base::DictionaryValue* values,
+                                       std::string* value) const {
+  if (values) {
+    return values->GetStringWithoutPathExpansion(
+        weaved::binder::GetNotificationValueKey(notification_id), value);
+  }
+
+  using NotificationListener =
+      android::weave::IWeaveServiceManagerNotificationListener;
+  android::String16 string_value;
+  android::binder::Status status;
+  switch (notification_id) {
+    case NotificationListener::PAIRING_SESSION_ID:
+      status = weave_service_manager_->getPairingSessionId(&string_value);
+      break;
+    case NotificationListener::PAIRING_MODE:
+      status = weave_service_manager_->getPairingMode(&string_value);
+      break;
+    case NotificationListener::PAIRING_CODE:
+      status = weave_service_manager_->getPairingCode(&string_value);
+      break;
+    default:
+      return false;
+  }
+  if (!status.isOk())
+    return false;
+  *value = ToString(string_value);
+  return true;
+}
+
 std::unique_ptr<Service::Subscription> Service::Connect(
     brillo::MessageLoop* message_loop,
     const ConnectionCallback& callback) {
@@ -17,11 +17,13 @@
 
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <base/callback.h>
 #include <base/compiler_specific.h>
 #include <base/macros.h>
+#include <base/time/time.h>
 #include <brillo/errors/error.h>
 #include <libweaved/command.h>
 #include <libweaved/export.h>
@@ -52,27 +54,57 @@ class LIBWEAVED_EXPORT Service {
   using PairingInfoCallback =
       base::Callback<void(const PairingInfo* pairing_info)>;
 
+  // A component name and the list of trait names the component supports.
+  using ComponentTraits = std::pair<std::string, std::vector<std::string>>;
+
   Service() = default;
   virtual ~Service() = default;
 
   // Adds a new component instance to device.
   // |component| is a component name being added.
   // |traits| is a list of trait names this component supports.
+  // Adding a component that was already added with the same traits is a no-op.
   virtual bool AddComponent(const std::string& component,
                             const std::vector<std::string>& traits,
                             brillo::ErrorPtr* error) = 0;
 
+  // Adds several component instances to the device in a single call to
+  // weaved. Returns false if any of the |components| could not be added, in
+  // which case |error| describes each failure. The other components are still
+  // added.
+  virtual bool AddComponents(const std::vector<ComponentTraits>& components,
+                             brillo::ErrorPtr* error) = 0;
+
   // Sets handler for new commands added to the queue for a given |component|.
   // |command_name| is the name of the command to handle (e.g. "reboot").
   // |trait_name| is the name of a trait the command belongs to (e.g. "base").
-  // Each command can have no more than one handler.
+  // Each command can have no more than one handler. Adding a handler for
+  // a command that already has one replaces the previous handler.
+  // The handlers added during one message loop task are registered with weaved
+  // in a single call once the task completes, so a registration failure can't
+  // be reported to the caller. Instead, it is logged and the handler is
+  // dropped, so that adding it again retries the registration.
   virtual void AddCommandHandler(const std::string& component,
                                  const std::string& trait_name,
                                  const std::string& command_name,
                                  const CommandHandlerCallback& callback) = 0;
 
+  // Sets a fallback handler for commands sent to |component| which do not
+  // have a specific handler set by AddCommandHandler().
+  // If |trait_name| is not empty, the handler receives the commands of that
+  // trait only, otherwise it receives the commands of all the traits the
+  // component implements. A trait-specific fallback handler takes precedence
+  // over the component-wide one. The component must be added to the device
+  // before calling this method. The handler is registered with weaved
+  // asynchronously, as with AddCommandHandler().
+  virtual void AddDefaultCommandHandler(
+      const std::string& component,
+      const std::string& trait_name,
+      const CommandHandlerCallback& callback) = 0;
+
   // Sets a number of state properties for a given |component|.
   // |dict| is a dictionary containing property-name/property-value pairs.
+  // Values that are unchanged since the last update are not sent to weaved.
   virtual bool SetStateProperties(const std::string& component,
                                   const base::DictionaryValue& dict,
                                   brillo::ErrorPtr* error) = 0;
@@ -87,6 +119,22 @@ class LIBWEAVED_EXPORT Service {
                                 const base::Value& value,
                                 brillo::ErrorPtr* error) = 0;
 
+  // Enables coalescing of state updates. While enabled, SetStateProperties()
+  // and SetStateProperty() merge the new values into a pending dictionary per
+  // component instead of sending them to weaved right away. Pending updates
+  // are sent at most once per |flush_interval|, or as soon as
+  // |max_pending_properties| distinct property values are pending (0 means no
+  // limit). Since pending values are validated by weaved only when they are
+  // flushed, errors in the background flushes are logged, not reported back.
+  // The values weaved rejects are dropped, so setting them again resends them.
+  // Passing a zero |flush_interval| disables coalescing and flushes any
+  // pending updates.
+  virtual void SetStateCoalescing(base::TimeDelta flush_interval,
+                                  size_t max_pending_properties) = 0;
+
+  // Sends all the pending coalesced state updates to weaved immediately.
+  virtual bool Flush(brillo::ErrorPtr* error) = 0;
+
   // Specifies a callback to be invoked when the device enters/exist pairing
   // mode. The |pairing_info| parameter is set to a pointer to pairing
   // information on starting the pairing session and is nullptr when the pairing
@@ -121,10 +169,11 @@ class LIBWEAVED_EXPORT Service {
   // weaved is lost. If this happens, a connection is re-established and the
   // |callback| is called again with a new instance of the service.
   // Therefore, if locking the |service| produces nullptr, this means that the
-  // service got disconnected, so no further action can be taken. Since the
-  // |callback| will be invoked with the new service instance when connection
-  // is re-established, it's a good idea to update the device state on each
-  // invocation of the callback (along with registering command handlers, etc).
+  // service got disconnected, so no further action can be taken. When the
+  // connection is re-established, the components, command handlers and state
+  // registered through the previous instance are restored automatically before
+  // the |callback| is invoked with the new service instance. Repeating the
+  // same registrations from the |callback| is harmless, as they are no-ops.
   // IMPORTANT: Keep the returned subscription object around for as long as the
   // service is needed. As soon as the subscription is destroyed, the connection
   // to weaved is terminated and the service instance is discarded.
@@ -0,0 +1,576 @@
+// Copyright 2016 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "libweaved/service.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <base/bind.h>
+#include <base/test/simple_test_clock.h>
+#include <base/values.h>
+#include <binderwrapper/binder_wrapper.h>
+#include <binderwrapper/stub_binder_wrapper.h>
+#include <brillo/message_loops/fake_message_loop.h>
+#include <gtest/gtest.h>
+
+#include "android/weave/BnWeaveService.h"
+#include "android/weave/BnWeaveServiceManager.h"
+#include "android/weave/IWeaveClient.h"
+#include "android/weave/IWeaveCommand.h"
+#include "common/binder_constants.h"
+#include "common/binder_utils.h"
+#include "common/parcelable_dictionary.h"
+
+using weaved::binder_utils::ToJson;
+using weaved::binder_utils::ToString;
+
+namespace weaved {
+
+namespace {
+
+const char kComponent[] = "myComponent";
+
+// Records the calls a client makes to its IWeaveService.
+class FakeWeaveService : public android::weave::BnWeaveService {
+ public:
+  android::binder::Status addComponent(
+      const android::String16& name,
+      const std::vector<android::String16>& traits) override {
+    components.push_back(ToString(name));
+    return android::binder::Status::ok();
+  }
+  android::binder::Status registerCommandHandler(
+      const android::String16& component,
+      const android::String16& command) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status addComponents(
+      const std::vector<android::String16>& names,
+      const std::vector<int32_t>& traitCounts,
+      const std::vector<android::String16>& traits,
+      std::vector<android::String16>* errors) override {
+    for (const android::String16& name : names) {
+      std::string component = ToString(name);
+      errors->push_back(android::String16{
+          component == invalid_component ? "Invalid component" : ""});
+      if (component != invalid_component)
+        components.push_back(component);
+    }
+    return android::binder::Status::ok();
+  }
+  android::binder::Status registerCommandHandlers(
+      const std::vector<android::String16>& components,
+      const std::vector<android::String16>& commands,
+      std::vector<android::String16>* errors) override {
+    registration_calls++;
+    if (reject_handlers) {
+      return android::binder::Status::fromServiceSpecificError(
+          1, android::String8{"Unavailable"});
+    }
+    for (size_t i = 0; i < components.size(); i++) {
+      std::string command = ToString(commands[i]);
+      errors->push_back(android::String16{
+          command == unknown_command ? "Unknown command" : ""});
+      if (command != unknown_command)
+        handlers.push_back(ToString(components[i]) + ":" + command);
+    }
+    return android::binder::Status::ok();
+  }
+  android::binder::Status updateState(
+      const android::String16& component,
+      const android::String16& state) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status setStateProperties(
+      const android::String16& component,
+      const android::weave::ParcelableDictionary& properties) override {
+    state_updates.push_back(ToJson(properties.dict()));
+    if (reject_state) {
+      return android::binder::Status::fromServiceSpecificError(
+          1, android::String8{"Invalid state"});
+    }
+    return android::binder::Status::ok();
+  }
+
+  // The names of the added components.
+  std::vector<std::string> components;
+  // A component addComponents() reports an error for.
+  std::string invalid_component;
+  // The number of registerCommandHandlers() calls.
+  int registration_calls{0};
+  // The registered handlers as "<component>:<command>".
+  std::vector<std::string> handlers;
+  // Makes registerCommandHandlers() fail.
+  bool reject_handlers{false};
+  // A command registerCommandHandlers() reports an error for.
+  std::string unknown_command;
+  // The JSON of each setStateProperties() call, in order.
+  std::vector<std::string> state_updates;
+  // Makes setStateProperties() fail.
+  bool reject_state{false};
+};
+
+// Keeps the client that connected to weaved.
+class FakeWeaveServiceManager : public android::weave::BnWeaveServiceManager {
+ public:
+  using Listener =
+      android::sp<android::weave::IWeaveServiceManagerNotificationListener>;
+
+  android::binder::Status connect(
+      const android::sp<android::weave::IWeaveClient>& client) override {
+    this->client = client;
+    return android::binder::Status::ok();
+  }
+  android::binder::Status registerNotificationListener(
+      const Listener& listener) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status registerNotificationListenerWithValues(
+      const Listener& listener) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status setNotificationMask(const Listener& listener,
+                                              int32_t mask) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getCloudId(android::String16* id) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getDeviceId(android::String16* id) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getDeviceName(android::String16* name) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getDeviceDescription(
+      android::String16* description) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getDeviceLocation(
+      android::String16* location) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getOemName(android::String16* name) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getModelName(android::String16* name) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getModelId(android::String16* id) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getPairingSessionId(android::String16* id) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getPairingMode(android::String16* mode) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getPairingCode(android::String16* code) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getState(android::String16* state) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getAllProperties(
+      android::weave::ParcelableDictionary* properties) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getDeviceInfo(
+      android::weave::DeviceInfo* info) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getTraits(android::String16* traits) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getComponents(
+      android::String16* components) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getTraitsIfChanged(
+      int64_t version,
+      android::weave::VersionedJson* traits) override {
+    return android::binder::Status::ok();
+  }
+  android::binder::Status getComponentsIfChanged(
+      int64_t version,
+      android::weave::VersionedJson* components) override {
+    return android::binder::Status::ok();
+  }
+
+  android::sp<android::weave::IWeaveClient> client;
+};
+
+}  // anonymous namespace
+
+class ServiceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    binder_wrapper_ = new android::StubBinderWrapper;
+    android::BinderWrapper::InitForTesting(binder_wrapper_);
+    service_manager_ = new FakeWeaveServiceManager;
+    weave_service_ = new FakeWeaveService;
+  }
+
+  void TearDown() override {
+    subscription_.reset();
+    android::BinderWrapper::Destroy();
+  }
+
+  // Registers the weave service manager with the binder service manager.
+  void RegisterWeaveService() {
+    binder_wrapper_->SetBinderForService(
+        binder::kWeaveServiceName,
+        android::IInterface::asBinder(service_manager_));
+  }
+
+  void StartConnecting() {
+    subscription_ = Service::Connect(
+        &message_loop_,
+        base::Bind(&ServiceTest::OnConnected, base::Unretained(this)));
+  }
+
+  // Makes weaved available and runs the connection until the client callback
+  // is invoked.
+  void Connect() {
+    RegisterWeaveService();
+    StartConnecting();
+    RunPendingTasks();
+    ASSERT_NE(nullptr, service_manager_->client.get());
+    service_manager_->client->onServiceConnected(weave_service_);
+    ASSERT_NE(nullptr, service_.lock());
+  }
+
+  void OnConnected(const std::weak_ptr<Service>& service) {
+    service_ = service;
+  }
+
+  // Kills weaved and connects to a new instance of it.
+  void Reconnect() {
+    binder_wrapper_->NotifyAboutBinderDeath(
+        android::IInterface::asBinder(service_manager_));
+    service_manager_ = new FakeWeaveServiceManager;
+    weave_service_ = new FakeWeaveService;
+    RegisterWeaveService();
+    RunPendingTasks();
+    ASSERT_NE(nullptr, service_manager_->client.get());
+    service_manager_->client->onServiceConnected(weave_service_);
+  }
+
+  // Runs the tasks that are due, without advancing the clock.
+  void RunPendingTasks() {
+    while (message_loop_.RunOnce(false)) {
+    }
+  }
+
+  void AdvanceTime(base::TimeDelta delta) {
+    clock_.Advance(delta);
+    RunPendingTasks();
+  }
+
+  // Adds a handler that records |name| in |handled_commands_|.
+  void AddCommandHandler(const std::string& trait,
+                         const std::string& command,
+                         const std::string& name) {
+    service_.lock()->AddCommandHandler(
+        kComponent, trait, command,
+        base::Bind(&ServiceTest::OnCommand, base::Unretained(this), name));
+  }
+
+  void OnCommand(const std::string& name, std::unique_ptr<Command> command) {
+    handled_commands_.push_back(name);
+  }
+
+  // Sends command |name| to the client, as weaved would. The handlers don't
+  // use the command, so it has no binder proxy.
+  void SendCommand(const std::string& name) {
+    service_manager_->client->onCommand(
+        android::String16{kComponent}, android::String16{name.c_str()},
+        android::sp<android::weave::IWeaveCommand>{});
+  }
+
+  bool SetBattery(int value, brillo::ErrorPtr* error) {
+    return service_.lock()->SetStateProperty(
+        kComponent, "robot", "battery", base::FundamentalValue{value}, error);
+  }
+
+  bool SetStatus(const std::string& value, brillo::ErrorPtr* error) {
+    return service_.lock()->SetStateProperty(
+        kComponent, "robot", "status", base::StringValue{value}, error);
+  }
+
+  base::SimpleTestClock clock_;
+  brillo::FakeMessageLoop message_loop_{&clock_};
+  android::StubBinderWrapper* binder_wrapper_;  // Owned by BinderWrapper.
+  android::sp<FakeWeaveServiceManager> service_manager_;
+  android::sp<FakeWeaveService> weave_service_;
+  std::unique_ptr<Service::Subscription> subscription_;
+  std::weak_ptr<Service> service_;
+  std::vector<std::string> handled_commands_;
+};
+
+TEST_F(ServiceTest, ConnectRetriesQuicklyAtFirst) {
+  StartConnecting();
+  RunPendingTasks();
+  EXPECT_EQ(nullptr, service_manager_->client.get());
+
+  // weaved shows up right after the first attempt. The first retry comes
+  // after 2 to 7 ms (5 ms +/- 50%).
+  RegisterWeaveService();
+  AdvanceTime(base::TimeDelta::FromMilliseconds(7));
+  EXPECT_NE(nullptr, service_manager_->client.get());
+}
+
+TEST_F(ServiceTest, ConnectRetryDelayIsCapped) {
+  StartConnecting();
+  for (int i = 0; i < 600; i++)
+    AdvanceTime(base::TimeDelta::FromMilliseconds(100));
+  EXPECT_EQ(nullptr, service_manager_->client.get());
+
+  // The delay is at most 1 s +/- 50%, even after a minute of retries.
+  RegisterWeaveService();
+  AdvanceTime(base::TimeDelta::FromMilliseconds(1500));
+  ASSERT_NE(nullptr, service_manager_->client.get());
+
+  service_manager_->client->onServiceConnected(weave_service_);
+  EXPECT_NE(nullptr, service_.lock());
+}
+
+TEST_F(ServiceTest, UnchangedStateIsNotResent) {
+  Connect();
+  EXPECT_TRUE(SetBattery(50, nullptr));
+  EXPECT_TRUE(SetBattery(50, nullptr));
+  EXPECT_TRUE(SetBattery(40, nullptr));
+  EXPECT_EQ((std::vector<std::string>{R"({"robot":{"battery":50}})",
+                                      R"({"robot":{"battery":40}})"}),
+            weave_service_->state_updates);
+}
+
+TEST_F(ServiceTest, CoalescedStateIsFlushedAfterInterval) {
+  Connect();
+  service_.lock()->SetStateCoalescing(base::TimeDelta::FromSeconds(1), 0);
+  EXPECT_TRUE(SetBattery(50, nullptr));
+  EXPECT_TRUE(SetStatus("idle", nullptr));
+  EXPECT_TRUE(SetBattery(40, nullptr));
+  AdvanceTime(base::TimeDelta::FromMilliseconds(999));
+  EXPECT_TRUE(weave_service_->state_updates.empty());
+
+  AdvanceTime(base::TimeDelta::FromMilliseconds(1));
+  EXPECT_EQ(
+      (std::vector<std::string>{R"({"robot":{"battery":40,"status":"idle"}})"}),
+      weave_service_->state_updates);
+}
+
+TEST_F(ServiceTest, CoalescedStateIsFlushedAtMaxPendingProperties) {
+  Connect();
+  service_.lock()->SetStateCoalescing(base::TimeDelta::FromSeconds(1), 2);
+  // Repeated updates of one property count once.
+  EXPECT_TRUE(SetBattery(50, nullptr));
+  EXPECT_TRUE(SetBattery(40, nullptr));
+  EXPECT_TRUE(weave_service_->state_updates.empty());
+
+  EXPECT_TRUE(SetStatus("idle", nullptr));
+  EXPECT_EQ(
+      (std::vector<std::string>{R"({"robot":{"battery":40,"status":"idle"}})"}),
+      weave_service_->state_updates);
+}
+
+TEST_F(ServiceTest, StateChangedBackWhilePendingIsSent) {
+  Connect();
+  service_.lock()->SetStateCoalescing(base::TimeDelta::FromSeconds(1), 0);
+  EXPECT_TRUE(SetBattery(50, nullptr));
+  EXPECT_TRUE(service_.lock()->Flush(nullptr));
+  // Back to the value weaved has, while a different one is pending.
+  EXPECT_TRUE(SetBattery(40, nullptr));
+  EXPECT_TRUE(SetBattery(50, nullptr));
+  EXPECT_TRUE(service_.lock()->Flush(nullptr));
+  EXPECT_EQ((std::vector<std::string>{R"({"robot":{"battery":50}})",
+                                      R"({"robot":{"battery":50}})"}),
+            weave_service_->state_updates);
+}
+
+TEST_F(ServiceTest, RejectedCoalescedStateIsNotRecorded) {
+  Connect();
+  service_.lock()->SetStateCoalescing(base::TimeDelta::FromSeconds(1), 0);
+  weave_service_->reject_state = true;
+  EXPECT_TRUE(SetBattery(50, nullptr));
+  brillo::ErrorPtr error;
+  EXPECT_FALSE(service_.lock()->Flush(&error));
+  EXPECT_NE(nullptr, error.get());
+
+  // The rejected value must not be taken for the current state.
+  weave_service_->reject_state = false;
+  EXPECT_TRUE(SetBattery(50, nullptr));
+  EXPECT_TRUE(service_.lock()->Flush(nullptr));
+  EXPECT_EQ((std::vector<std::string>{R"({"robot":{"battery":50}})",
+                                      R"({"robot":{"battery":50}})"}),
+            weave_service_->state_updates);
+}
+
+TEST_F(ServiceTest, AddComponents) {
+  Connect();
+  weave_service_->invalid_component = "b";
+  std::vector<Service::ComponentTraits> components{
+      {"a", {"robot"}}, {"b", {"lamp"}}, {"c", {}}};
+  brillo::ErrorPtr error;
+  EXPECT_FALSE(service_.lock()->AddComponents(components, &error));
+  ASSERT_NE(nullptr, error.get());
+  EXPECT_EQ("Failed to add component 'b': Invalid component",
+            error->GetMessage());
+  EXPECT_EQ((std::vector<std::string>{"a", "c"}),
+            weave_service_->components);
+
+  // Only the component that failed is sent again.
+  weave_service_->invalid_component.clear();
+  EXPECT_TRUE(service_.lock()->AddComponents(components, nullptr));
+  EXPECT_EQ((std::vector<std::string>{"a", "c", "b"}),
+            weave_service_->components);
+}
+
+TEST_F(ServiceTest, CommandHandlersAreRegisteredInOneCall) {
+  Connect();
+  AddCommandHandler("robot", "jump", "jump");
+  AddCommandHandler("robot", "sit", "sit");
+  EXPECT_EQ(0, weave_service_->registration_calls);
+
+  RunPendingTasks();
+  EXPECT_EQ(1, weave_service_->registration_calls);
+  EXPECT_EQ((std::vector<std::string>{"myComponent:robot.jump",
+                                      "myComponent:robot.sit"}),
+            weave_service_->handlers);
+}
+
+TEST_F(ServiceTest, ReplacedCommandHandlerIsNotReregistered) {
+  Connect();
+  AddCommandHandler("robot", "jump", "first");
+  RunPendingTasks();
+  AddCommandHandler("robot", "jump", "second");
+  RunPendingTasks();
+  EXPECT_EQ(1, weave_service_->registration_calls);
+
+  SendCommand("robot.jump");
+  EXPECT_EQ(std::vector<std::string>{"second"}, handled_commands_);
+}
+
+TEST_F(ServiceTest, FailedCommandHandlerIsRetried) {
+  Connect();
+  weave_service_->unknown_command = "robot.jump";
+  AddCommandHandler("robot", "jump", "jump");
+  AddCommandHandler("robot", "sit", "sit");
+  RunPendingTasks();
+  EXPECT_EQ(std::vector<std::string>{"myComponent:robot.sit"},
+            weave_service_->handlers);
+
+  weave_service_->unknown_command.clear();
+  AddCommandHandler("robot", "jump", "jump");
+  AddCommandHandler("robot", "sit", "sit");
+  RunPendingTasks();
+  EXPECT_EQ(2, weave_service_->registration_calls);
+  EXPECT_EQ((std::vector<std::string>{"myComponent:robot.sit",
+                                      "myComponent:robot.jump"}),
+            weave_service_->handlers);
+}
+
+TEST_F(ServiceTest, CommandHandlersAreRetriedAfterFailedCall) {
+  Connect();
+  weave_service_->reject_handlers = true;
+  AddCommandHandler("robot", "jump", "jump");
+  RunPendingTasks();
+  SendCommand("robot.jump");
+  EXPECT_TRUE(handled_commands_.empty());
+
+  weave_service_->reject_handlers = false;
+  AddCommandHandler("robot", "jump", "jump");
+  RunPendingTasks();
+  EXPECT_EQ(std::vector<std::string>{"myComponent:robot.jump"},
+            weave_service_->handlers);
+  SendCommand("robot.jump");
+  EXPECT_EQ(std::vector<std::string>{"jump"}, handled_commands_);
+}
+
+TEST_F(ServiceTest, DefaultCommandHandlers) {
+  Connect();
+  AddCommandHandler("robot", "jump", "jump");
+  service_.lock()->AddDefaultCommandHandler(
+      kComponent, "robot",
+      base::Bind(&ServiceTest::OnCommand, base::Unretained(this),
+                 std::string{"robot"}));
+  service_.lock()->AddDefaultCommandHandler(
+      kComponent, "",
+      base::Bind(&ServiceTest::OnCommand, base::Unretained(this),
+                 std::string{"any"}));
+  RunPendingTasks();
+  EXPECT_EQ((std::vector<std::string>{"myComponent:robot.jump",
+                                      "myComponent:robot.*",
+                                      "myComponent:*"}),
+            weave_service_->handlers);
+
+  SendCommand("robot.jump");
+  SendCommand("robot.sit");
+  SendCommand("lamp.on");
+  EXPECT_EQ((std::vector<std::string>{"jump", "robot", "any"}),
+            handled_commands_);
+}
+
+TEST_F(ServiceTest, ReconnectReplaysRegistrations) {
+  Connect();
+  std::shared_ptr<Service> service = service_.lock();
+  EXPECT_TRUE(service->AddComponent(kComponent, {"robot"}, nullptr));
+  AddCommandHandler("robot", "jump", "jump");
+  EXPECT_TRUE(SetBattery(50, nullptr));
+  RunPendingTasks();
+
+  std::weak_ptr<Service> old_service = service_;
+  service.reset();
+  Reconnect();
+  // The previous instance is invalidated before the callback gets a new one.
+  EXPECT_EQ(nullptr, old_service.lock());
+  ASSERT_NE(nullptr, service_.lock());
+  EXPECT_EQ(std::vector<std::string>{kComponent}, weave_service_->components);
+  EXPECT_EQ(std::vector<std::string>{R"({"robot":{"battery":50}})"},
+            weave_service_->state_updates);
+  EXPECT_EQ(1, weave_service_->registration_calls);
+  EXPECT_EQ(std::vector<std::string>{"myComponent:robot.jump"},
+            weave_service_->handlers);
+
+  // Repeating the registrations from the connection callback is a no-op.
+  EXPECT_TRUE(service_.lock()->AddComponent(kComponent, {"robot"}, nullptr));
+  AddCommandHandler("robot", "jump", "jump");
+  EXPECT_TRUE(SetBattery(50, nullptr));
+  RunPendingTasks();
+  EXPECT_EQ(1u, weave_service_->components.size());
+  EXPECT_EQ(1u, weave_service_->state_updates.size());
+  EXPECT_EQ(1, weave_service_->registration_calls);
+
+  SendCommand("robot.jump");
+  EXPECT_EQ(std::vector<std::string>{"jump"}, handled_commands_);
+}
+
+TEST_F(ServiceTest, ReconnectDoesNotReplayRejectedState) {
+  Connect();
+  service_.lock()->SetStateCoalescing(base::TimeDelta::FromSeconds(1), 0);
+  EXPECT_TRUE(SetBattery(50, nullptr));
+  EXPECT_TRUE(service_.lock()->Flush(nullptr));
+  weave_service_->reject_state = true;
+  EXPECT_TRUE(SetBattery(40, nullptr));
+  EXPECT_FALSE(service_.lock()->Flush(nullptr));
+
+  Reconnect();
+  EXPECT_EQ(std::vector<std::string>{R"({"robot":{"battery":50}})"},
+            weave_service_->state_updates);
+}
+
+}  // namespace weaved